@@ -31,6 +31,10 @@
  * When executing any of the ops from the command line, the program
  * first tries to contact the server, and does things itself if no
  * server is found (encurring 2-3 S of timeout in the latter case).
+ *
+ * The server keeps the state of all Receivers and Senders in memory,
+ * maintained from the device events, so that listing is immediate. It
+ * can also stream the changes to a client (-w).
  */
 #include "../src/config.h"
 
@@ -46,10 +50,21 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "libupnpp/upnpplib.hxx"
 #include "libupnpp/log.hxx"
 #include "libupnpp/control/linnsongcast.hxx"
+#include "libupnpp/control/discovery.hxx"
+#include "libupnpp/control/service.hxx"
 
 #include "../src/netcon.h"
 #include "../src/smallut.h"
@@ -70,57 +85,272 @@ using namespace Songcast;
 #define OPT_r 0x80
 #define OPT_s 0x100
 #define OPT_x 0x200
+#define OPT_w 0x400
+#define OPT_T 0x800
 
 static const string sep("||");
 
+static string receiverLine(const ReceiverState& scs, const string& dsep)
+{
+    ostringstream out;
+    switch (scs.state) {
+    case ReceiverState::SCRS_GENERROR:    out << "Error " << dsep;break;
+    case ReceiverState::SCRS_NOOH:        out << "Nooh  " << dsep;break;
+    case ReceiverState::SCRS_NOTRECEIVER: out << "Off   " << dsep;break;
+    case ReceiverState::SCRS_STOPPED:     out << "Stop  " << dsep;break;
+    case ReceiverState::SCRS_PLAYING:     out << "Play  " << dsep;break;
+    }
+    out << scs.nm << dsep;
+    out << scs.UDN << dsep;
+    if (scs.state == ReceiverState::SCRS_PLAYING) {
+        out << scs.uri;
+    } else if (scs.state == ReceiverState::SCRS_GENERROR) {
+        out << scs.reason;
+    }
+    out << endl;
+    return out.str();
+}
+
+static string senderLine(const SenderState& scs, const string& dsep)
+{
+    return scs.nm + dsep + scs.UDN + dsep + scs.reason + dsep + scs.uri + "\n";
+}
+
 string showReceivers(int ops)
 {
     vector<ReceiverState> vscs;
     listReceivers(vscs);
-    ostringstream out;
+    string out;
     string dsep = (ops & OPT_m) ? sep : " ";
     
     for (auto& scs: vscs) {
-        switch (scs.state) {
-        case ReceiverState::SCRS_GENERROR:    out << "Error " << dsep;break;
-        case ReceiverState::SCRS_NOOH:        out << "Nooh  " << dsep;break;
-        case ReceiverState::SCRS_NOTRECEIVER: out << "Off   " << dsep;break;
-        case ReceiverState::SCRS_STOPPED:     out << "Stop  " << dsep;break;
-        case ReceiverState::SCRS_PLAYING:     out << "Play  " << dsep;break;
-        }
-        out << scs.nm << dsep;
-        out << scs.UDN << dsep;
-        if (scs.state == ReceiverState::SCRS_PLAYING) {
-            out << scs.uri;
-        } else if (scs.state == ReceiverState::SCRS_GENERROR) {
-            out << scs.reason;
-        }
-        out << endl;
+        out += receiverLine(scs, dsep);
     }
-    return out.str();
+    return out;
 }
 
 string showSenders(int ops)
 {
     vector<SenderState> vscs;
     listSenders(vscs);
-    ostringstream out;
+    string out;
     string dsep = (ops & OPT_m) ? sep : " ";
 
     for (auto& scs: vscs) {
-        out << scs.nm << dsep;
-        out << scs.UDN << dsep;
-        out << scs.reason << dsep;
-        out << scs.uri;
-        out << endl;
+        out += senderLine(scs, dsep);
     }
-    return out.str();
+    return out;
+}
+
+// Receiver operations are run in parallel, on at most MAXPAR threads,
+// so that grouping N rooms does not cost N times the SOAP round
+// trips. An operation which is not done RCVTIMEOUT seconds after it
+// was started is reported as timed out (SOAP calls can't be
+// interrupted: the late workers finish in the background and their
+// results are ignored). A worker stuck on a late receiver is replaced
+// by a new one, so that the waiting receivers still get their full
+// time.
+enum {MAXPAR = 8, RCVTIMEOUT = 10};
+
+struct RcvResult {
+    enum Status {RCV_OK, RCV_FAILED, RCV_TIMEOUT};
+    Status status{RCV_TIMEOUT};
+    string reason;
+};
+
+// Run op(i, reason) for i in [0, cnt), return the results in order.
+static vector<RcvResult> fanout(unsigned int cnt,
+                                function<bool (int, string&)> op,
+                                unsigned int maxpar = MAXPAR)
+{
+    struct State {
+        mutex mtx;
+        condition_variable cv;
+        vector<RcvResult> results;
+        // Per receiver: deadline (set when started), and result
+        // final (done or timed out).
+        vector<chrono::steady_clock::time_point> deadlines;
+        vector<bool> settled;
+        unsigned int next{0};
+        unsigned int ndone{0};
+    };
+    auto state = make_shared<State>();
+    state->results.resize(cnt);
+    state->deadlines.resize(cnt);
+    state->settled.resize(cnt, false);
+
+    function<void ()> worker = [state, op, cnt] {
+        for (;;) {
+            unsigned int idx;
+            {
+                lock_guard<mutex> lock(state->mtx);
+                if (state->next >= cnt) {
+                    return;
+                }
+                idx = state->next++;
+                state->deadlines[idx] = chrono::steady_clock::now() +
+                    chrono::seconds(RCVTIMEOUT);
+            }
+            string reason;
+            bool ok = op(idx, reason);
+            lock_guard<mutex> lock(state->mtx);
+            if (state->settled[idx]) {
+                // Timed out, and we have been replaced.
+                return;
+            }
+            state->results[idx].status = ok ? RcvResult::RCV_OK :
+                RcvResult::RCV_FAILED;
+            state->results[idx].reason = reason;
+            state->settled[idx] = true;
+            state->ndone++;
+            state->cv.notify_all();
+        }
+    };
+    unsigned int nthreads = min(cnt, maxpar);
+    for (unsigned int i = 0; i < nthreads; i++) {
+        thread(worker).detach();
+    }
+
+    unique_lock<mutex> lock(state->mtx);
+    while (state->ndone < cnt) {
+        auto now = chrono::steady_clock::now();
+        // The started receivers are the ones below next. We wake up
+        // at the nearest deadline, or when a result comes in.
+        auto wakeup = now + chrono::seconds(RCVTIMEOUT);
+        for (unsigned int i = 0; i < state->next; i++) {
+            if (state->settled[i]) {
+                continue;
+            }
+            if (now >= state->deadlines[i]) {
+                state->settled[i] = true;
+                state->ndone++;
+                if (state->next < cnt) {
+                    thread(worker).detach();
+                }
+            } else if (state->deadlines[i] < wakeup) {
+                wakeup = state->deadlines[i];
+            }
+        }
+        if (state->ndone < cnt) {
+            state->cv.wait_until(lock, wakeup);
+        }
+    }
+    return state->results;
+}
+
+// One line per receiver
+static string rcvReport(const vector<string>& names,
+                        const vector<RcvResult>& results, int ops)
+{
+    string dsep = (ops & OPT_m) ? sep : " ";
+    string out;
+    for (unsigned int i = 0; i < names.size(); i++) {
+        switch (results[i].status) {
+        case RcvResult::RCV_OK: out += "Ok     " + dsep + names[i]; break;
+        case RcvResult::RCV_FAILED: out += "Failed " + dsep + names[i] +
+                dsep + results[i].reason; break;
+        case RcvResult::RCV_TIMEOUT: out += "Timeout" + dsep + names[i]; break;
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+// Make the receivers play the uri. With OPT_T, this is done in two
+// phases: all receivers are first armed (switched to the Receiver
+// source and given the uri), and only then told to play, so that they
+// start as close together as possible.
+static string playReceivers(const vector<string>& names, const string& uri,
+                            const string& meta, int ops)
+{
+    bool together = (ops & OPT_T) != 0;
+    auto states = make_shared<vector<ReceiverState> >(names.size());
+    vector<RcvResult> results =
+        fanout(names.size(), [=](int i, string& reason) {
+                ReceiverState& st = (*states)[i];
+                getReceiverState(names[i], st);
+                if (!st.prod || !st.rcv) {
+                    reason = st.reason.empty() ? "not a Songcast Receiver" :
+                        st.reason;
+                    return false;
+                }
+                if (!together) {
+                    reason = "setReceiverPlaying failed";
+                    return setReceiverPlaying(st, uri, meta);
+                }
+                reason = "arm failed";
+                return st.rcv->setSender(uri, meta) == 0 &&
+                    st.prod->setSourceIndex(st.receiverSourceIndex) == 0;
+            });
+
+    if (together) {
+        vector<int> armed;
+        for (unsigned int i = 0; i < results.size(); i++) {
+            if (results[i].status == RcvResult::RCV_OK) {
+                armed.push_back(i);
+            }
+        }
+        vector<RcvResult> pres =
+            fanout(armed.size(), [=](int j, string& reason) {
+                    reason = "play failed";
+                    return (*states)[armed[j]].rcv->play() == 0;
+                }, armed.size());
+        for (unsigned int j = 0; j < armed.size(); j++) {
+            results[armed[j]] = pres[j];
+        }
+    }
+    return rcvReport(names, results, ops);
+}
+
+// -s: args are master, slaves
+static string playFromReceiver(const vector<string>& args, int ops)
+{
+    ReceiverState mst;
+    getReceiverState(args[0], mst);
+    if (mst.state != ReceiverState::SCRS_PLAYING || mst.uri.empty()) {
+        return "Failed " + args[0] + " master Receiver not playing\n";
+    }
+    return playReceivers(vector<string>(args.begin() + 1, args.end()),
+                         mst.uri, mst.meta, ops);
+}
+
+// -r: args are sender, receivers
+static string playFromSender(const vector<string>& args, int ops)
+{
+    SenderState sst;
+    getSenderState(args[0], sst);
+    if (!sst.has_sender || sst.uri.empty()) {
+        return "Failed " + args[0] + " not a Songcast Sender: " +
+            sst.reason + "\n";
+    }
+    return playReceivers(vector<string>(args.begin() + 1, args.end()),
+                         sst.uri, sst.meta, ops);
+}
+
+// -x
+static string stopAll(const vector<string>& names, int ops)
+{
+    vector<RcvResult> results =
+        fanout(names.size(), [=](int i, string& reason) {
+                ReceiverState st;
+                getReceiverState(names[i], st);
+                if (!st.prod || !st.rcv) {
+                    reason = st.reason.empty() ? "not a Songcast Receiver" :
+                        st.reason;
+                    return false;
+                }
+                reason = "stopReceiver failed";
+                return stopReceiver(st);
+            });
+    return rcvReport(names, results, ops);
 }
 
 static char *thisprog;
 static char usage [] =
 " -l List renderers with Songcast Receiver capability\n"
 " -L List Songcast Senders\n"
+" -w Watch: list the Receivers and Senders, then print a line for each\n"
+"    change. This needs a running server.\n"
 "   -m : for above modes: use parseable format\n"
 "For the following options the renderers can be designated by their \n"
 "uid (safer) or friendly name\n"
@@ -130,6 +360,8 @@ static char usage [] =
 " -r <sender> <renderer> <renderer> : set up the renderers in Receiver mode\n"
 "    playing data from the sender. This is like -s but we get the uri from \n"
 "    the sender instead of a sibling receiver\n"
+"   -T : for -s and -r: first set up all the renderers, then start them\n"
+"    together, to minimize the start time differences.\n"
 " -S Run as server\n"
 " -f If no server is found, scctl will fork one after performing the\n"
 "    requested command, so that the next execution will not have to wait for\n"
@@ -157,7 +389,7 @@ int main(int argc, char *argv[])
     thisprog = argv[0];
 
     int ret;
-    while ((ret = getopt(argc, argv, "fhmLlrsSx")) != -1) {
+    while ((ret = getopt(argc, argv, "fhmLlrsSTwx")) != -1) {
         switch (ret) {
         case 'f': op_flags |= OPT_f; break;
         case 'h': Usage(stdout); break;
@@ -179,6 +411,12 @@ int main(int argc, char *argv[])
         case 'S':
             op_flags |= OPT_S;
             break;
+        case 'T':
+            op_flags |= OPT_T;
+            break;
+        case 'w':
+            op_flags |= OPT_w;
+            break;
         case 'x':
             op_flags |= OPT_x;
             break;
@@ -195,9 +433,14 @@ int main(int argc, char *argv[])
     }
 
     // At least one action needed. 
-    if ((op_flags & ~(OPT_f|OPT_m)) == 0)
+    if ((op_flags & ~(OPT_f|OPT_m|OPT_T)) == 0)
         Usage();
 
+    if ((op_flags & OPT_w)) {
+        cerr << "scctl: -w needs a running server (scctl -S)" << endl;
+        return 1;
+    }
+
     LibUPnP *mylib = LibUPnP::getLibUPnP();
     if (!mylib) {
         cerr << "Can't get LibUPnP" << endl;
@@ -228,17 +471,15 @@ int main(int argc, char *argv[])
     } else if ((op_flags & OPT_r)) {
         if (args.size() < 2)
             Usage();
-        setReceiversFromSender(args[0], vector<string>(args.begin() + 1,
-                                                       args.end()));
+        cout << playFromSender(args, op_flags);
     } else if ((op_flags & OPT_s)) {
         if (args.size() < 2)
             Usage();
-        setReceiversFromReceiver(args[0], vector<string>(args.begin()+1,
-                                                         args.end()));
+        cout << playFromReceiver(args, op_flags);
     } else if ((op_flags & OPT_x)) {
         if (args.size() < 1)
             Usage();
-        stopReceivers(args);
+        cout << stopAll(args, op_flags);
     } else if ((op_flags & OPT_S)) {
         exit(runserver());
     } else {
@@ -334,8 +575,346 @@ bool tryserver(int opflags, int argc, char **argv)
 }
 
 
+// Topology cache for the server. A worker thread keeps the Receiver
+// and Sender states up to date, so that the list requests can be
+// answered from memory:
+//  - Devices are refreshed as soon as one of their services sends an
+//    event (we subscribe to the Product, Receiver and Sender services
+//    of each device we see).
+//  - New devices are picked up through the discovery callback (SSDP
+//    announces, handled by libupnpp).
+//  - A full rescan is performed at long intervals to drop devices
+//    which went away and resync anything we missed.
+// Watcher connections (-w) get a line for each change.
+class TopoCache {
+public:
+    void start() {
+        UPnPDeviceDirectory::addCallback(
+            [this](const UPnPDeviceDesc& dev, const UPnPServiceDesc& srv) {
+                return discovered(dev, srv);});
+        thread(&TopoCache::work, this).detach();
+    }
+
+    // Wait for the initial scan, then return the sorted list
+    string receivers(int ops) {
+        string dsep = (ops & OPT_m) ? sep : " ";
+        unique_lock<mutex> lock(m_mutex);
+        waitready(lock);
+        vector<const ReceiverState*> v;
+        for (const auto& ent : m_rcvs) {
+            v.push_back(&ent.second);
+        }
+        sort(v.begin(), v.end(), [](const ReceiverState *a,
+                                    const ReceiverState *b) {
+                 return a->nm < b->nm;});
+        string out;
+        for (auto st : v) {
+            out += receiverLine(*st, dsep);
+        }
+        return out;
+    }
+    string senders(int ops) {
+        string dsep = (ops & OPT_m) ? sep : " ";
+        unique_lock<mutex> lock(m_mutex);
+        waitready(lock);
+        vector<const SenderState*> v;
+        for (const auto& ent : m_snds) {
+            v.push_back(&ent.second);
+        }
+        sort(v.begin(), v.end(), [](const SenderState *a,
+                                    const SenderState *b) {
+                 return a->nm < b->nm;});
+        string out;
+        for (auto st : v) {
+            out += senderLine(*st, dsep);
+        }
+        return out;
+    }
+
+    // Synchronously refresh receivers we just changed, so that a
+    // following list request sees the new state.
+    void refreshReceivers(const vector<string>& names) {
+        auto states = make_shared<vector<ReceiverState> >(names.size());
+        vector<RcvResult> results =
+            fanout(names.size(), [=](int i, string&) {
+                    getReceiverState(names[i], (*states)[i]);
+                    return true;
+                });
+        for (unsigned int i = 0; i < names.size(); i++) {
+            if (results[i].status == RcvResult::RCV_OK) {
+                updreceiver((*states)[i]);
+            }
+        }
+    }
+
+    // Send the current state, then the changes to the connection.
+    void addwatcher(shared_ptr<NetconData> con, int ops) {
+        con->set_nonblock(1);
+        string rl = receivers(ops);
+        string sl = senders(ops);
+        Watcher w{con, (ops & OPT_m) ? sep : " "};
+        string out;
+        vector<string> lines;
+        stringToTokens(rl, lines, "\n");
+        for (const auto& line : lines) {
+            out += "Receiver" + w.dsep + line + "\n";
+        }
+        lines.clear();
+        stringToTokens(sl, lines, "\n");
+        for (const auto& line : lines) {
+            out += "Sender" + w.dsep + line + "\n";
+        }
+        lock_guard<mutex> lock(m_mutex);
+        if (con->send(out.c_str(), out.size()) != int(out.size())) {
+            return;
+        }
+        m_watchers.push_back(w);
+    }
+
+private:
+    enum {RESCAN_SECS = 60};
+
+    struct Watcher {
+        shared_ptr<NetconData> con;
+        string dsep;
+    };
+
+    // Event listener for the services of one device. Holding the
+    // service objects maintains the subscriptions. The callbacks are
+    // called from the libupnpp event threads, they just queue the
+    // device for the worker.
+    class DevReporter : public VarEventReporter {
+    public:
+        DevReporter(TopoCache *cache, const string& udn, bool sender)
+            : m_cache(cache), m_udn(udn), m_sender(sender) {}
+        ~DevReporter() {
+            for (auto& srv : services) {
+                srv->installReporter(nullptr);
+            }
+        }
+        void install(shared_ptr<Service> srv) {
+            if (srv) {
+                srv->installReporter(this);
+                services.push_back(srv);
+            }
+        }
+        virtual void changed(const char *, int) {
+            m_cache->devchanged(m_udn, m_sender);
+        }
+        virtual void changed(const char *, const char *) {
+            m_cache->devchanged(m_udn, m_sender);
+        }
+        vector<shared_ptr<Service> > services;
+    private:
+        TopoCache *m_cache;
+        string m_udn;
+        bool m_sender;
+    };
+
+    void waitready(unique_lock<mutex>& lock) {
+        m_readycv.wait(lock, [this] {return m_ready;});
+    }
+
+    void devchanged(const string& udn, bool sender) {
+        lock_guard<mutex> lock(m_mutex);
+        if (sender) {
+            m_sdirty.insert(udn);
+        } else {
+            m_rdirty.insert(udn);
+        }
+        m_workcv.notify_one();
+    }
+
+    // Discovery callback: queue devices we don't know yet.
+    bool discovered(const UPnPDeviceDesc& dev, const UPnPServiceDesc& srv) {
+        bool sender = srv.serviceType.find(":service:Sender:") !=
+            string::npos;
+        if (!sender && dev.deviceType.find(":device:MediaRenderer:") ==
+            string::npos) {
+            return true;
+        }
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if ((sender ? m_sreporters.find(dev.UDN) != m_sreporters.end() :
+                 m_rreporters.find(dev.UDN) != m_rreporters.end())) {
+                return true;
+            }
+        }
+        devchanged(dev.UDN, sender);
+        return true;
+    }
+
+    // Send a change to the watchers, dropping the ones which are gone
+    // or can't keep up. Called with the lock held. mline and hline
+    // are the parseable and human-readable versions.
+    void notify(const string& what, const string& mline,
+                const string& hline) {
+        for (auto it = m_watchers.begin(); it != m_watchers.end();) {
+            string out = what + it->dsep + (it->dsep == sep ? mline : hline);
+            if (it->con->send(out.c_str(), out.size()) != int(out.size())) {
+                LOGDEB("scctl: server: dropping watcher\n");
+                it = m_watchers.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    // Store the reporter unless another thread was faster. A
+    // duplicate is deleted by the caller, outside of the lock.
+    void addreporter(map<string, unique_ptr<DevReporter> >& reps,
+                     const string& udn, unique_ptr<DevReporter>& rep) {
+        lock_guard<mutex> lock(m_mutex);
+        auto& slot = reps[udn];
+        if (!slot) {
+            slot.swap(rep);
+        }
+    }
+
+    void updreceiver(const ReceiverState& st) {
+        if (st.UDN.empty()) {
+            return;
+        }
+        bool subscribe = false;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            auto it = m_rcvs.find(st.UDN);
+            string line = receiverLine(st, sep);
+            if (it == m_rcvs.end() || receiverLine(it->second, sep) != line) {
+                notify("Receiver", line, receiverLine(st, " "));
+            }
+            m_rcvs[st.UDN] = st;
+            subscribe = m_rreporters.find(st.UDN) == m_rreporters.end() &&
+                (st.prod || st.rcv);
+        }
+        if (subscribe) {
+            // Not under the lock: the reporter may be called at once.
+            unique_ptr<DevReporter> rep(new DevReporter(this, st.UDN, false));
+            rep->install(st.prod);
+            rep->install(st.rcv);
+            addreporter(m_rreporters, st.UDN, rep);
+        }
+    }
+
+    void updsender(const SenderState& st) {
+        if (st.UDN.empty()) {
+            return;
+        }
+        bool subscribe = false;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            auto it = m_snds.find(st.UDN);
+            string line = senderLine(st, sep);
+            if (it == m_snds.end() || senderLine(it->second, sep) != line) {
+                notify("Sender", line, senderLine(st, " "));
+            }
+            m_snds[st.UDN] = st;
+            subscribe = m_sreporters.find(st.UDN) == m_sreporters.end() &&
+                st.sender;
+        }
+        if (subscribe) {
+            unique_ptr<DevReporter> rep(new DevReporter(this, st.UDN, true));
+            rep->install(st.sender);
+            addreporter(m_sreporters, st.UDN, rep);
+        }
+    }
+
+    void rescan() {
+        vector<ReceiverState> vr;
+        listReceivers(vr);
+        vector<SenderState> vs;
+        listSenders(vs);
+        set<string> rseen, sseen;
+        for (const auto& st : vr) {
+            rseen.insert(st.UDN);
+            updreceiver(st);
+        }
+        for (const auto& st : vs) {
+            sseen.insert(st.UDN);
+            updsender(st);
+        }
+        // Forget about the devices which are gone. The reporters are
+        // deleted outside of the lock.
+        vector<unique_ptr<DevReporter> > gone;
+        lock_guard<mutex> lock(m_mutex);
+        for (auto it = m_rcvs.begin(); it != m_rcvs.end();) {
+            if (rseen.find(it->first) == rseen.end()) {
+                string line = it->first + "\n";
+                notify("ReceiverGone", line, line);
+                gone.push_back(std::move(m_rreporters[it->first]));
+                m_rreporters.erase(it->first);
+                it = m_rcvs.erase(it);
+            } else {
+                it++;
+            }
+        }
+        for (auto it = m_snds.begin(); it != m_snds.end();) {
+            if (sseen.find(it->first) == sseen.end()) {
+                string line = it->first + "\n";
+                notify("SenderGone", line, line);
+                gone.push_back(std::move(m_sreporters[it->first]));
+                m_sreporters.erase(it->first);
+                it = m_snds.erase(it);
+            } else {
+                it++;
+            }
+        }
+        if (!m_ready) {
+            m_ready = true;
+            m_readycv.notify_all();
+        }
+    }
+
+    void work() {
+        for (;;) {
+            rescan();
+            auto deadline = chrono::steady_clock::now() +
+                chrono::seconds(RESCAN_SECS);
+            for (;;) {
+                set<string> rdirty, sdirty;
+                {
+                    unique_lock<mutex> lock(m_mutex);
+                    if (!m_workcv.wait_until(lock, deadline, [this] {
+                                return !m_rdirty.empty() ||
+                                    !m_sdirty.empty();})) {
+                        break;
+                    }
+                    rdirty.swap(m_rdirty);
+                    sdirty.swap(m_sdirty);
+                }
+                for (const auto& udn : rdirty) {
+                    ReceiverState st;
+                    getReceiverState(udn, st);
+                    updreceiver(st);
+                }
+                for (const auto& udn : sdirty) {
+                    SenderState st;
+                    getSenderState(udn, st);
+                    updsender(st);
+                }
+            }
+        }
+    }
+
+    mutex m_mutex;
+    condition_variable m_readycv;
+    condition_variable m_workcv;
+    bool m_ready{false};
+    map<string, ReceiverState> m_rcvs;
+    map<string, SenderState> m_snds;
+    map<string, unique_ptr<DevReporter> > m_rreporters;
+    map<string, unique_ptr<DevReporter> > m_sreporters;
+    set<string> m_rdirty;
+    set<string> m_sdirty;
+    list<Watcher> m_watchers;
+};
+
+static TopoCache o_topo;
+
 // Listening endpoint for the server. For each connection, one request
-// is served immediately and the connection is closed.
+// is served immediately and the connection is closed, except for
+// watch requests, where the connection is handed to the topology
+// cache.
 class MyNetconServLis : public NetconServLis {
 public:
 protected:
@@ -380,41 +959,32 @@ int MyNetconServLis::cando(Netcon::Event reason)
     if (opflags & OPT_p) {
         // ping
         out = "Ok\n";
+    } else if (opflags & OPT_w) {
+        conhold.release();
+        o_topo.addwatcher(shared_ptr<NetconData>(con), opflags);
+        return 1;
     } else if (opflags & OPT_l) {
-        out = showReceivers(opflags);
+        out = o_topo.receivers(opflags);
     } else if (opflags & OPT_L) {
-        out = showSenders(opflags);
+        out = o_topo.senders(opflags);
     } else if (opflags & OPT_s) {
         if (toks.size() < 3)
             return 1;
-        vector<string>::iterator beg = toks.begin();
-        beg++;
-        string master = *beg;
-        beg++;
-        vector<string> slaves(beg, toks.end());
-        ReceiverState mst;
-        getReceiverState(master, mst);
-        for (auto it = slaves.begin(); it != slaves.end(); it++) {
-            ReceiverState st;
-            getReceiverState(*it, st);
-            setReceiverPlaying(st, mst.uri, mst.meta);
-        }
+        vector<string> args(toks.begin() + 1, toks.end());
+        out = playFromReceiver(args, opflags);
+        o_topo.refreshReceivers(vector<string>(args.begin() + 1, args.end()));
     } else if (opflags & OPT_x) {
         if (toks.size() < 2)
             return 1;
-        vector<string>::iterator beg = toks.begin();
-        beg++;
-        vector<string> slaves(beg, toks.end());
-        stopReceivers(slaves);
+        vector<string> slaves(toks.begin() + 1, toks.end());
+        out = stopAll(slaves, opflags);
+        o_topo.refreshReceivers(slaves);
     } else if (opflags & OPT_r) {
         if (toks.size() < 3)
             return 1;
-        vector<string>::iterator beg = toks.begin();
-        beg++;
-        string sender = *beg;
-        beg++;
-        vector<string> receivers(beg, toks.end());
-        setReceiversFromSender(sender, receivers);
+        vector<string> args(toks.begin() + 1, toks.end());
+        out = playFromSender(args, opflags);
+        o_topo.refreshReceivers(vector<string>(args.begin() + 1, args.end()));
     } else {
         LOGERR("scctl: server: bad cmd:" << toks[0] << endl);
         return 1;
@@ -454,8 +1024,9 @@ int runserver()
     signal(SIGCHLD, SIG_IGN);
     signal(SIGPIPE, SIG_IGN);
 
-    // Initialize lib at once, will be ready when we need it
-    showReceivers(0);
+    // Initialize lib and start maintaining the device states at
+    // once, will be ready when we need it
+    o_topo.start();
 
     MyNetconServLis *servlis = new MyNetconServLis();
     if (servlis == 0) {
@@ -0,0 +1,170 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "asynclog.hxx"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+#include "metrics.hxx"
+
+using namespace std;
+
+// The producer side is only ever used by one thread at a time,
+// because the log macros hold the Logger mutex while formatting and
+// flushing. The ring buffer is then a single producer/single
+// consumer queue, with the positions as the only synchronization.
+class AsyncLogBuf : public std::streambuf {
+public:
+    AsyncLogBuf(std::streambuf *out, size_t size)
+        : m_out(out), m_ring(size), m_head(0), m_tail(0), m_dropped(0) {
+        m_droppedcnt = metricsCounter("upmpdcli_log_dropped_total", "");
+    }
+
+    // Writer thread
+    void work() {
+        for (;;) {
+            {
+                unique_lock<mutex> lock(m_waitmutex);
+                m_waitcv.wait_for(lock, chrono::milliseconds(200), [this] {
+                        return m_head.load(memory_order_acquire) !=
+                            m_tail.load(memory_order_relaxed);});
+            }
+            drain();
+        }
+    }
+
+    // Write out everything queued. Called by the writer thread, and
+    // at exit.
+    void drain() {
+        lock_guard<mutex> lock(m_drainmutex);
+        size_t tail = m_tail.load(memory_order_relaxed);
+        size_t head = m_head.load(memory_order_acquire);
+        if (head == tail) {
+            return;
+        }
+        size_t size = m_ring.size();
+        while (tail != head) {
+            size_t offs = tail % size;
+            size_t cnt = min(head - tail, size - offs);
+            m_out->sputn(&m_ring[offs], cnt);
+            tail += cnt;
+        }
+        m_tail.store(tail, memory_order_release);
+        uint64_t dropped = m_dropped.exchange(0);
+        if (dropped) {
+            string msg = ":2:asynclog: " + to_string(dropped) +
+                " log messages dropped (buffer full)\n";
+            m_out->sputn(msg.c_str(), msg.size());
+        }
+        m_out->pubsync();
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (c != traits_type::eof()) {
+            m_line += char(c);
+            if (c == '\n') {
+                push();
+            }
+        }
+        return traits_type::not_eof(c);
+    }
+    virtual streamsize xsputn(const char *s, streamsize n) {
+        m_line.append(s, n);
+        if (n > 0 && s[n-1] == '\n') {
+            push();
+        }
+        return n;
+    }
+    virtual int sync() {
+        push();
+        return 0;
+    }
+
+private:
+    void push() {
+        size_t n = m_line.size();
+        if (n == 0) {
+            return;
+        }
+        size_t size = m_ring.size();
+        size_t head = m_head.load(memory_order_relaxed);
+        size_t tail = m_tail.load(memory_order_acquire);
+        if (size - (head - tail) < n) {
+            m_dropped++;
+            m_droppedcnt->inc();
+        } else {
+            size_t offs = head % size;
+            size_t cnt = min(n, size - offs);
+            memcpy(&m_ring[offs], m_line.c_str(), cnt);
+            if (cnt < n) {
+                memcpy(&m_ring[0], m_line.c_str() + cnt, n - cnt);
+            }
+            m_head.store(head + n, memory_order_release);
+            m_waitcv.notify_one();
+        }
+        m_line.clear();
+    }
+
+    std::streambuf *m_out;
+    // Message being formatted.
+    string m_line;
+    vector<char> m_ring;
+    // Total bytes queued and written. The ring positions are these
+    // modulo the size.
+    atomic<size_t> m_head;
+    atomic<size_t> m_tail;
+    atomic<uint64_t> m_dropped;
+    MetricsCounter *m_droppedcnt;
+    mutex m_waitmutex;
+    condition_variable m_waitcv;
+    mutex m_drainmutex;
+};
+
+static AsyncLogBuf *o_buf;
+
+static void atexitdrain()
+{
+    o_buf->drain();
+}
+
+bool asyncLogInit(size_t bufsize)
+{
+    Logger *logger = Logger::getTheLog("");
+    if (nullptr == logger || logger->logisstderr() || o_buf) {
+        return false;
+    }
+    unique_lock<recursive_mutex> lock(logger->getmutex());
+    std::ostream& stream = logger->getstream();
+    o_buf = new AsyncLogBuf(stream.rdbuf(), bufsize);
+    stream.flush();
+    stream.rdbuf(o_buf);
+    std::thread(&AsyncLogBuf::work, o_buf).detach();
+    atexit(atexitdrain);
+    return true;
+}
@@ -0,0 +1,36 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _ASYNCLOG_H_X_INCLUDED_
+#define _ASYNCLOG_H_X_INCLUDED_
+
+#include <stddef.h>
+
+// Asynchronous log output. This replaces the buffer of the libupnpp
+// log file stream with one which queues the complete messages in a
+// ring buffer, and a thread which writes them to the file. The
+// logging threads only format the message and copy it, they never
+// wait for the file system.
+//
+// If the ring buffer is full, messages are dropped and counted, and
+// the count is logged when space is available again.
+//
+// Only used when logging to a file (stderr is shared with other
+// code). Must be called after daemon() (threads don't survive
+// fork). Pending messages are written at exit.
+extern bool asyncLogInit(size_t bufsize);
+
+#endif /* _ASYNCLOG_H_X_INCLUDED_ */
@@ -33,6 +33,7 @@
 #include "upmpd.hxx"
 #include "upmpdutils.hxx"
 #include "smallut.h"
+#include "metrics.hxx"
 
 // For testing upplay with a dumb renderer.
 // #define NO_SETNEXT
@@ -46,46 +47,46 @@ static const string sTpTransport("urn:schemas-upnp-org:service:AVTransport:1");
 UpMpdAVTransport::UpMpdAVTransport(UpMpd *dev, bool noev)
     : UpnpService(sTpTransport, sIdTransport, dev, noev), m_dev(dev), m_ohp(0)
 {
-    m_dev->addActionMapping(this,"SetAVTransportURI", 
+    metricsAddAction(m_dev, this,"SetAVTransportURI", 
                             bind(&UpMpdAVTransport::setAVTransportURI, 
                                  this,_1,_2, false));
-    m_dev->addActionMapping(this,"SetNextAVTransportURI", 
+    metricsAddAction(m_dev, this,"SetNextAVTransportURI", 
                             bind(&UpMpdAVTransport::setAVTransportURI, 
                                  this,_1, _2, true));
-    m_dev->addActionMapping(this,"GetPositionInfo", 
+    metricsAddAction(m_dev, this,"GetPositionInfo", 
                             bind(&UpMpdAVTransport::getPositionInfo, 
                                  this, _1, _2));
-    m_dev->addActionMapping(this,"GetTransportInfo", 
+    metricsAddAction(m_dev, this,"GetTransportInfo", 
                             bind(&UpMpdAVTransport::getTransportInfo, 
                                  this, _1, _2));
-    m_dev->addActionMapping(this,"GetMediaInfo", 
+    metricsAddAction(m_dev, this,"GetMediaInfo", 
                             bind(&UpMpdAVTransport::getMediaInfo, 
                                  this, _1, _2));
-    m_dev->addActionMapping(this,"GetDeviceCapabilities", 
+    metricsAddAction(m_dev, this,"GetDeviceCapabilities", 
                             bind(&UpMpdAVTransport::getDeviceCapabilities, 
                                  this, _1, _2));
-    m_dev->addActionMapping(this,"SetPlayMode", 
+    metricsAddAction(m_dev, this,"SetPlayMode", 
                             bind(&UpMpdAVTransport::setPlayMode, this, _1, _2));
-    m_dev->addActionMapping(this,"GetTransportSettings", 
+    metricsAddAction(m_dev, this,"GetTransportSettings", 
                             bind(&UpMpdAVTransport::getTransportSettings, 
                                  this, _1, _2));
-    m_dev->addActionMapping(this,"GetCurrentTransportActions", 
+    metricsAddAction(m_dev, this,"GetCurrentTransportActions", 
                             bind(&UpMpdAVTransport::getCurrentTransportActions,
                                  this,_1,_2));
-    m_dev->addActionMapping(this,"Stop", bind(&UpMpdAVTransport::playcontrol, 
+    metricsAddAction(m_dev, this,"Stop", bind(&UpMpdAVTransport::playcontrol, 
                                          this, _1, _2, 0));
-    m_dev->addActionMapping(this,"Play", bind(&UpMpdAVTransport::playcontrol, 
+    metricsAddAction(m_dev, this,"Play", bind(&UpMpdAVTransport::playcontrol, 
                                          this, _1, _2, 1));
-    m_dev->addActionMapping(this,"Pause", 
+    metricsAddAction(m_dev, this,"Pause", 
                             bind(&UpMpdAVTransport::playcontrol, 
                                  this, _1, _2, 2));
-    m_dev->addActionMapping(this,"Seek", bind(&UpMpdAVTransport::seek, 
+    metricsAddAction(m_dev, this,"Seek", bind(&UpMpdAVTransport::seek, 
                                          this, _1, _2));
 
     // should we get rid of those ? They don't make sense for us
-    m_dev->addActionMapping(this, "Next", bind(&UpMpdAVTransport::seqcontrol, 
+    metricsAddAction(m_dev, this, "Next", bind(&UpMpdAVTransport::seqcontrol, 
                                                this, _1, _2, 0));
-    m_dev->addActionMapping(this, "Previous", 
+    metricsAddAction(m_dev, this, "Previous", 
                             bind(&UpMpdAVTransport::seqcontrol, 
                                  this, _1, _2, 1));
 
@@ -209,7 +210,7 @@ static string mpdsToPlaymode(const MpdStatus& mpds)
 // Translate MPD state to UPnP AVTransport state variables
 bool UpMpdAVTransport::tpstateMToU(unordered_map<string, string>& status)
 {
-    const MpdStatus &mpds =  m_dev->getMpdStatus();
+    const MpdStatus &mpds =  m_dev->pollMpdStatus();
     //DEBOUT << "UpMpdAVTransport::tpstateMToU: curpos: " << mpds.songpos <<
     //   " qlen " << mpds.qlen << endl;
     bool is_song = (mpds.state == MpdStatus::MPDS_PLAY) || 
@@ -315,6 +316,8 @@ bool UpMpdAVTransport::tpstateMToU(unordered_map<string, string>& status)
 bool UpMpdAVTransport::getEventData(bool all, std::vector<std::string>& names, 
                                     std::vector<std::string>& values)
 {
+    static MetricsHistogram *evhist = metricsEventHistogram(sIdTransport);
+    MetricsTimer timer(evhist);
     unordered_map<string, string> newtpstate;
     tpstateMToU(newtpstate);
     if (all)
@@ -497,7 +500,7 @@ int UpMpdAVTransport::setAVTransportURI(const SoapIncoming& sc, SoapOutgoing& da
 
 int UpMpdAVTransport::getPositionInfo(const SoapIncoming& sc, SoapOutgoing& data)
 {
-    const MpdStatus &mpds = m_dev->getMpdStatus();
+    const MpdStatus &mpds = m_dev->getMpdStatusInterpolated();
     //LOGDEB("UpMpdAVTransport::getPositionInfo. State: " << mpds.state <<endl);
 
     bool is_song = (mpds.state == MpdStatus::MPDS_PLAY) || 
@@ -550,7 +553,7 @@ int UpMpdAVTransport::getPositionInfo(const SoapIncoming& sc, SoapOutgoing& data
 
 int UpMpdAVTransport::getTransportInfo(const SoapIncoming& sc, SoapOutgoing& data)
 {
-    const MpdStatus &mpds = m_dev->getMpdStatus();
+    const MpdStatus &mpds = m_dev->getMpdStatusInterpolated();
     //LOGDEB("UpMpdAVTransport::getTransportInfo. State: " << mpds.state<<endl);
 
     string tstate("STOPPED");
@@ -113,8 +113,10 @@ int libclf_closefrom(int fd0)
 /*************************************************************************/
 #elif (defined(linux) || defined(__linux) || defined(__linux__))
 
-/* Use /proc/self/fd directory */
+/* Use the close_range() system call (Linux 5.9), else the
+   /proc/self/fd directory */
 #include <sys/types.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 
 int libclf_closefrom(int fd0)
@@ -122,6 +124,15 @@ int libclf_closefrom(int fd0)
     DIR *dirp;
     struct dirent *ent;
 
+#ifdef SYS_close_range
+    /* No libc wrapper in older glibcs. This fails with ENOSYS on older
+       kernels. It does not allocate memory, so it is safe after vfork */
+    if (syscall(SYS_close_range, (unsigned int)fd0, ~0U, 0) == 0) {
+        DPRINT((stderr, "libclf_closefrom: using close_range\n"));
+        return 0;
+    }
+#endif
+
     DPRINT((stderr, "libclf_closefrom: using /proc\n"));
     dirp = opendir("/proc/self/fd");
     if (dirp == 0) {
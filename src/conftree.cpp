@@ -42,6 +42,7 @@
 
 #include "pathut.h"
 #include "smallut.h"
+#include "readfile.h"
 #include "log.h"
 
 using namespace std;
@@ -155,6 +156,109 @@ void ConfSimple::parseinput(istream& input)
     }
 }
 
+static inline bool isspacetab(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Fast parse for the trimmed (read-only) mode: same syntax as
+// parseinput(), but no presentation data, and we work directly on the
+// file data, without going through getline() and intermediary
+// strings. The subkey submap is cached so that we don't look it up
+// for each variable.
+void ConfSimple::parsebuf(const char *cp, size_t size)
+{
+    const char *end = cp + size;
+    string submapkey;
+    map<string, string> *submap = nullptr;
+    // Continued line (only used for lines ending with a backslash)
+    string line;
+    bool appending = false;
+
+    while (cp < end || appending) {
+        const char *lstart, *lend;
+        if (cp >= end) {
+            // Backslash on the last line: process what we have, as
+            // parseinput() does.
+            appending = false;
+            lstart = line.c_str();
+            lend = lstart + line.size();
+        } else {
+            lstart = cp;
+            lend = (const char *)memchr(cp, '\n', end - cp);
+            if (nullptr == lend) {
+                lend = end;
+            }
+            cp = lend + 1;
+        }
+        while (lend > lstart && (lend[-1] == '\r' || lend[-1] == '\n')) {
+            lend--;
+        }
+        if (appending) {
+            line.append(lstart, lend - lstart);
+            lstart = line.c_str();
+            lend = lstart + line.size();
+        }
+        while (lstart < lend && isspacetab(*lstart)) {
+            lstart++;
+        }
+        while (lend > lstart && isspacetab(lend[-1])) {
+            lend--;
+        }
+        if (lstart == lend || *lstart == '#') {
+            continue;
+        }
+        if (lend[-1] == '\\') {
+            // lstart may point into line
+            line = string(lstart, lend - lstart - 1);
+            appending = true;
+            continue;
+        }
+        appending = false;
+
+        if (*lstart == '[') {
+            while (lstart < lend && (*lstart == '[' || *lstart == ']')) {
+                lstart++;
+            }
+            while (lend > lstart && (lend[-1] == '[' || lend[-1] == ']')) {
+                lend--;
+            }
+            submapkey.assign(lstart, lend - lstart);
+            if (dotildexpand) {
+                submapkey = path_tildexpand(submapkey);
+            }
+            m_subkeys_unsorted.push_back(submapkey);
+            submap = nullptr;
+            continue;
+        }
+
+        const char *eq = (const char *)memchr(lstart, '=', lend - lstart);
+        if (nullptr == eq) {
+            continue;
+        }
+        const char *nmend = eq;
+        while (nmend > lstart && isspacetab(nmend[-1])) {
+            nmend--;
+        }
+        if (nmend == lstart) {
+            continue;
+        }
+        const char *valstart = eq + 1;
+        while (valstart < lend && isspacetab(*valstart)) {
+            valstart++;
+        }
+        // Same as i_set()
+        if (memchr(valstart, '\r', lend - valstart)) {
+            continue;
+        }
+        if (nullptr == submap) {
+            submap = &m_submaps[submapkey];
+        }
+        (*submap)[string(lstart, nmend - lstart)] =
+            string(valstart, lend - valstart);
+    }
+}
+
 
 ConfSimple::ConfSimple(int readonly, bool tildexp)
     : dotildexpand(tildexp), m_fmtime(0), m_holdWrites(false)
@@ -178,11 +282,23 @@ ConfSimple::ConfSimple(const string& d, int readonly, bool tildexp)
     parseinput(input);
 }
 
-ConfSimple::ConfSimple(const char *fname, int readonly, bool tildexp)
+ConfSimple::ConfSimple(const char *fname, int readonly, bool tildexp,
+                       bool trimmed)
     : dotildexpand(tildexp), m_filename(fname), m_fmtime(0), m_holdWrites(false)
 {
     status = readonly ? STATUS_RO : STATUS_RW;
 
+    if (readonly && trimmed) {
+        string data;
+        if (!file_to_string(fname, data)) {
+            status = STATUS_ERROR;
+            return;
+        }
+        parsebuf(data.c_str(), data.size());
+        i_changed(true);
+        return;
+    }
+
     ifstream input;
     if (readonly) {
         input.open(fname, ios::in);
@@ -374,7 +490,8 @@ int ConfSimple::i_set(const std::string& nm, const std::string& value,
         m_submaps[sk] = submap;
 
         // Maybe add sk entry to m_order data, if not already there.
-        if (!sk.empty()) {
+        // During the initial parse, parseinput() just added it.
+        if (!sk.empty() && !init) {
             ConfLine nl(ConfLine::CFL_SK, sk);
             // Append SK entry only if it's not already there (erase
             // does not remove entries from the order data, and it may
@@ -731,3 +848,117 @@ const
     return 0;
 }
 
+
+#ifdef CONFTREE_TEST
+// Benchmark for the radio list use case: normal and trimmed parsing
+// of a big file with many sections, then the OHRadio lookups. Build
+// in src with:
+//   c++ -O2 -std=c++0x -I. -I.. -I/usr/include/libupnpp -DCONFTREE_TEST
+//       -o conftree conftree.cpp pathut.cpp smallut.cpp readfile.cpp -lupnpp
+#include <chrono>
+#include <fstream>
+
+static const char *thisprog;
+static char usage [] =
+    "conftree [-n nsections] [file]\n"
+    "  Create a radio list with nsections (default 10000) in file\n"
+    "  (default /tmp/conftree-bench.conf), and time its parsing\n";
+static void Usage()
+{
+    fprintf(stderr, "%s: usage: %s", thisprog, usage);
+    exit(1);
+}
+
+static double msecs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count() / 1000.0;
+}
+
+// Read the radios as OHRadio does, return the number of urls.
+static size_t radiolookups(const ConfSimple& conf)
+{
+    size_t cnt = 0;
+    vector<string> allsubk = conf.getSubKeys_unsorted();
+    for (const auto& sk : allsubk) {
+        string uri, artUri, artScript;
+        if (sk.find("radio ") == 0 && conf.get("url", uri, sk)) {
+            conf.get("artUrl", artUri, sk);
+            conf.get("artScript", artScript, sk);
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+int main(int argc, char **argv)
+{
+    thisprog = argv[0];
+    int nsections = 10000;
+    string fn("/tmp/conftree-bench.conf");
+    argc--; argv++;
+    while (argc > 0 && **argv == '-') {
+        if (!strcmp(*argv, "-n") && argc > 1) {
+            nsections = atoi(argv[1]);
+            argc -= 2; argv += 2;
+        } else {
+            Usage();
+        }
+    }
+    if (argc > 1)
+        Usage();
+    if (argc == 1)
+        fn = *argv;
+
+    {
+        std::ofstream out(fn.c_str());
+        out << "# Radio list\nfriendlyname = bench\n\n";
+        for (int i = 0; i < nsections; i++) {
+            out << "# Station " << i << "\n" <<
+                "[radio Station number " << i << "]\n" <<
+                "url = http://streams.example.com/station/" << i <<
+                "/listen.pls\n" <<
+                "artUrl = http://img.example.com/logos/" << i << ".png\n\n";
+        }
+        // Continued line at the end of the file
+        out << "[tail]\nlast = \\\n";
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ConfSimple full(fn.c_str(), 1);
+    double fullms = msecs(start);
+    start = std::chrono::steady_clock::now();
+    ConfSimple trimmed(fn.c_str(), 1, false, true);
+    double trimmedms = msecs(start);
+    if (!full.ok() || !trimmed.ok()) {
+        cerr << "Parse failed for " << fn << endl;
+        return 1;
+    }
+    start = std::chrono::steady_clock::now();
+    size_t cnt = radiolookups(trimmed);
+    double lookupms = msecs(start);
+
+    // Check that both parsers produce the same data
+    vector<string> sks = full.getSubKeys();
+    string last;
+    bool same = trimmed.get("last", last, "tail") && last.empty() &&
+        sks == trimmed.getSubKeys() &&
+        full.getSubKeys_unsorted() == trimmed.getSubKeys_unsorted();
+    sks.push_back(string());
+    for (const auto& sk : sks) {
+        vector<string> nms = full.getNames(sk);
+        same = same && nms == trimmed.getNames(sk);
+        for (const auto& nm : nms) {
+            string v1, v2;
+            full.get(nm, v1, sk);
+            trimmed.get(nm, v2, sk);
+            same = same && v1 == v2;
+        }
+    }
+
+    cout << nsections << " sections: parse " << fullms << " mS, trimmed " <<
+        trimmedms << " mS, " << cnt << " radio lookups " << lookupms <<
+        " mS. Results " << (same ? "identical" : "DIFFER") << endl;
+    return same ? 0 : 1;
+}
+#endif // CONFTREE_TEST
@@ -120,8 +120,15 @@ public:
      * @param filename file to open
      * @param readonly if true open readonly, else rw
      * @param tildexp  try tilde (home dir) expansion for subkey values
+     * @param trimmed if true (and readonly), don't keep the
+     *     presentation data (comments and ordering, see getlines()). The
+     *     file is then read in one go and parsed by a faster routine,
+     *     which is useful for big files (e.g. radio lists with thousands
+     *     of sections). Such an object can't be written back, and
+     *     commentsAsXML() returns nothing.
      */
-    ConfSimple(const char *fname, int readonly = 0, bool tildexp = false);
+    ConfSimple(const char *fname, int readonly = 0, bool tildexp = false,
+               bool trimmed = false);
 
     /**
      * Build the object by reading content from a string
@@ -316,6 +323,7 @@ private:
     bool                              m_holdWrites;
 
     void parseinput(istream& input);
+    void parsebuf(const char *cp, size_t size);
     bool write();
     // Internal version of set: no RW checking
     virtual int i_set(const string& nm, const string& val,
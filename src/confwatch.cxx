@@ -0,0 +1,194 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "confwatch.hxx"
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+#include "conftree.h"
+#include "pathut.h"
+
+using namespace std;
+
+static mutex o_lock;
+static shared_ptr<ConfSimple> o_config;
+static shared_ptr<ConfSimple> o_radiolist;
+static atomic<int> o_generation(0);
+static string o_conffile;
+static function<void()> o_wakeup;
+
+// Wait for the editors to finish writing, and group the changes to
+// both files into a single reload.
+static const int settlems = 300;
+// Polling interval when inotify is not available.
+static const int pollsecs = 5;
+
+int confWatchGeneration()
+{
+    return o_generation.load();
+}
+
+shared_ptr<ConfSimple> confWatchConfig()
+{
+    lock_guard<mutex> lock(o_lock);
+    return o_config;
+}
+
+static string radiolistname(const shared_ptr<ConfSimple>& conf)
+{
+    string fn;
+    conf->get("radiolist", fn);
+    return fn;
+}
+
+// Check the file modification times and reload if needed. Returns
+// true if something changed.
+static bool checkreload()
+{
+    shared_ptr<ConfSimple> conf, radiolist;
+    {
+        lock_guard<mutex> lock(o_lock);
+        conf = o_config;
+        radiolist = o_radiolist;
+    }
+    if (!conf->sourceChanged() && !(radiolist && radiolist->sourceChanged())) {
+        return false;
+    }
+    shared_ptr<ConfSimple> nconf =
+        make_shared<ConfSimple>(o_conffile.c_str(), 1, true, true);
+    if (!nconf->ok()) {
+        LOGERR("confwatch: can't read " << o_conffile <<
+               ", keeping the previous configuration\n");
+        return false;
+    }
+    shared_ptr<ConfSimple> nradiolist;
+    string rlfn = radiolistname(nconf);
+    if (!rlfn.empty()) {
+        nradiolist = make_shared<ConfSimple>(rlfn.c_str(), 1, false, true);
+    }
+    {
+        lock_guard<mutex> lock(o_lock);
+        o_config = nconf;
+        o_radiolist = nradiolist;
+    }
+    o_generation++;
+    LOGINF("confwatch: configuration reloaded, generation " <<
+           o_generation.load() << endl);
+    o_wakeup();
+    return true;
+}
+
+#ifdef __linux__
+// Watch the directories, so that we see files replaced by rename
+// (which most editors do).
+static void setwatches(int fd, vector<int>& wds)
+{
+    for (auto wd : wds) {
+        inotify_rm_watch(fd, wd);
+    }
+    wds.clear();
+    vector<string> dirs{path_getfather(o_conffile)};
+    {
+        lock_guard<mutex> lock(o_lock);
+        string rlfn = radiolistname(o_config);
+        if (!rlfn.empty() && path_getfather(rlfn) != dirs[0]) {
+            dirs.push_back(path_getfather(rlfn));
+        }
+    }
+    for (const auto& dir : dirs) {
+        int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE |
+                                   IN_MOVED_TO | IN_CREATE | IN_DELETE);
+        if (wd < 0) {
+            LOGERR("confwatch: inotify_add_watch(" << dir << ") errno " <<
+                   errno << endl);
+        } else {
+            wds.push_back(wd);
+        }
+    }
+}
+#endif
+
+static void watchworker()
+{
+#ifdef __linux__
+    int fd = inotify_init();
+    if (fd >= 0) {
+        vector<int> wds;
+        setwatches(fd, wds);
+        char buf[4096];
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                LOGERR("confwatch: inotify read failed, errno " << errno <<
+                       endl);
+                break;
+            }
+            // We don't look at the event details: the modification
+            // times decide. Let things settle and drain the queue.
+            struct pollfd pfd{fd, POLLIN, 0};
+            while (poll(&pfd, 1, settlems) > 0) {
+                if (read(fd, buf, sizeof(buf)) <= 0) {
+                    break;
+                }
+            }
+            if (checkreload()) {
+                // The radio list file may have moved
+                setwatches(fd, wds);
+            }
+        }
+        close(fd);
+    } else {
+        LOGINF("confwatch: inotify_init failed, polling\n");
+    }
+#endif
+    for (;;) {
+        sleep(pollsecs);
+        checkreload();
+    }
+}
+
+bool confWatchStart(const string& conffile, function<void()> wakeup)
+{
+    o_conffile = conffile;
+    o_wakeup = wakeup;
+    o_config = make_shared<ConfSimple>(o_conffile.c_str(), 1, true, true);
+    if (!o_config->ok()) {
+        LOGERR("confwatch: can't read " << conffile << endl);
+        o_config.reset();
+        return false;
+    }
+    string rlfn = radiolistname(o_config);
+    if (!rlfn.empty()) {
+        o_radiolist = make_shared<ConfSimple>(rlfn.c_str(), 1, false, true);
+    }
+    std::thread(watchworker).detach();
+    return true;
+}
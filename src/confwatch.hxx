@@ -0,0 +1,47 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _CONFWATCH_H_X_INCLUDED_
+#define _CONFWATCH_H_X_INCLUDED_
+
+#include <functional>
+#include <memory>
+#include <string>
+
+class ConfSimple;
+
+// Configuration reload. A thread watches the configuration file and
+// the radio list file (inotify, or polling where it is not
+// available). When one of them changes, the configuration is parsed
+// again, the generation number is incremented, and the wakeup
+// function is called.
+//
+// g_config is not modified (it is used without locking all over the
+// place). The subsystems which support a reload (radio list, source
+// list, mpd hooks) check the generation from their event generation
+// code, which runs under the device lock, and rebuild their data from
+// confWatchConfig(). Other parameters still need a restart.
+extern bool confWatchStart(const std::string& conffile,
+                           std::function<void()> wakeup);
+
+// 0 until the first change
+extern int confWatchGeneration();
+
+// Current configuration data. Null if confWatchStart() was not
+// called (no configuration file).
+extern std::shared_ptr<ConfSimple> confWatchConfig();
+
+#endif /* _CONFWATCH_H_X_INCLUDED_ */
@@ -27,6 +27,7 @@
 
 #include "libupnpp/log.hxx"
 #include "libupnpp/soaphelp.hxx"
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -39,13 +40,13 @@ static const string sIdCM("urn:upnp-org:serviceId:ConnectionManager");
 UpMpdConMan::UpMpdConMan(UpnpDevice *dev, const string& protoinfo)
     : UpnpService(sTpCM, sIdCM, dev), m_protoinfo(protoinfo)
 {
-    dev->addActionMapping(this,"GetCurrentConnectionIDs", 
+    metricsAddAction(dev, this,"GetCurrentConnectionIDs", 
                           bind(&UpMpdConMan::getCurrentConnectionIDs, 
                                this, _1,_2));
-    dev->addActionMapping(this,"GetCurrentConnectionInfo", 
+    metricsAddAction(dev, this,"GetCurrentConnectionInfo", 
                           bind(&UpMpdConMan::getCurrentConnectionInfo, 
                                this,_1,_2));
-    dev->addActionMapping(this,"GetProtocolInfo", 
+    metricsAddAction(dev, this,"GetProtocolInfo", 
                           bind(&UpMpdConMan::getProtocolInfo, this, _1, _2));
 }
 
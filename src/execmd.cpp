@@ -35,6 +35,12 @@
 #include <signal.h>
 #include <time.h>
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+#include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -83,6 +89,9 @@ public:
     std::shared_ptr<NetconCli> m_fromcmd;
     // Subprocess id
     pid_t            m_pid;
+    // Exit status pipe when the process was started by the spawn
+    // helper (it is not our child then).
+    int              m_statusfd;
     // Saved sigmask
     sigset_t         m_blkcld;
 
@@ -92,6 +101,7 @@ public:
         m_killRequest = false;
         m_pipein[0] = m_pipein[1] = m_pipeout[0] = m_pipeout[1] = -1;
         m_pid = -1;
+        m_statusfd = -1;
         sigemptyset(&m_blkcld);
     }
     // Child process code
@@ -100,6 +110,11 @@ public:
 };
 bool ExecCmd::Internal::o_useVfork = false;
 
+// Spawn helper connection (see startSpawnHelper()). The lock
+// serializes the request/reply exchanges.
+static int o_helpersock = -1;
+static std::mutex o_helperlock;
+
 ExecCmd::ExecCmd(int)
 {
     m = new Internal();
@@ -292,6 +307,9 @@ public:
                        ": " << errno << "\n");
             }
         }
+        if (m_parent->m_statusfd >= 0) {
+            close(m_parent->m_statusfd);
+        }
         m_parent->m_tocmd.reset();
         m_parent->m_fromcmd.reset();
         pthread_sigmask(SIG_UNBLOCK, &m_parent->m_blkcld, 0);
@@ -435,6 +453,366 @@ inline void ExecCmd::Internal::dochild(const string& cmd, const char **argv,
     _exit(127);
 }
 
+//////////// Spawn helper
+//
+// The request is a 4 bytes length, then null-terminated strings:
+// executable, stderr file, rlimit, has_input, has_output, argument
+// count, arguments (including argv[0]), environment. The descriptors
+// are passed with the length: command input if has_input, command
+// output if has_output, then the write side of the exit status
+// pipe. The reply is the pid, or -errno.
+//
+// The helper writes the exit status (as returned by waitpid()) to the
+// status pipe when the command exits.
+
+static const int helpermaxfds = 3;
+static pid_t o_helperpid = -1;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool sendall(int fd, const char *data, size_t cnt)
+{
+    while (cnt > 0) {
+        ssize_t n = send(fd, data, cnt, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        cnt -= n;
+    }
+    return true;
+}
+
+static bool recvall(int fd, char *data, size_t cnt)
+{
+    while (cnt > 0) {
+        ssize_t n = recv(fd, data, cnt, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        cnt -= n;
+    }
+    return true;
+}
+
+// Send the request length with the descriptors attached
+static bool sendwithfds(int sock, uint32_t len, const vector<int>& fds)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char cbuf[CMSG_SPACE(helpermaxfds * sizeof(int))];
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_control = cbuf;
+    msg.msg_controllen = CMSG_SPACE(fds.size() * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fds.size() * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fds[0], fds.size() * sizeof(int));
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    return n == sizeof(len);
+}
+
+static bool recvwithfds(int sock, uint32_t *len, vector<int>& fds)
+{
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = len;
+    iov.iov_len = sizeof(*len);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    char cbuf[CMSG_SPACE(helpermaxfds * sizeof(int))];
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, 0)) < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *cfds = (int *)CMSG_DATA(cmsg);
+            fds.insert(fds.end(), cfds, cfds + cnt);
+        }
+    }
+    return n == sizeof(*len) ||
+        recvall(sock, (char *)len + n, sizeof(*len) - n);
+}
+
+// Helper: read a request, start the command, send the reply. Returns
+// false if the connection is closed.
+static bool helperspawn(int sock, map<pid_t, int>& children)
+{
+    uint32_t len;
+    vector<int> fds;
+    if (!recvwithfds(sock, &len, fds)) {
+        return false;
+    }
+    string data(len, 0);
+    if (len > 0 && !recvall(sock, &data[0], len)) {
+        return false;
+    }
+    if (!data.empty() && data.back() != '\0') {
+        data.push_back('\0');
+    }
+    vector<const char *> fields;
+    for (string::size_type pos = 0; pos < data.size();
+         pos = data.find('\0', pos) + 1) {
+        fields.push_back(data.c_str() + pos);
+    }
+
+    int32_t reply = -EINVAL;
+    bool has_input = fields.size() > 5 && atoi(fields[3]);
+    bool has_output = fields.size() > 5 && atoi(fields[4]);
+    unsigned int argc = fields.size() > 5 ? atoi(fields[5]) : 0;
+    if (fields.size() < 6 || argc == 0 || fields.size() < 6 + argc ||
+        fds.size() != size_t(has_input + has_output + 1)) {
+        for (auto fd : fds) {
+            close(fd);
+        }
+        return sendall(sock, (const char *)&reply, sizeof(reply));
+    }
+
+    ExecCmd::Internal cmd;
+    cmd.reset();
+    cmd.m_stderrFile = fields[1];
+    cmd.m_rlimit_as_mbytes = atoi(fields[2]);
+    int fdidx = 0;
+    if (has_input) {
+        cmd.m_pipein[0] = fds[fdidx++];
+    }
+    if (has_output) {
+        cmd.m_pipeout[1] = fds[fdidx++];
+    }
+    int statusfd = fds[fdidx];
+    vector<const char *> argv(fields.begin() + 6, fields.begin() + 6 + argc);
+    argv.push_back(nullptr);
+    vector<const char *> envv(fields.begin() + 6 + argc, fields.end());
+    envv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The helper ignores SIGPIPE, don't pass this on to the command.
+        signal(SIGPIPE, SIG_DFL);
+        cmd.dochild(fields[0], &argv[0], &envv[0], has_input, has_output);
+        _exit(1);
+    }
+    for (int i = 0; i < fdidx; i++) {
+        close(fds[i]);
+    }
+    if (pid < 0) {
+        reply = -errno;
+        close(statusfd);
+    } else {
+        // Set the process group before the caller gets the pid, so
+        // that a killpg() can't hit ours.
+        setpgid(pid, pid);
+        children[pid] = statusfd;
+        reply = pid;
+    }
+    return sendall(sock, (const char *)&reply, sizeof(reply));
+}
+
+static int o_chldpipe[2];
+static void helpersigchld(int)
+{
+    int saved = errno;
+    if (write(o_chldpipe[1], "c", 1) < 0) {
+        // Pipe full: a wakeup is pending anyway
+    }
+    errno = saved;
+}
+
+// Helper process main loop. Does not return.
+static void spawnhelper(int sock)
+{
+    // The status pipe writes would kill us if the caller is gone. The
+    // children get the default back before exec.
+    signal(SIGPIPE, SIG_IGN);
+    if (pipe(o_chldpipe) < 0) {
+        _exit(1);
+    }
+    fcntl(o_chldpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(o_chldpipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = helpersigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, 0);
+    sigset_t sset;
+    sigemptyset(&sset);
+    sigaddset(&sset, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &sset, 0);
+
+    // Running commands: pid -> status pipe
+    map<pid_t, int> children;
+    for (;;) {
+        struct pollfd pfds[2];
+        pfds[0].fd = sock;
+        pfds[1].fd = o_chldpipe[0];
+        pfds[0].events = pfds[1].events = POLLIN;
+        pfds[0].revents = pfds[1].revents = 0;
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(1);
+        }
+        if (pfds[1].revents) {
+            char buf[64];
+            while (read(o_chldpipe[0], buf, sizeof(buf)) > 0);
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = children.find(pid);
+                if (it != children.end()) {
+                    if (write(it->second, &status, sizeof(status)) < 0) {
+                        // The caller is not interested any more.
+                    }
+                    close(it->second);
+                    children.erase(it);
+                }
+            }
+        }
+        if (pfds[0].revents && !helperspawn(sock, children)) {
+            // The main process is gone.
+            _exit(0);
+        }
+    }
+}
+
+bool ExecCmd::startSpawnHelper()
+{
+    std::unique_lock<std::mutex> lock(o_helperlock);
+    if (o_helpersock >= 0) {
+        return true;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        LOGERR("ExecCmd::startSpawnHelper: socketpair failed. errno " <<
+               errno << "\n");
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGERR("ExecCmd::startSpawnHelper: fork failed. errno " <<
+               errno << "\n");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        spawnhelper(sv[1]);
+    }
+    close(sv[1]);
+    // Don't pass the socket to the commands we fork ourselves.
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    o_helpersock = sv[0];
+    o_helperpid = pid;
+    LOGINF("ExecCmd: spawn helper started, pid " << pid << "\n");
+    return true;
+}
+
+// Start the command through the helper if it is running. Returns
+// false if it is not, or failed (the caller then forks).
+static bool helperExec(const string& exe, const char **argv,
+                       const char **envv, ExecCmd::Internal *m,
+                       bool has_input, bool has_output)
+{
+    std::unique_lock<std::mutex> lock(o_helperlock);
+    if (o_helpersock < 0) {
+        return false;
+    }
+
+    string data;
+    auto add = [&data](const string& s) {
+        data += s;
+        data.push_back('\0');
+    };
+    add(exe);
+    add(m->m_stderrFile);
+    add(lltodecstr(m->m_rlimit_as_mbytes));
+    add(has_input ? "1" : "0");
+    add(has_output ? "1" : "0");
+    int argc = 0;
+    for (const char **ap = argv; *ap; ap++) {
+        argc++;
+    }
+    add(lltodecstr(argc));
+    for (const char **ap = argv; *ap; ap++) {
+        add(*ap);
+    }
+    for (const char **ep = envv; *ep; ep++) {
+        add(*ep);
+    }
+
+    int statuspipe[2];
+    if (pipe(statuspipe) < 0) {
+        return false;
+    }
+    vector<int> fds;
+    if (has_input) {
+        fds.push_back(m->m_pipein[0]);
+    }
+    if (has_output) {
+        fds.push_back(m->m_pipeout[1]);
+    }
+    fds.push_back(statuspipe[1]);
+
+    int32_t reply = -1;
+    bool ok = sendwithfds(o_helpersock, data.size(), fds) &&
+        sendall(o_helpersock, data.c_str(), data.size()) &&
+        recvall(o_helpersock, (char *)&reply, sizeof(reply));
+    close(statuspipe[1]);
+    if (!ok) {
+        LOGERR("ExecCmd: spawn helper failed, forking directly from now on\n");
+        close(o_helpersock);
+        o_helpersock = -1;
+        int status;
+        waitpid(o_helperpid, &status, WNOHANG);
+    }
+    if (!ok || reply <= 0) {
+        if (ok) {
+            LOGERR("ExecCmd: spawn helper: fork failed. errno " << -reply <<
+                   "\n");
+        }
+        close(statuspipe[0]);
+        return false;
+    }
+    fcntl(statuspipe[0], F_SETFD, FD_CLOEXEC);
+    m->m_pid = reply;
+    m->m_statusfd = statuspipe[0];
+    return true;
+}
+
+// Read the exit status sent by the helper.
+static bool readstatus(int fd, int *status)
+{
+    ssize_t n;
+    while ((n = read(fd, status, sizeof(*status))) < 0 && errno == EINTR);
+    return n == sizeof(*status);
+}
+
 void ExecCmd::setrlimit_as(int mbytes)
 {
     m->m_rlimit_as_mbytes = mbytes;
@@ -595,24 +973,29 @@ int ExecCmd::startExec(const string& cmd, const vector<string>& args,
     }
 
 #else
-    if (Internal::o_useVfork) {
-        LOGDEB1("using VFORK\n");
-        m->m_pid = vfork();
+    if (helperExec(exe, argv, envv, m, has_input, has_output)) {
+        LOGDEB1("using spawn helper\n");
     } else {
-        LOGDEB1("using FORK\n");
-        m->m_pid = fork();
-    }
-    if (m->m_pid < 0) {
-        LOGERR("ExecCmd::startExec: fork(2) failed. errno " << errno << "\n");
-        return -1;
-    }
-    if (m->m_pid == 0) {
-        // e.inactivate() is not needed. As we do not return, the call
-        // stack won't be unwound and destructors of local objects
-        // won't be called.
-        m->dochild(exe, argv, envv, has_input, has_output);
-        // dochild does not return. Just in case...
-        _exit(1);
+        if (Internal::o_useVfork) {
+            LOGDEB1("using VFORK\n");
+            m->m_pid = vfork();
+        } else {
+            LOGDEB1("using FORK\n");
+            m->m_pid = fork();
+        }
+        if (m->m_pid < 0) {
+            LOGERR("ExecCmd::startExec: fork(2) failed. errno " << errno <<
+                   "\n");
+            return -1;
+        }
+        if (m->m_pid == 0) {
+            // e.inactivate() is not needed. As we do not return, the call
+            // stack won't be unwound and destructors of local objects
+            // won't be called.
+            m->dochild(exe, argv, envv, has_input, has_output);
+            // dochild does not return. Just in case...
+            _exit(1);
+        }
     }
 #endif
 
@@ -951,7 +1334,12 @@ int ExecCmd::wait()
     ExecCmdRsrc e(this->m);
     int status = -1;
     if (!m->m_killRequest && m->m_pid > 0) {
-        if (waitpid(m->m_pid, &status, 0) < 0) {
+        if (m->m_statusfd >= 0) {
+            if (!readstatus(m->m_statusfd, &status)) {
+                LOGERR("ExecCmd::wait: no status from spawn helper\n");
+                status = -1;
+            }
+        } else if (waitpid(m->m_pid, &status, 0) < 0) {
             LOGERR("ExecCmd::waitpid: returned -1 errno " << errno << "\n");
             status = -1;
         }
@@ -972,7 +1360,20 @@ bool ExecCmd::maybereap(int *status)
         return true;
     }
 
-    pid_t pid = waitpid(m->m_pid, status, WNOHANG);
+    pid_t pid;
+    if (m->m_statusfd >= 0) {
+        struct pollfd pfd;
+        pfd.fd = m->m_statusfd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) == 0) {
+            pid = 0;
+        } else {
+            pid = readstatus(m->m_statusfd, status) ? m->m_pid : -1;
+        }
+    } else {
+        pid = waitpid(m->m_pid, status, WNOHANG);
+    }
     if (pid < 0) {
         LOGERR("ExecCmd::maybereap: returned -1 errno " << errno << "\n");
         m->m_pid = -1;
@@ -1255,6 +1656,10 @@ static char usage [] =
     "     <mimetype> the type of the file parameters\n"
     "trexecmd -w cmd : do the 'which' thing\n"
     "trexecmd -l cmd test getline\n"
+    "trexecmd -b [-H] cmd [arg1 arg2 ...]: spawn latency benchmark: run\n"
+    "     the command 100 times from a process with 300 MB of resident\n"
+    "     memory and print the average start+wait time\n"
+    "   -H : use the spawn helper\n"
     ;
 
 static void Usage(void)
@@ -1272,6 +1677,8 @@ static int     op_flags;
 #define OPT_m     0x40
 #define OPT_o     0x80
 #define OPT_l     0x100
+#define OPT_b     0x200
+#define OPT_H     0x400
 
 // Data sink for data coming out of the command. We also use it to set
 // a cancellation after a moment.
@@ -1349,9 +1756,15 @@ int main(int argc, char *argv[])
         }
         while (**argv)
             switch (*(*argv)++) {
+            case 'b':
+                op_flags |= OPT_b;
+                break;
             case 'c':
                 op_flags |= OPT_c;
                 break;
+            case 'H':
+                op_flags |= OPT_H;
+                break;
             case 'r':
                 op_flags |= OPT_r;
                 break;
@@ -1412,6 +1825,41 @@ int main(int argc, char *argv[])
         reexec.reexec();
     }
 
+    if (op_flags & OPT_H) {
+        // Must be done while we are small
+        if (!ExecCmd::startSpawnHelper()) {
+            cerr << "Could not start the spawn helper\n";
+            exit(1);
+        }
+    }
+
+    if (op_flags & OPT_b) {
+        const size_t mbytes = 300;
+        const int count = 100;
+        // Touch the memory so that it is resident
+        vector<char> ballast(mbytes * 1024 * 1024);
+        for (size_t i = 0; i < ballast.size(); i += 4096) {
+            ballast[i] = 1;
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < count; i++) {
+            ExecCmd mexec;
+            if (mexec.startExec(arg1, l, false, false) < 0) {
+                cerr << "Startexec failed\n";
+                exit(1);
+            }
+            mexec.wait();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = (end.tv_sec - start.tv_sec) * 1e6 +
+            (end.tv_nsec - start.tv_nsec) / 1e3;
+        cout << count << " runs, " << mbytes << " MB resident, " <<
+            ((op_flags & OPT_H) ? "spawn helper" : "direct fork") <<
+            ": " << us / count << " uS per command\n";
+        return 0;
+    }
+
     if (op_flags & OPT_w) {
         // Test "which" method
         string path;
@@ -70,6 +70,18 @@ public:
     // far as I can see, but just in case...
     static void useVfork(bool on);
 
+    /**
+     * Start a helper process which will then do the fork/exec for all
+     * commands. The helper is a fork of the caller, so this must be
+     * called early, while the process is still small, and before
+     * any thread is started. Commands are then started without
+     * having to duplicate the page tables of a big multithreaded
+     * process. The command processes are not our children, but their
+     * exit status is transmitted back, and wait()/maybereap() work as
+     * usual. If the helper fails, we fall back to forking directly.
+     */
+    static bool startSpawnHelper();
+
     /**
      * Add/replace environment variable before executing command. This must
      * be called before doexec() to have an effect (possibly multiple
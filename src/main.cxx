@@ -43,6 +43,10 @@
 #include "mediaserver/mediaserver.hxx"
 #include "mediaserver/contentdirectory.hxx"
 #include "httpfs.hxx"
+#include "asynclog.hxx"
+#include "confwatch.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
 #include "upmpdutils.hxx"
 #include "pathut.h"
 
@@ -159,6 +163,8 @@ unordered_set<string> g_supportedFormats;
 static UpnpDevice *dev;
 
 string g_datadir(DATADIR "/");
+// Directory for persistent cached data (metacache, media server indexes)
+string g_cachedir;
 
 // Global
 string g_configfilename;
@@ -220,6 +226,10 @@ int main(int argc, char *argv[])
     string presentationhtml(DATADIR "/presentation.html");
     string iface;
     unsigned short upport = 0;
+    int metricsport = 0;
+    int tracebufsize = 0;
+    bool asynclog = false;
+    bool spawnhelper = false;
     string upnpip;
     int msm = 0;
     bool inprocessms = false;
@@ -292,7 +302,7 @@ int main(int argc, char *argv[])
 
     string cachedir;
     if (!g_configfilename.empty()) {
-        g_config = new ConfSimple(g_configfilename.c_str(), 1, true);
+        g_config = new ConfSimple(g_configfilename.c_str(), 1, true, true);
         if (!g_config || !g_config->ok()) {
             cerr << "Could not open config: " << g_configfilename << endl;
             return 1;
@@ -305,6 +315,10 @@ int main(int argc, char *argv[])
             g_config->get("friendlyname", friendlyname);
         if (!(op_flags & OPT_l) && g_config->get("loglevel", value))
             loglevel = atoi(value.c_str());
+        if (g_config->get("asynclog", value))
+            asynclog = atoi(value.c_str()) != 0;
+        if (g_config->get("spawnhelper", value))
+            spawnhelper = atoi(value.c_str()) != 0;
         if (!(op_flags & OPT_h))
             g_config->get("mpdhost", mpdhost);
         if (!(op_flags & OPT_p) && g_config->get("mpdport", value)) {
@@ -314,6 +328,10 @@ int main(int argc, char *argv[])
         if (!(op_flags & OPT_q) && g_config->get("ownqueue", value)) {
             ownqueue = atoi(value.c_str()) != 0;
         }
+        if (g_config->get("mpdpollmaxsecs", value))
+            opts.pollmaxsecs = atoi(value.c_str());
+        if (g_config->get("mpdstatusmaxage", value))
+            opts.statusmaxagems = atoi(value.c_str());
         if (g_config->get("openhome", value)) {
             enableOH = atoi(value.c_str()) != 0;
         }
@@ -354,10 +372,20 @@ int main(int argc, char *argv[])
         }
         if (g_config->get("schttpport", value))
             opts.schttpport = atoi(value.c_str());
+        if (g_config->get("metricsport", value))
+            metricsport = atoi(value.c_str());
+        if (g_config->get("tracebufsize", value))
+            tracebufsize = atoi(value.c_str());
         g_config->get("scplaymethod", opts.scplaymethod);
+        if (g_config->get("scstandby", value))
+            opts.scstandby = atoi(value.c_str()) != 0;
         g_config->get("sc2mpd", sc2mpdpath);
         if (g_config->get("ohmetasleep", value))
             opts.ohmetasleep = atoi(value.c_str());
+        if (g_config->get("volumeinterval", value))
+            opts.volintervalms = atoi(value.c_str());
+        if (g_config->get("volumerampstep", value))
+            opts.volrampstep = atoi(value.c_str());
         g_config->get("ohmanufacturername", ohProductDesc.manufacturer.name);
         g_config->get("ohmanufacturerinfo", ohProductDesc.manufacturer.info);
         g_config->get("ohmanufacturerurl", ohProductDesc.manufacturer.url);
@@ -460,6 +488,7 @@ int main(int argc, char *argv[])
 	if (cachedir.empty())
             cachedir = path_cat(path_tildexpand("~") , "/.cache/upmpdcli");
     }
+    g_cachedir = cachedir;
 
     string& mcfn = opts.cachefn;
     // no cache access needed or desirable for a pure media server
@@ -519,6 +548,18 @@ int main(int argc, char *argv[])
 
 //// Dropped root 
 
+    // The spawn helper is a fork of this process: start it while we
+    // are small and have no threads.
+    if (spawnhelper) {
+        ExecCmd::startSpawnHelper();
+    }
+
+    // Now that we are done forking, possibly switch to asynchronous
+    // log file writes.
+    if (asynclog) {
+        asyncLogInit(1024 * 1024);
+    }
+
     if (sc2mpdpath.empty()) {
         // Do we have an sc2mpd command installed (for songcast)?
         if (!ExecCmd::which("sc2mpd", sc2mpdpath))
@@ -633,6 +674,16 @@ int main(int argc, char *argv[])
         pidfilename = pidfilename + "-ms";
     }
 
+    // Request tracing, dumped on SIGUSR2 or through the metrics server
+    traceInit(tracebufsize,
+              path_cat(g_cachedir, msonly ? "trace-ms.json" : "trace.json"));
+
+    // Internal metrics HTTP server. A Media Server-only process (as
+    // forked by the renderer) uses the next port.
+    if (metricsport > 0) {
+        metricsStartHttp(msonly ? metricsport + 1 : metricsport);
+    }
+
     // Initialize the data we serve through HTTP (device and service
     // descriptions, icons, presentation page, etc.)
     unordered_map<string, VDirContent> files;
@@ -718,6 +769,14 @@ int main(int argc, char *argv[])
     } else {
         LOGDEB("Renderer event loop" << endl);
         dev = mediarenderer;
+        if (!g_configfilename.empty()) {
+            // Reload the radio list, source list and hooks when the
+            // configuration changes. The services check for a new
+            // generation when generating events.
+            UpMpd *renderer = mediarenderer;
+            confWatchStart(g_configfilename,
+                           [renderer] () {renderer->loopWakeup();});
+        }
         mediarenderer->eventloop();
     }
     LOGDEB("Event loop returned" << endl);
@@ -23,6 +23,7 @@
 
 extern std::string g_configfilename;
 extern std::string g_datadir;
+extern std::string g_cachedir;
 class ConfSimple;
 extern std::mutex g_configlock;
 extern ConfSimple *g_config;
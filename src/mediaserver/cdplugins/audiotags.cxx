@@ -0,0 +1,507 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "audiotags.hxx"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <string>
+#include <unordered_map>
+
+#include "libupnpp/log.hxx"
+
+#include "pathut.h"
+#include "smallut.h"
+
+using namespace std;
+
+static const unordered_map<string, string> o_mimes {
+    {"flac", "audio/flac"},
+    {"mp3", "audio/mpeg"},
+    {"ogg", "application/ogg"},
+    {"oga", "application/ogg"},
+    {"opus", "application/ogg"},
+    {"m4a", "audio/mp4"},
+    {"aac", "audio/aac"},
+    {"wav", "audio/x-wav"},
+    {"aif", "audio/x-aiff"},
+    {"aiff", "audio/x-aiff"},
+};
+
+const string& audioMimeForPath(const string& path)
+{
+    static const string empty;
+    string ext = stringtolower(path_suffix(path));
+    auto it = o_mimes.find(ext);
+    if (it == o_mimes.end()) {
+        return empty;
+    }
+    return it->second;
+}
+
+// Read cnt bytes at offset. Short reads are ok, the result is
+// truncated to what we got.
+static bool readat(int fd, off_t offs, size_t cnt, string& out)
+{
+    out.resize(cnt);
+    size_t got = 0;
+    while (got < cnt) {
+        ssize_t ret = pread(fd, &out[got], cnt - got, offs + got);
+        if (ret <= 0) {
+            break;
+        }
+        got += ret;
+    }
+    out.resize(got);
+    return got > 0;
+}
+
+static inline unsigned int le32(const string& s, size_t i)
+{
+    const unsigned char *b = (const unsigned char *)s.c_str() + i;
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned int)b[3] << 24);
+}
+
+static inline unsigned int be32(const string& s, size_t i)
+{
+    const unsigned char *b = (const unsigned char *)s.c_str() + i;
+    return ((unsigned int)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static inline unsigned int syncsafe32(const string& s, size_t i)
+{
+    const unsigned char *b = (const unsigned char *)s.c_str() + i;
+    return ((b[0] & 0x7f) << 21) | ((b[1] & 0x7f) << 14) |
+        ((b[2] & 0x7f) << 7) | (b[3] & 0x7f);
+}
+
+static void appendutf8(string& out, unsigned int c)
+{
+    if (c < 0x80) {
+        out += char(c);
+    } else if (c < 0x800) {
+        out += char(0xc0 | (c >> 6));
+        out += char(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += char(0xe0 | (c >> 12));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    } else {
+        out += char(0xf0 | (c >> 18));
+        out += char(0x80 | ((c >> 12) & 0x3f));
+        out += char(0x80 | ((c >> 6) & 0x3f));
+        out += char(0x80 | (c & 0x3f));
+    }
+}
+
+static string latin1toutf8(const char *cp, size_t len)
+{
+    string out;
+    for (size_t i = 0; i < len && cp[i]; i++) {
+        appendutf8(out, (unsigned char)cp[i]);
+    }
+    return out;
+}
+
+static string utf16toutf8(const char *cp, size_t len, bool bigendian)
+{
+    string out;
+    const unsigned char *b = (const unsigned char *)cp;
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        unsigned int c = bigendian ? (b[i] << 8) | b[i+1] :
+            (b[i+1] << 8) | b[i];
+        if (c == 0) {
+            break;
+        }
+        if (c >= 0xd800 && c < 0xdc00 && i + 3 < len) {
+            unsigned int c2 = bigendian ? (b[i+2] << 8) | b[i+3] :
+                (b[i+3] << 8) | b[i+2];
+            c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+            i += 2;
+        }
+        appendutf8(out, c);
+    }
+    return out;
+}
+
+// We store the tags in a tab-separated file, and display them in
+// one-line lists: get rid of control characters.
+static void cleanvalue(string& value)
+{
+    for (auto& c : value) {
+        if ((unsigned char)c < 0x20) {
+            c = ' ';
+        }
+    }
+    trimstring(value, " ");
+}
+
+static void setifempty(string& dest, const string& value)
+{
+    if (dest.empty() && !value.empty()) {
+        dest = value;
+        cleanvalue(dest);
+    }
+}
+
+// Vorbis comment block, shared by FLAC and Ogg Vorbis/Opus.
+static void parseVorbisComment(const string& data, size_t i, AudioTags& tags)
+{
+    if (i + 4 > data.size()) {
+        return;
+    }
+    // Skip vendor string
+    i += 4 + le32(data, i);
+    if (i + 4 > data.size()) {
+        return;
+    }
+    unsigned int cnt = le32(data, i);
+    i += 4;
+    for (unsigned int n = 0; n < cnt; n++) {
+        if (i + 4 > data.size()) {
+            return;
+        }
+        unsigned int len = le32(data, i);
+        i += 4;
+        if (i + len > data.size()) {
+            return;
+        }
+        string comment = data.substr(i, len);
+        i += len;
+        string::size_type eq = comment.find('=');
+        if (eq == string::npos) {
+            continue;
+        }
+        string key = stringtoupper(comment.substr(0, eq));
+        string value = comment.substr(eq + 1);
+        if (key == "TITLE") {
+            setifempty(tags.title, value);
+        } else if (key == "ARTIST") {
+            setifempty(tags.artist, value);
+        } else if (key == "ALBUMARTIST" || key == "ALBUM ARTIST") {
+            setifempty(tags.albumartist, value);
+        } else if (key == "ALBUM") {
+            setifempty(tags.album, value);
+        } else if (key == "GENRE") {
+            setifempty(tags.genre, value);
+        } else if (key == "DATE") {
+            setifempty(tags.date, value);
+        } else if (key == "TRACKNUMBER") {
+            setifempty(tags.tracknum, value);
+        } else if (key == "COMPOSER") {
+            setifempty(tags.composer, value);
+        }
+    }
+}
+
+static bool readFlac(int fd, off_t fsize, AudioTags& tags)
+{
+    string data;
+    if (!readat(fd, 0, 4, data) || data.compare("fLaC")) {
+        return false;
+    }
+    // Walk the metadata blocks. We only read the ones we need: the
+    // blocks before the comments may hold big pictures.
+    off_t offs = 4;
+    for (;;) {
+        string hdr;
+        if (!readat(fd, offs, 4, hdr) || hdr.size() != 4) {
+            break;
+        }
+        bool last = (hdr[0] & 0x80) != 0;
+        int type = hdr[0] & 0x7f;
+        unsigned int len = be32(hdr, 0) & 0xffffff;
+        offs += 4;
+        if (type == 0 && len >= 18) {
+            // STREAMINFO
+            if (!readat(fd, offs, 18, data) || data.size() != 18) {
+                return false;
+            }
+            const unsigned char *b = (const unsigned char *)data.c_str();
+            tags.samplefreq = (b[10] << 12) | (b[11] << 4) | (b[12] >> 4);
+            tags.channels = ((b[12] >> 1) & 0x7) + 1;
+            uint64_t samples = ((uint64_t)(b[13] & 0xf) << 32) | be32(data, 14);
+            if (tags.samplefreq > 0) {
+                tags.duration_secs = int(samples / tags.samplefreq);
+            }
+            if (tags.duration_secs > 0) {
+                tags.bitrate = int(fsize * 8 / tags.duration_secs);
+            }
+        } else if (type == 4) {
+            // VORBIS_COMMENT
+            if (!readat(fd, offs, len, data)) {
+                return false;
+            }
+            parseVorbisComment(data, 0, tags);
+        }
+        offs += len;
+        if (last || offs >= fsize) {
+            break;
+        }
+    }
+    return true;
+}
+
+static bool readOgg(int fd, off_t fsize, AudioTags& tags)
+{
+    // The identification and comment headers are in the first pages.
+    string data;
+    if (!readat(fd, 0, 64 * 1024, data) || data.find("OggS") != 0) {
+        return false;
+    }
+    bool opus = false;
+    string::size_type pos = data.find("\x01vorbis");
+    if (pos != string::npos && pos + 16 <= data.size()) {
+        tags.channels = (unsigned char)data[pos + 11];
+        tags.samplefreq = le32(data, pos + 12);
+    } else if ((pos = data.find("OpusHead")) != string::npos &&
+               pos + 16 <= data.size()) {
+        opus = true;
+        tags.channels = (unsigned char)data[pos + 9];
+        // Opus granule positions are always at 48 kHz.
+        tags.samplefreq = 48000;
+    } else {
+        return false;
+    }
+    if (opus) {
+        pos = data.find("OpusTags");
+        if (pos != string::npos) {
+            parseVorbisComment(data, pos + 8, tags);
+        }
+    } else {
+        pos = data.find("\x03vorbis");
+        if (pos != string::npos) {
+            parseVorbisComment(data, pos + 7, tags);
+        }
+    }
+
+    // Duration: granule position for the last page.
+    off_t tailoffs = fsize > 64 * 1024 ? fsize - 64 * 1024 : 0;
+    if (tags.samplefreq > 0 && readat(fd, tailoffs, 64 * 1024, data)) {
+        pos = data.rfind("OggS");
+        if (pos != string::npos && pos + 14 <= data.size()) {
+            uint64_t granule = ((uint64_t)le32(data, pos + 10) << 32) |
+                le32(data, pos + 6);
+            tags.duration_secs = int(granule / tags.samplefreq);
+            if (tags.duration_secs > 0) {
+                tags.bitrate = int(fsize * 8 / tags.duration_secs);
+            }
+        }
+    }
+    return true;
+}
+
+// Decode an ID3v2 text frame. We only keep the first value.
+static string id3text(const string& frame)
+{
+    if (frame.empty()) {
+        return string();
+    }
+    const char *cp = frame.c_str() + 1;
+    size_t len = frame.size() - 1;
+    string out;
+    switch (frame[0]) {
+    case 0:
+        out = latin1toutf8(cp, len);
+        break;
+    case 1:
+        if (len >= 2) {
+            bool be = (unsigned char)cp[0] == 0xfe;
+            out = utf16toutf8(cp + 2, len - 2, be);
+        }
+        break;
+    case 2:
+        out = utf16toutf8(cp, len, true);
+        break;
+    case 3:
+    default:
+        out = string(cp, strnlen(cp, len));
+        break;
+    }
+    cleanvalue(out);
+    return out;
+}
+
+// Use the first MPEG audio frame after the tag to compute the
+// duration, from the Xing/Info frame count if present, else from
+// the bit rate.
+static void mpegDuration(int fd, off_t offs, off_t fsize, AudioTags& tags)
+{
+    static const int br1[] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160,
+                              192, 224, 256, 320, 0};
+    static const int br2[] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112,
+                              128, 144, 160, 0};
+    static const int sr[] = {44100, 48000, 32000, 0};
+    string data;
+    if (!readat(fd, offs, 4096, data)) {
+        return;
+    }
+    const unsigned char *b = (const unsigned char *)data.c_str();
+    size_t i = 0;
+    for (; i + 4 < data.size(); i++) {
+        if (b[i] == 0xff && (b[i+1] & 0xe0) == 0xe0) {
+            break;
+        }
+    }
+    if (i + 40 >= data.size()) {
+        return;
+    }
+    int version = (b[i+1] >> 3) & 0x3; // 3: MPEG1, 2: MPEG2, 0: MPEG2.5
+    int layer = (b[i+1] >> 1) & 0x3;   // 1: Layer III
+    int bridx = b[i+2] >> 4;
+    int sridx = (b[i+2] >> 2) & 0x3;
+    bool mono = ((b[i+3] >> 6) & 0x3) == 3;
+    if (layer != 1 || version == 1 || sr[sridx] == 0) {
+        return;
+    }
+    bool mpeg1 = version == 3;
+    tags.samplefreq = sr[sridx] / (mpeg1 ? 1 : (version == 2 ? 2 : 4));
+    tags.channels = mono ? 1 : 2;
+    int kbps = mpeg1 ? br1[bridx] : br2[bridx];
+    int spf = mpeg1 ? 1152 : 576;
+
+    size_t xoffs = i + 4 + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+    if (xoffs + 12 <= data.size() &&
+        (!data.compare(xoffs, 4, "Xing") || !data.compare(xoffs, 4, "Info")) &&
+        (be32(data, xoffs + 4) & 0x1)) {
+        unsigned int frames = be32(data, xoffs + 8);
+        tags.duration_secs = int((uint64_t)frames * spf / tags.samplefreq);
+        if (tags.duration_secs > 0) {
+            tags.bitrate = int((fsize - offs) * 8 / tags.duration_secs);
+        }
+    } else if (kbps > 0) {
+        tags.bitrate = kbps * 1000;
+        tags.duration_secs = int((fsize - offs) * 8 / tags.bitrate);
+    }
+}
+
+static bool readMp3(int fd, off_t fsize, AudioTags& tags)
+{
+    string data;
+    off_t audiooffs = 0;
+    if (readat(fd, 0, 10, data) && data.size() == 10 &&
+        !data.compare(0, 3, "ID3")) {
+        int major = data[3];
+        int flags = data[5];
+        unsigned int tagsize = syncsafe32(data, 6);
+        audiooffs = 10 + tagsize;
+        off_t offs = 10;
+        if ((flags & 0x40) && major >= 3) {
+            // Extended header
+            if (!readat(fd, offs, 4, data) || data.size() != 4) {
+                return false;
+            }
+            offs += major == 4 ? syncsafe32(data, 0) : be32(data, 0) + 4;
+        }
+        int hdrlen = major == 2 ? 6 : 10;
+        int idlen = major == 2 ? 3 : 4;
+        while (offs + hdrlen < audiooffs) {
+            string hdr;
+            if (!readat(fd, offs, hdrlen, hdr) || int(hdr.size()) != hdrlen ||
+                hdr[0] == 0) {
+                // Padding or error
+                break;
+            }
+            string id = hdr.substr(0, idlen);
+            unsigned int len;
+            if (major == 2) {
+                len = (be32(hdr, 2) >> 8) & 0xffffff;
+            } else if (major == 4) {
+                len = syncsafe32(hdr, 4);
+            } else {
+                len = be32(hdr, 4);
+            }
+            offs += hdrlen;
+            if (offs + len > audiooffs) {
+                break;
+            }
+            string *dest = nullptr;
+            if (id == "TIT2" || id == "TT2") {
+                dest = &tags.title;
+            } else if (id == "TPE1" || id == "TP1") {
+                dest = &tags.artist;
+            } else if (id == "TPE2" || id == "TP2") {
+                dest = &tags.albumartist;
+            } else if (id == "TALB" || id == "TAL") {
+                dest = &tags.album;
+            } else if (id == "TCON" || id == "TCO") {
+                dest = &tags.genre;
+            } else if (id == "TRCK" || id == "TRK") {
+                dest = &tags.tracknum;
+            } else if (id == "TDRC" || id == "TYER" || id == "TYE") {
+                dest = &tags.date;
+            } else if (id == "TCOM" || id == "TCM") {
+                dest = &tags.composer;
+            }
+            if (dest && dest->empty() && len < 64 * 1024) {
+                string frame;
+                if (readat(fd, offs, len, frame)) {
+                    *dest = id3text(frame);
+                }
+            }
+            offs += len;
+        }
+    }
+
+    if (tags.title.empty() && fsize > 128 &&
+        readat(fd, fsize - 128, 128, data) && data.size() == 128 &&
+        !data.compare(0, 3, "TAG")) {
+        // ID3v1
+        tags.title = latin1toutf8(data.c_str() + 3, 30);
+        tags.artist = latin1toutf8(data.c_str() + 33, 30);
+        tags.album = latin1toutf8(data.c_str() + 63, 30);
+        tags.date = latin1toutf8(data.c_str() + 93, 4);
+        cleanvalue(tags.title);
+        cleanvalue(tags.artist);
+        cleanvalue(tags.album);
+        cleanvalue(tags.date);
+    }
+
+    mpegDuration(fd, audiooffs, fsize, tags);
+    return true;
+}
+
+bool audioTagsRead(const string& path, const string& mime, AudioTags& tags)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOGERR("audioTagsRead: open(" << path << ") errno " << errno << endl);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    bool ret = false;
+    if (mime == "audio/flac") {
+        ret = readFlac(fd, st.st_size, tags);
+    } else if (mime == "application/ogg") {
+        ret = readOgg(fd, st.st_size, tags);
+    } else if (mime == "audio/mpeg") {
+        ret = readMp3(fd, st.st_size, tags);
+    }
+    close(fd);
+    LOGDEB1("audioTagsRead: " << path << " title " << tags.title <<
+            " album " << tags.album << " duration " << tags.duration_secs <<
+            endl);
+    return ret;
+}
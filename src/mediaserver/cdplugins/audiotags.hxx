@@ -0,0 +1,57 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _AUDIOTAGS_H_INCLUDED_
+#define _AUDIOTAGS_H_INCLUDED_
+
+#include <string>
+
+// Minimal native audio tag extraction, used by the local library
+// index. We only look at the formats which make up most collections
+// (FLAC, Ogg Vorbis, MP3 with ID3v2), and only extract what the
+// media server displays. Other audio files get indexed with empty
+// tags (the title will then be the file name).
+class AudioTags {
+public:
+    AudioTags() {
+    }
+    std::string title;
+    std::string artist;
+    std::string albumartist;
+    std::string album;
+    std::string genre;
+    std::string date;
+    std::string tracknum;
+    std::string composer;
+    int duration_secs{0};
+    int samplefreq{0};
+    int channels{0};
+    // bits per second
+    int bitrate{0};
+};
+
+/// Return the mime type for an audio file path, based on the
+/// extension, or an empty string if this is not an audio file we know of.
+extern const std::string& audioMimeForPath(const std::string& path);
+
+/// Read the tags for the file. The mime type is the one returned
+/// by audioMimeForPath().
+/// @return false if the file could not be read or parsed. The
+///    tags may still be partially set.
+extern bool audioTagsRead(const std::string& path, const std::string& mime,
+                          AudioTags& tags);
+
+#endif /* _AUDIOTAGS_H_INCLUDED_ */
@@ -106,7 +106,8 @@ public:
     /// @param stidx first entry to return.
     /// @param cnt number of entries.
     /// @param[output] entries output content.
-    /// @param sortcrits csv list of sort criteria.
+    /// @param sortcrits list of sort criteria (e.g. "+dc:title"). See
+    ///    UpSongSorter in upsongsort.hxx.
     /// @param flg browse flag
     /// @return total number of matched entries in container
     virtual int browse(
@@ -126,7 +127,7 @@ public:
     /// @param stidx first entry to return.
     /// @param cnt number of entries.
     /// @param[output] entries output content.
-    /// @param sortcrits csv list of sort criteria.
+    /// @param sortcrits list of sort criteria.
     /// @return total number of matched entries in container
     virtual int search(
 	const std::string& ctid, int stidx, int cnt,
@@ -135,6 +136,14 @@ public:
 	const std::vector<std::string>& sortcrits = std::vector<std::string>())
     = 0;
 
+    /// Optionally start the initialization (e.g. starting a
+    /// subprocess and logging in to a service) in the background, so
+    /// that the first request does not have to wait for it. Called
+    /// at startup if plgwarmup is set. The requests which arrive
+    /// before the initialization is complete wait for it.
+    virtual void warmup() {
+    }
+
     const std::string& getname() {
         return m_name;
     }
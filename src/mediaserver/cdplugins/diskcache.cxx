@@ -0,0 +1,295 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "diskcache.hxx"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <set>
+
+#include "libupnpp/log.hxx"
+
+#include "pathut.h"
+#include "readfile.h"
+#include "smallut.h"
+
+using namespace std;
+
+// Record header. Bump the version if the format changes, the old
+// records will be ignored and replaced.
+static const char o_magic[4] = {'U', 'P', 'D', 'C'};
+static const uint32_t o_version = 1;
+struct RecHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t stored;
+    uint32_t keylen;
+    uint32_t datalen;
+};
+
+DiskCache::DiskCache(const string& dir, int64_t maxbytes)
+    : m_dir(dir), m_maxbytes(maxbytes)
+{
+}
+
+// FNV-1a. The keys are checked on reading, so a collision only means
+// that the two keys share one record.
+string DiskCache::fn(const string& key)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (auto c : key) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ULL;
+    }
+    char buf[30];
+    sprintf(buf, "%016llx", (unsigned long long)h);
+    return string(buf) + ".rec";
+}
+
+// List the existing records. Done on first use instead of at startup,
+// the cache may never be accessed.
+void DiskCache::init()
+{
+    if (m_initdone) {
+        return;
+    }
+    m_initdone = true;
+    if (!path_makepath(m_dir, 0755)) {
+        LOGERR("DiskCache: can't create " << m_dir << " errno " <<
+               errno << endl);
+        return;
+    }
+    string reason;
+    set<string> entries;
+    if (!readdir(m_dir, reason, entries)) {
+        LOGERR("DiskCache: " << reason << endl);
+        return;
+    }
+    for (const auto& entry : entries) {
+        string path = path_cat(m_dir, entry);
+        string suffix = path_suffix(entry);
+        if (suffix != "rec") {
+            // Leftover temporary from an interrupted write
+            if (suffix == "tmp") {
+                unlink(path.c_str());
+            }
+            continue;
+        }
+        struct stat st;
+        if (path_fileprops(path, &st) < 0) {
+            continue;
+        }
+        m_files[entry] = FileInfo{st.st_size, st.st_mtime};
+        m_totalbytes += st.st_size;
+    }
+    LOGDEB("DiskCache: " << m_files.size() << " records, " <<
+           m_totalbytes / 1024 << " KB in " << m_dir << endl);
+    evict(string());
+}
+
+bool DiskCache::get(const string& key, string& data, time_t *stored)
+{
+    lock_guard<mutex> lock(m_mutex);
+    init();
+    string name = fn(key);
+    auto it = m_files.find(name);
+    if (it == m_files.end()) {
+        return false;
+    }
+    string path = path_cat(m_dir, name);
+    string record, reason;
+    if (!file_to_string(path, record, &reason)) {
+        LOGERR("DiskCache::get: " << reason << endl);
+        return false;
+    }
+    RecHeader hd;
+    if (record.size() < sizeof(hd)) {
+        return false;
+    }
+    memcpy(&hd, record.c_str(), sizeof(hd));
+    if (memcmp(hd.magic, o_magic, sizeof(o_magic)) ||
+        hd.version != o_version ||
+        record.size() != sizeof(hd) + uint64_t(hd.keylen) + hd.datalen ||
+        key.compare(0, string::npos, record, sizeof(hd), hd.keylen)) {
+        LOGDEB0("DiskCache::get: bad record or other key for " << key << endl);
+        return false;
+    }
+    data.assign(record, sizeof(hd) + hd.keylen, hd.datalen);
+    if (stored) {
+        *stored = hd.stored;
+    }
+    // Remember the use time for the eviction, also for the next run
+    utimes(path.c_str(), nullptr);
+    it->second.used = time(0);
+    return true;
+}
+
+bool DiskCache::put(const string& key, const string& data)
+{
+    lock_guard<mutex> lock(m_mutex);
+    init();
+    RecHeader hd;
+    memcpy(hd.magic, o_magic, sizeof(o_magic));
+    hd.version = o_version;
+    hd.stored = time(0);
+    hd.keylen = key.size();
+    hd.datalen = data.size();
+
+    string name = fn(key);
+    string path = path_cat(m_dir, name);
+    string tmp = path + ".tmp";
+    ofstream out(tmp, ios::out | ios::trunc | ios::binary);
+    if (!out.is_open()) {
+        LOGERR("DiskCache::put: can't open " << tmp << endl);
+        return false;
+    }
+    out.write((const char *)&hd, sizeof(hd));
+    out.write(key.c_str(), key.size());
+    out.write(data.c_str(), data.size());
+    out.close();
+    if (out.fail()) {
+        LOGERR("DiskCache::put: write failed for " << tmp << endl);
+        unlink(tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), path.c_str()) < 0) {
+        LOGERR("DiskCache::put: rename to " << path << " errno " <<
+               errno << endl);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    int64_t size = sizeof(hd) + key.size() + data.size();
+    auto it = m_files.find(name);
+    if (it != m_files.end()) {
+        m_totalbytes -= it->second.size;
+    }
+    m_files[name] = FileInfo{size, hd.stored};
+    m_totalbytes += size;
+    evict(name);
+    return true;
+}
+
+void DiskCache::erase(const string& key)
+{
+    lock_guard<mutex> lock(m_mutex);
+    init();
+    string name = fn(key);
+    auto it = m_files.find(name);
+    if (it != m_files.end()) {
+        unlink(path_cat(m_dir, name).c_str());
+        m_totalbytes -= it->second.size;
+        m_files.erase(it);
+    }
+}
+
+// Delete the least recently used records until we are under the
+// size limit. The record just written is kept in any case.
+void DiskCache::evict(const string& keep)
+{
+    while (m_totalbytes > m_maxbytes) {
+        auto oldest = m_files.end();
+        for (auto it = m_files.begin(); it != m_files.end(); it++) {
+            if (it->first != keep &&
+                (oldest == m_files.end() ||
+                 it->second.used < oldest->second.used)) {
+                oldest = it;
+            }
+        }
+        if (oldest == m_files.end()) {
+            break;
+        }
+        LOGDEB0("DiskCache: evicting " << oldest->first << endl);
+        unlink(path_cat(m_dir, oldest->first).c_str());
+        m_totalbytes -= oldest->second.size;
+        m_files.erase(oldest);
+    }
+}
+
+#ifdef DISKCACHE_TEST
+// Build in src with:
+//   c++ -std=c++11 -DDISKCACHE_TEST -I. -I/usr/include/libupnpp
+//       -o diskcache mediaserver/cdplugins/diskcache.cxx pathut.cpp
+//       readfile.cpp smallut.cpp -lupnpp
+#include <stdlib.h>
+
+static int fails;
+#define CHECK(X) do {                                                   \
+        if (!(X)) {                                                     \
+            fprintf(stderr, "Line %d: check failed: %s\n", __LINE__, #X); \
+            fails++;                                                    \
+        }                                                               \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: diskcache <testdir>\n");
+        return 1;
+    }
+    string dir(argv[1]);
+    string data(1000, 'x'), out;
+    time_t stored;
+    {
+        DiskCache dc(dir, 3500);
+        CHECK(!dc.get("k1", out, &stored));
+        CHECK(dc.put("k1", data));
+        CHECK(dc.get("k1", out, &stored) && out == data);
+        CHECK(stored <= time(0) && stored > time(0) - 5);
+        // The use times have a 1 s resolution
+        sleep(1);
+        CHECK(dc.put("k2", data));
+        sleep(1);
+        CHECK(dc.put("k3", data));
+        // Make k1 the most recently used, then k2 should go.
+        sleep(1);
+        CHECK(dc.get("k1", out, nullptr));
+        CHECK(dc.put("k4", data));
+        CHECK(!dc.get("k2", out, nullptr));
+        CHECK(dc.get("k1", out, nullptr));
+        CHECK(dc.get("k4", out, nullptr));
+        dc.erase("k4");
+        CHECK(!dc.get("k4", out, nullptr));
+        CHECK(dc.put("k3", "short"));
+        CHECK(dc.get("k3", out, nullptr) && out == "short");
+    }
+    {
+        // Restart: the records are still there.
+        DiskCache dc(dir, 3500);
+        CHECK(dc.get("k1", out, nullptr) && out == data);
+        sleep(1);
+        CHECK(dc.get("k3", out, nullptr) && out == "short");
+        CHECK(!dc.get("k2", out, nullptr));
+    }
+    {
+        // A smaller cap trims the old records on startup (k1 was
+        // used before k3 above).
+        DiskCache dc(dir, 1000);
+        CHECK(!dc.get("k1", out, nullptr));
+        CHECK(dc.get("k3", out, nullptr));
+    }
+    printf("%s\n", fails ? "FAILED" : "OK");
+    return fails ? 1 : 0;
+}
+#endif // DISKCACHE_TEST
@@ -0,0 +1,72 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _DISKCACHE_H_INCLUDED_
+#define _DISKCACHE_H_INCLUDED_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Persistent key/data store, used as a second level for the plugin
+// content caches, so that the results survive a restart.
+//
+// Each record is stored in its own file inside the cache directory,
+// with a small binary header (format version, storage time, key). The
+// file name is a hash of the key, and the key is checked on
+// reading. The total size is capped: when it is exceeded, the least
+// recently used records are deleted. The last use time is the file
+// modification time, which we update on each read, so that it is
+// preserved across restarts.
+//
+// The storage time is returned to the caller, which decides if the
+// data is still usable (there is no expiration inside the cache
+// beyond the size cap). All methods are thread-safe.
+class DiskCache {
+public:
+    DiskCache(const std::string& dir, int64_t maxbytes);
+
+    /// Retrieve the data for key. Returns false if there is no valid
+    /// record. The storage time is returned in *stored if not null.
+    bool get(const std::string& key, std::string& data, time_t *stored);
+    /// Store or replace the data for key, evicting old records if
+    /// needed.
+    bool put(const std::string& key, const std::string& data);
+    /// Delete the record for key, if any.
+    void erase(const std::string& key);
+
+private:
+    struct FileInfo {
+        int64_t size;
+        time_t used;
+    };
+    void init();
+    std::string fn(const std::string& key);
+    void evict(const std::string& keep);
+
+    std::string m_dir;
+    int64_t m_maxbytes;
+    bool m_initdone{false};
+    int64_t m_totalbytes{0};
+    // Record files by file name.
+    std::unordered_map<std::string, FileInfo> m_files;
+    std::mutex m_mutex;
+};
+
+#endif /* _DISKCACHE_H_INCLUDED_ */
@@ -0,0 +1,613 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "jsonentries.hxx"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libupnpp/log.hxx"
+#include "smallut.h"
+
+using namespace std;
+
+namespace {
+
+// Minimal on-demand JSON scanner over a memory buffer. Values are
+// either decoded to a string, or skipped.
+class Scanner {
+public:
+    Scanner(const string& s)
+        : m_cp(s.c_str()), m_end(s.c_str() + s.size()) {
+    }
+    void skipws() {
+        while (m_cp < m_end &&
+               (*m_cp == ' ' || *m_cp == '\n' || *m_cp == '\r' ||
+                *m_cp == '\t')) {
+            m_cp++;
+        }
+    }
+    bool atend() {
+        skipws();
+        return m_cp >= m_end;
+    }
+    bool peek(char c) {
+        skipws();
+        return m_cp < m_end && *m_cp == c;
+    }
+    bool expect(char c) {
+        if (peek(c)) {
+            m_cp++;
+            return true;
+        }
+        return false;
+    }
+    // Decode (or skip if out is null) the string at the current
+    // position, appending to out.
+    bool str(string *out);
+    // Decode a value, appending to out (if not null), the way
+    // Json::Value::asString() would: string contents, literal text
+    // for numbers and booleans, nothing for null. Objects and arrays
+    // are skipped and yield nothing.
+    bool value(string *out, int depth = 0);
+
+private:
+    bool hex4(unsigned int& val);
+    const char *m_cp;
+    const char *m_end;
+};
+
+bool Scanner::hex4(unsigned int& val)
+{
+    if (m_end - m_cp < 4) {
+        return false;
+    }
+    val = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *m_cp++;
+        val <<= 4;
+        if (c >= '0' && c <= '9') {
+            val += c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            val += c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            val += c - 'A' + 10;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void utf8append(string& out, unsigned int cp)
+{
+    if (cp < 0x80) {
+        out += char(cp);
+    } else if (cp < 0x800) {
+        out += char(0xc0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += char(0xe0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3f));
+        out += char(0x80 | (cp & 0x3f));
+    } else {
+        out += char(0xf0 | (cp >> 18));
+        out += char(0x80 | ((cp >> 12) & 0x3f));
+        out += char(0x80 | ((cp >> 6) & 0x3f));
+        out += char(0x80 | (cp & 0x3f));
+    }
+}
+
+bool Scanner::str(string *out)
+{
+    if (!expect('"')) {
+        return false;
+    }
+    for (;;) {
+        // Copy the unescaped runs in one go
+        const char *start = m_cp;
+        while (m_cp < m_end && *m_cp != '"' && *m_cp != '\\') {
+            m_cp++;
+        }
+        if (out) {
+            out->append(start, m_cp - start);
+        }
+        if (m_cp >= m_end) {
+            return false;
+        }
+        if (*m_cp++ == '"') {
+            return true;
+        }
+        if (m_cp >= m_end) {
+            return false;
+        }
+        char c = *m_cp++;
+        char decoded;
+        switch (c) {
+        case '"': case '\\': case '/': decoded = c; break;
+        case 'b': decoded = '\b'; break;
+        case 'f': decoded = '\f'; break;
+        case 'n': decoded = '\n'; break;
+        case 'r': decoded = '\r'; break;
+        case 't': decoded = '\t'; break;
+        case 'u':
+        {
+            unsigned int cp;
+            if (!hex4(cp)) {
+                return false;
+            }
+            // Python's json.dumps() escapes all non-ASCII characters,
+            // using surrogate pairs outside of the BMP.
+            if (cp >= 0xd800 && cp < 0xdc00 && m_end - m_cp >= 6 &&
+                m_cp[0] == '\\' && m_cp[1] == 'u') {
+                m_cp += 2;
+                unsigned int low;
+                if (!hex4(low)) {
+                    return false;
+                }
+                if (low >= 0xdc00 && low < 0xe000) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                }
+            }
+            if (out) {
+                utf8append(*out, cp);
+            }
+            continue;
+        }
+        default:
+            return false;
+        }
+        if (out) {
+            *out += decoded;
+        }
+    }
+}
+
+bool Scanner::value(string *out, int depth)
+{
+    skipws();
+    if (m_cp >= m_end) {
+        return false;
+    }
+    switch (*m_cp) {
+    case '"':
+        return str(out);
+    case '{':
+    case '[':
+    {
+        if (depth > 100) {
+            return false;
+        }
+        bool isobj = *m_cp == '{';
+        char close = isobj ? '}' : ']';
+        m_cp++;
+        if (expect(close)) {
+            return true;
+        }
+        for (;;) {
+            if (isobj && !(str(nullptr) && expect(':'))) {
+                return false;
+            }
+            if (!value(nullptr, depth + 1)) {
+                return false;
+            }
+            if (!expect(',')) {
+                return expect(close);
+            }
+        }
+    }
+    default:
+    {
+        // Number, true, false, null
+        const char *start = m_cp;
+        while (m_cp < m_end && (isalnum((unsigned char)*m_cp) ||
+                                *m_cp == '-' || *m_cp == '+' ||
+                                *m_cp == '.')) {
+            m_cp++;
+        }
+        if (m_cp == start) {
+            return false;
+        }
+        if (out && !(m_cp - start == 4 && !memcmp(start, "null", 4))) {
+            out->append(start, m_cp - start);
+        }
+        return true;
+    }
+    }
+}
+
+// The entry fields which we use. The values are collected first, as
+// the meaning of some depends on the entry type, which may come last.
+enum Field {FId, FPid, FTitle, FArtUri, FArtist, FClass, FType,
+            FSearchable, FUri, FCreator, FGenre, FAlbum, FTrackNum,
+            FMime, FDuration, FSize, FBitrate, FSampleFreq, FChannels,
+            FNFIELDS};
+const struct {
+    const char *key;
+    size_t len;
+} o_fields[FNFIELDS] = {
+#define F(K) {K, sizeof(K) - 1}
+    F("id"), F("pid"), F("tt"), F("upnp:albumArtURI"), F("upnp:artist"),
+    F("upnp:class"), F("tp"), F("searchable"), F("uri"), F("dc:creator"),
+    F("upnp:genre"), F("upnp:album"), F("upnp:originalTrackNumber"),
+    F("res:mime"), F("duration"), F("res:size"), F("res:bitrate"),
+    F("res:samplefreq"), F("res:channels"),
+#undef F
+};
+
+int fieldIndex(const string& key)
+{
+    for (int i = 0; i < FNFIELDS; i++) {
+        if (key.size() == o_fields[i].len &&
+            !memcmp(key.c_str(), o_fields[i].key, o_fields[i].len)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Decode one entry object. Returns false for a syntax error. ok is
+// set if the entry was valid and stored in song.
+bool decodeEntry(Scanner& sc, string *values, string& key, UpSong& song,
+                 bool& ok)
+{
+    ok = false;
+    for (int i = 0; i < FNFIELDS; i++) {
+        values[i].clear();
+    }
+    if (!sc.expect('{')) {
+        return sc.value(nullptr);
+    }
+    if (!sc.expect('}')) {
+        for (;;) {
+            key.clear();
+            if (!sc.str(&key) || !sc.expect(':')) {
+                return false;
+            }
+            int idx = fieldIndex(key);
+            string *out = nullptr;
+            if (idx >= 0) {
+                // Same as the DOM: the last occurrence wins
+                out = &values[idx];
+                out->clear();
+            }
+            if (!sc.value(out)) {
+                return false;
+            }
+            if (!sc.expect(',')) {
+                if (!sc.expect('}')) {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+
+    song = UpSong();
+    song.id = std::move(values[FId]);
+    song.parentid = std::move(values[FPid]);
+    song.title = std::move(values[FTitle]);
+    song.artUri = std::move(values[FArtUri]);
+    song.artist = std::move(values[FArtist]);
+    song.upnpClass = std::move(values[FClass]);
+    // tp is container ("ct") or item ("it")
+    const string& stp = values[FType];
+    if (!stp.compare("ct")) {
+        song.iscontainer = true;
+        if (!values[FSearchable].empty()) {
+            song.searchable = stringToBool(values[FSearchable]);
+        }
+    } else if (!stp.compare("it")) {
+        song.iscontainer = false;
+        song.uri = std::move(values[FUri]);
+        const string& creator = values[FCreator];
+        if (!creator.empty()) {
+            if (song.artist.empty()) {
+                song.artist = creator;
+            } else {
+                song.artist += string(" ") + creator;
+            }
+        }
+        song.genre = std::move(values[FGenre]);
+        song.album = std::move(values[FAlbum]);
+        song.tracknum = std::move(values[FTrackNum]);
+        song.mime = std::move(values[FMime]);
+        if (!values[FDuration].empty()) {
+            song.duration_secs = atoi(values[FDuration].c_str());
+        }
+        if (!values[FSize].empty()) {
+            song.size = atoll(values[FSize].c_str());
+        }
+        if (!values[FBitrate].empty()) {
+            song.bitrate = atoi(values[FBitrate].c_str());
+        }
+        if (!values[FSampleFreq].empty()) {
+            song.samplefreq = atoi(values[FSampleFreq].c_str());
+        }
+        if (!values[FChannels].empty()) {
+            song.channels = atoi(values[FChannels].c_str());
+        }
+    } else {
+        LOGERR("jsonToEntries: bad type in entry: " << stp <<
+               "(title: " << song.title << ")\n");
+        return true;
+    }
+    ok = true;
+    return true;
+}
+
+} // namespace
+
+int jsonToEntries(const string& encoded, int stidx, int cnt,
+                  vector<UpSong>& entries)
+{
+    Scanner sc(encoded);
+    if (sc.atend()) {
+        return 0;
+    }
+    if (!sc.expect('[')) {
+        LOGERR("jsonToEntries: not an array\n");
+        return -1;
+    }
+    if (sc.expect(']')) {
+        return 0;
+    }
+    string values[FNFIELDS];
+    string key;
+    int total = 0;
+    for (;;) {
+        bool wanted = total >= stidx && (cnt <= 0 || total < stidx + cnt);
+        if (wanted) {
+            UpSong song;
+            bool ok;
+            if (!decodeEntry(sc, values, key, song, ok)) {
+                break;
+            }
+            if (ok) {
+                LOGDEB1("jsonToEntries: pushing: " << song.dump() << endl);
+                entries.push_back(std::move(song));
+            }
+        } else if (!sc.value(nullptr)) {
+            break;
+        }
+        total++;
+        if (sc.expect(',')) {
+            continue;
+        }
+        if (sc.expect(']')) {
+            return total;
+        }
+        break;
+    }
+    LOGERR("jsonToEntries: syntax error after entry " << total << endl);
+    return -1;
+}
+
+#ifdef JSONENTRIES_TEST
+// Compare with the jsoncpp document decoding which was used before,
+// and time both on a synthetic plugin payload. Build in src with:
+//   c++ -O2 -std=c++11 -DJSONENTRIES_TEST -I. -I.. -I/usr/include/libupnpp
+//       -I/usr/include/jsoncpp -o jsonentries
+//       mediaserver/cdplugins/jsonentries.cxx upmpdutils.cxx smallut.cpp
+//       -ljsoncpp -lupnpp
+#include <stdio.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <sstream>
+
+#include <json/json.h>
+
+static void catstring(string& dest, const string& s2)
+{
+    if (s2.empty()) {
+        return;
+    }
+    if (dest.empty()) {
+        dest = s2;
+    } else {
+        dest += string(" ") + s2;
+    }
+}
+
+static int domToEntries(const string& encoded, int stidx, int cnt,
+                        vector<UpSong>& entries)
+{
+    Json::Value decoded;
+    istringstream input(encoded);
+    input >> decoded;
+    bool dolimit = cnt > 0;
+    for (unsigned int i = stidx; i < decoded.size(); i++) {
+#define JSONTOUPS(fld, nm) {catstring(song.fld, \
+                                      decoded[i].get(#nm, "").asString());}
+        if (dolimit && --cnt < 0) {
+            break;
+        }
+        UpSong song;
+        JSONTOUPS(id, id);
+        JSONTOUPS(parentid, pid);
+        JSONTOUPS(title, tt);
+        JSONTOUPS(artUri, upnp:albumArtURI);
+        JSONTOUPS(artist, upnp:artist);
+        JSONTOUPS(upnpClass, upnp:class);
+        string stp = decoded[i].get("tp", "").asString();
+        if (!stp.compare("ct")) {
+            song.iscontainer = true;
+            string ss = decoded[i].get("searchable", "").asString();
+            if (!ss.empty()) {
+                song.searchable = stringToBool(ss);
+            }
+        } else  if (!stp.compare("it")) {
+            song.iscontainer = false;
+            JSONTOUPS(uri, uri);
+            JSONTOUPS(artist, dc:creator);
+            JSONTOUPS(genre, upnp:genre);
+            JSONTOUPS(album, upnp:album);
+            JSONTOUPS(tracknum, upnp:originalTrackNumber);
+            JSONTOUPS(mime, res:mime);
+            string ss = decoded[i].get("duration", "").asString();
+            if (!ss.empty()) {
+                song.duration_secs = atoi(ss.c_str());
+            }
+            ss = decoded[i].get("res:size", "").asString();
+            if (!ss.empty()) {
+                song.size = atoll(ss.c_str());
+            }
+            ss = decoded[i].get("res:bitrate", "").asString();
+            if (!ss.empty()) {
+                song.bitrate = atoi(ss.c_str());
+            }
+            ss = decoded[i].get("res:samplefreq", "").asString();
+            if (!ss.empty()) {
+                song.samplefreq = atoi(ss.c_str());
+            }
+            ss = decoded[i].get("res:channels", "").asString();
+            if (!ss.empty()) {
+                song.channels = atoi(ss.c_str());
+            }
+        } else {
+            continue;
+        }
+        entries.push_back(song);
+    }
+    return decoded.size();
+}
+
+// Something like what the Python plugins produce with json.dumps()
+static string makePayload(int count)
+{
+    string out("[");
+    for (int i = 0; i < count; i++) {
+        string n = std::to_string(i);
+        if (i) {
+            out += ", ";
+        }
+        if (i % 10 == 0) {
+            out += "{\"id\": \"0$qobuz$albums$" + n + "\", \"pid\": "
+                "\"0$qobuz$albums\", \"tt\": \"Caf\\u00e9 \\ud83c\\udfb5 " + n +
+                "\", \"tp\": \"ct\", \"searchable\": \"1\", "
+                "\"upnp:class\": \"object.container.album.musicAlbum\", "
+                "\"upnp:albumArtURI\": \"http://x.invalid/" + n + ".jpg\"}";
+        } else {
+            out += "{\"pid\": \"0$qobuz$albums$" + std::to_string(i / 10) +
+                "\", \"tp\": \"it\", \"id\": \"0$qobuz$track$" + n +
+                "\", \"tt\": \"Track \\\"" + n + "\\\"\", "
+                "\"uri\": \"http://192.168.1.2:49149/qobuzprx/track/"
+                "version/1/trackId/" + n + ".flac\", "
+                "\"upnp:artist\": \"Artist " + n + "\", "
+                "\"dc:creator\": \"Composer\", "
+                "\"upnp:album\": \"Album " + std::to_string(i / 10) + "\", "
+                "\"upnp:genre\": \"Jazz\", \"upnp:originalTrackNumber\": \"" +
+                std::to_string(i % 10) + "\", \"duration\": " +
+                std::to_string(100 + i % 300) + ", "
+                "\"res:mime\": \"audio/flac\", \"res:size\": \"" +
+                std::to_string(30000000LL + i) + "\", "
+                "\"res:bitrate\": \"" + std::to_string(900 + i % 100) + "\", "
+                "\"res:samplefreq\": \"" + (i % 2 ? "96000" : "44100") +
+                "\", \"res:channels\": \"" + (i % 3 ? "2" : "1") + "\", "
+                "\"extra\": {\"a\": [1, 2.5, null, true]}, "
+                "\"upnp:class\": \"object.item.audioItem.musicTrack\"}";
+        }
+    }
+    out += "]";
+    return out;
+}
+
+static bool same(vector<UpSong>& v1, vector<UpSong>& v2)
+{
+    if (v1.size() != v2.size()) {
+        return false;
+    }
+    for (unsigned int i = 0; i < v1.size(); i++) {
+        UpSong& s1 = v1[i];
+        UpSong& s2 = v2[i];
+        if (s1.id != s2.id || s1.parentid != s2.parentid ||
+            s1.uri != s2.uri || s1.name != s2.name ||
+            s1.artist != s2.artist || s1.album != s2.album ||
+            s1.title != s2.title || s1.tracknum != s2.tracknum ||
+            s1.genre != s2.genre || s1.artUri != s2.artUri ||
+            s1.upnpClass != s2.upnpClass || s1.mime != s2.mime ||
+            s1.duration_secs != s2.duration_secs || s1.size != s2.size ||
+            s1.bitrate != s2.bitrate || s1.samplefreq != s2.samplefreq ||
+            s1.channels != s2.channels || s1.mpdid != s2.mpdid ||
+            s1.iscontainer != s2.iscontainer ||
+            s1.searchable != s2.searchable) {
+            fprintf(stderr, "Entry %u differs:\n%s\n%s\n", i,
+                    s1.dump().c_str(), s2.dump().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static double bench(int (*func)(const string&, int, int, vector<UpSong>&),
+                    const string& payload, int stidx, int cnt, int loops)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < loops; i++) {
+        vector<UpSong> entries;
+        func(payload, stidx, cnt, entries);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count() / 1000.0 / loops;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 5000;
+    int c;
+    while ((c = getopt(argc, argv, "n:")) != -1) {
+        if (c == 'n') {
+            count = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: jsonentries [-n count]\n");
+            return 1;
+        }
+    }
+    string payload = makePayload(count);
+    printf("Payload: %d entries, %d bytes\n", count, int(payload.size()));
+
+    const int windows[][2] = {{0, 0}, {0, 50}, {count / 2, 100},
+                              {count - 10, 50}, {count + 5, 10}};
+    for (const auto& win : windows) {
+        vector<UpSong> e1, e2;
+        int t1 = domToEntries(payload, win[0], win[1], e1);
+        int t2 = jsonToEntries(payload, win[0], win[1], e2);
+        if (t1 != t2 || !same(e1, e2)) {
+            fprintf(stderr, "Mismatch for window %d %d: totals %d %d\n",
+                    win[0], win[1], t1, t2);
+            return 1;
+        }
+    }
+    vector<UpSong> e;
+    if (jsonToEntries("[{\"tp\": \"it\"}, {\"tp\": ", 0, 0, e) != -1 ||
+        e.size() != 1 || jsonToEntries(" ", 0, 0, e) != 0) {
+        fprintf(stderr, "Bad error handling\n");
+        return 1;
+    }
+    printf("Results identical\n");
+
+    printf("All entries:   DOM %8.2f ms  on-demand %8.2f ms\n",
+           bench(domToEntries, payload, 0, 0, 20),
+           bench(jsonToEntries, payload, 0, 0, 20));
+    printf("First 50:      DOM %8.2f ms  on-demand %8.2f ms\n",
+           bench(domToEntries, payload, 0, 50, 20),
+           bench(jsonToEntries, payload, 0, 50, 20));
+    return 0;
+}
+#endif // JSONENTRIES_TEST
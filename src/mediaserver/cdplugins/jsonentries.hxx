@@ -0,0 +1,41 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _JSONENTRIES_H_INCLUDED_
+#define _JSONENTRIES_H_INCLUDED_
+
+#include <string>
+#include <vector>
+
+#include "upmpdutils.hxx"
+
+/// Decode the JSON array of directory entries returned by the plugin
+/// browse and search methods, appending them to the entries vector.
+///
+/// The text is scanned once, without building a document tree: the
+/// fields we use are decoded directly, the others are skipped, and
+/// the entries outside of the [stidx, stidx+cnt) window (cnt == 0:
+/// to the end) are skipped without decoding. PlgWithSlave caches
+/// the complete browse and search results, so it only uses a window
+/// for the (uncached) metadata requests.
+///
+/// @return the total number of entries in the array, or -1 if the
+///   text could not be parsed (the entries decoded before the error
+///   are kept).
+extern int jsonToEntries(const std::string& encoded, int stidx, int cnt,
+                         std::vector<UpSong>& entries);
+
+#endif /* _JSONENTRIES_H_INCLUDED_ */
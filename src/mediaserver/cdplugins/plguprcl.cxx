@@ -0,0 +1,1115 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#include "config.h"
+
+#include "plguprcl.hxx"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <microhttpd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+
+#include "conftree.h"
+#include "main.hxx"
+#include "pathut.h"
+#include "smallut.h"
+#include "tagindex.hxx"
+#include "upsongsort.hxx"
+
+using namespace std;
+
+// Object ids. We use the same "0$uprcl$" namespace as the Python
+// module, but the rest of the ids is our own:
+//  0$uprcl$folders[$d<folder>]
+//  0$uprcl$albums[$*<album>]
+//  0$uprcl$items
+//  0$uprcl$=<tagname>[$<valueidx>[$*<album>|$items]]
+// Tracks are listed as <container id>$i<track>.
+static const string o_idprefix("0$uprcl$");
+static const string o_foldersid(o_idprefix + "folders");
+static const string o_albumsid(o_idprefix + "albums");
+static const string o_itemsid(o_idprefix + "items");
+
+enum SearchKind {SKTracks, SKAlbums, SKArtists};
+
+// Check if the last id element is a track (i<index>), and not, e.g.,
+// an "items" container.
+static bool isTrackElt(const string& elt)
+{
+    return elt.size() > 1 && elt[0] == 'i' &&
+        elt.find_first_not_of("0123456789", 1) == string::npos;
+}
+
+class PlgUprcl::Internal {
+public:
+    Internal(PlgUprcl *_plg, const string& pp)
+        : plg(_plg), pathprefix(pp) {
+    }
+    ~Internal() {
+        if (mhd) {
+            MHD_stop_daemon(mhd);
+        }
+        delete index;
+    }
+
+    bool maybeInit();
+    bool startHttp();
+    string trackuri(const string& path);
+    string urltopath(const string& url);
+    string folderpath(int f);
+    string arturi(int folder);
+    UpSong trackEntry(const string& pid, int t);
+    UpSong albumEntry(const string& pid, int a);
+    int folderDisplayRoot();
+    string folderId(int f);
+    int browseFolder(const string& objid, int f, int stidx, int cnt,
+                     vector<UpSong>& entries);
+    int browseTag(const string& objid, TagIndex::TagTable tt,
+                  const vector<string>& elts, int stidx, int cnt,
+                  vector<UpSong>& entries);
+    int browseChildren(const string& objid, int stidx, int cnt,
+                       vector<UpSong>& entries);
+    bool trackMatches(const TagIndex::Track& t, const vector<string>& vs);
+    UpSong searchEntry(int i);
+
+    PlgUprcl *plg;
+    // Path prefix for our URLs (used by upmpdcli to route requests)
+    string pathprefix;
+    // Host:port for the media HTTP server
+    string httphp;
+    // URL path -> local file system path translations (uprclpaths)
+    vector<pair<string, string> > pathmap;
+    TagIndex *index{nullptr};
+    // Media file HTTP server
+    struct MHD_Daemon *mhd{nullptr};
+    bool initdone{false};
+    bool initok{false};
+
+    // Last search results: CPs generally page through the same
+    // search multiple times.
+    string lastsearch;
+    SearchKind lastkind{SKTracks};
+    vector<int> lastresults;
+
+    // Last sorted browse or search result. We have to build the whole
+    // list for sorting, and keep it for the next pages.
+    string sortedkey;
+    vector<UpSong> sortedresults;
+
+    mutex mtx;
+};
+
+PlgUprcl::PlgUprcl(const string& name, CDPluginServices *services)
+    : CDPlugin(name, services)
+{
+    m = new Internal(this, services->getpathprefix(this));
+}
+
+PlgUprcl::~PlgUprcl()
+{
+    delete m;
+}
+
+// Called on first access. Reads the configuration, updates the index
+// and starts the HTTP server.
+bool PlgUprcl::Internal::maybeInit()
+{
+    if (initdone) {
+        return initok;
+    }
+    initdone = true;
+
+    ConfSimple *conf = plg->m_services->getconfig(plg);
+    if (!conf->get("uprclhostport", httphp)) {
+        LOGERR("PlgUprcl: uprclhostport not in configuration\n");
+        return false;
+    }
+    string pthstr;
+    if (!conf->get("uprclpaths", pthstr)) {
+        LOGERR("PlgUprcl: uprclpaths not in configuration\n");
+        return false;
+    }
+    vector<string> vpaths;
+    stringToTokens(pthstr, vpaths, ",");
+    for (const auto& ent : vpaths) {
+        vector<string> lr;
+        stringToTokens(ent, lr, ":");
+        if (lr.size() != 2) {
+            LOGERR("PlgUprcl: bad element in uprclpaths: " << ent << endl);
+            continue;
+        }
+        pathmap.push_back(pair<string, string>(lr[0], lr[1]));
+    }
+
+    vector<string> topdirs;
+    string sdirs;
+    if (conf->get("uprclmediadirs", sdirs)) {
+        stringToStrings(sdirs, topdirs);
+    } else {
+        for (const auto& ent : pathmap) {
+            topdirs.push_back(ent.second);
+        }
+    }
+    if (topdirs.empty()) {
+        LOGERR("PlgUprcl: no media directories configured\n");
+        return false;
+    }
+
+    index = new TagIndex(path_cat(g_cachedir, "uprcl/tagindex"), topdirs);
+    if (!index->update()) {
+        // Not fatal: the tables are built anyway, we just could not
+        // save them.
+        LOGERR("PlgUprcl: index update failed\n");
+    }
+    if (!startHttp()) {
+        return false;
+    }
+    initok = true;
+    return true;
+}
+
+// Media file server. We run our own microhttpd daemon on the
+// uprclhostport port. Range requests are answered from the file
+// descriptor (microhttpd uses sendfile() for these), and the number
+// of connections and threads is bounded.
+static const int o_httpthreads = 4;
+static const int o_httpmaxconns = 32;
+static const int o_httptimeoutsecs = 60;
+
+static string httpdate(time_t t)
+{
+    struct tm tm;
+    char buf[100];
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+static time_t parsehttpdate(const char *s)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm) == nullptr) {
+        return (time_t)-1;
+    }
+    return timegm(&tm);
+}
+
+// Parse a "bytes=first-last" Range header value. We only use the
+// first range if there are several.
+// @return 1 for a valid range, 0 if the header should be ignored
+//   (full content, also for a syntactically invalid range), -1 if
+//   the range is valid but can't be satisfied.
+static int parseRange(const string& hdr, int64_t size, int64_t& start,
+                      int64_t& end)
+{
+    if (!beginswith(hdr, "bytes=")) {
+        return 0;
+    }
+    string spec = hdr.substr(6, hdr.find(',') - 6);
+    string::size_type dash = spec.find('-');
+    if (dash == string::npos) {
+        return 0;
+    }
+    string s1 = spec.substr(0, dash);
+    string s2 = spec.substr(dash + 1);
+    trimstring(s1);
+    trimstring(s2);
+    if (s1.empty()) {
+        // Suffix range: last N bytes
+        int64_t n = atoll(s2.c_str());
+        if (n <= 0) {
+            return 0;
+        }
+        start = n >= size ? 0 : size - n;
+        end = size - 1;
+    } else {
+        start = atoll(s1.c_str());
+        end = size - 1;
+        if (!s2.empty()) {
+            int64_t last = atoll(s2.c_str());
+            if (last < start) {
+                return 0;
+            }
+            end = min(last, end);
+        }
+    }
+    if (start >= size) {
+        return -1;
+    }
+    return 1;
+}
+
+static int queueStatus(struct MHD_Connection *connection, unsigned int status,
+                       struct MHD_Response *response = nullptr)
+{
+    static char data[] = "";
+    bool mine = response == nullptr;
+    if (mine) {
+        response = MHD_create_response_from_buffer(0, data,
+                                                   MHD_RESPMEM_PERSISTENT);
+        if (response == nullptr) {
+            return MHD_NO;
+        }
+    }
+    int ret = MHD_queue_response(connection, status, response);
+    if (mine) {
+        MHD_destroy_response(response);
+    }
+    return ret;
+}
+
+static int answer_to_connection(void *cls, struct MHD_Connection *connection,
+                                const char *url, const char *method,
+                                const char *version, const char *upload_data,
+                                size_t *upload_data_size, void **con_cls)
+{
+    static int aptr;
+    if (&aptr != *con_cls) {
+        /* do not respond on first call */
+        *con_cls = &aptr;
+        return MHD_YES;
+    }
+    LOGDEB("PlgUprcl::answer_to_connection: " << method << " " << url << endl);
+    if (strcmp(method, MHD_HTTP_METHOD_GET) &&
+        strcmp(method, MHD_HTTP_METHOD_HEAD)) {
+        return queueStatus(connection, MHD_HTTP_METHOD_NOT_ALLOWED);
+    }
+
+    PlgUprcl::Internal *plgi = (PlgUprcl::Internal *)cls;
+    string path = plgi->urltopath(url);
+    if (path.empty()) {
+        LOGERR("PlgUprcl: no translation for " << url << endl);
+        return queueStatus(connection, MHD_HTTP_NOT_FOUND);
+    }
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOGERR("PlgUprcl: can't open " << path << " errno " << errno << endl);
+        return queueStatus(connection, MHD_HTTP_NOT_FOUND);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return queueStatus(connection, MHD_HTTP_NOT_FOUND);
+    }
+    int64_t size = st.st_size;
+    string lastmod = httpdate(st.st_mtime);
+
+    const char *ims = MHD_lookup_connection_value(
+        connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_IF_MODIFIED_SINCE);
+    if (ims) {
+        time_t t = parsehttpdate(ims);
+        if (t != (time_t)-1 && st.st_mtime <= t) {
+            close(fd);
+            static char data[] = "";
+            struct MHD_Response *response = MHD_create_response_from_buffer(
+                0, data, MHD_RESPMEM_PERSISTENT);
+            if (response == nullptr) {
+                return MHD_NO;
+            }
+            MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED,
+                                    lastmod.c_str());
+            int ret = queueStatus(connection, MHD_HTTP_NOT_MODIFIED, response);
+            MHD_destroy_response(response);
+            return ret;
+        }
+    }
+
+    int64_t start = 0, end = size - 1;
+    int rangestatus = 0;
+    const char *range = MHD_lookup_connection_value(
+        connection, MHD_HEADER_KIND, MHD_HTTP_HEADER_RANGE);
+    if (range) {
+        rangestatus = parseRange(range, size, start, end);
+    }
+    if (rangestatus < 0) {
+        close(fd);
+        static char data[] = "";
+        struct MHD_Response *response =
+            MHD_create_response_from_buffer(0, data, MHD_RESPMEM_PERSISTENT);
+        if (response == nullptr) {
+            return MHD_NO;
+        }
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_RANGE,
+                                (string("bytes */") + lltodecstr(size)).c_str());
+        int ret = queueStatus(connection,
+                              MHD_HTTP_REQUESTED_RANGE_NOT_SATISFIABLE,
+                              response);
+        MHD_destroy_response(response);
+        return ret;
+    }
+
+    // The response takes ownership of the fd
+    struct MHD_Response *response = MHD_create_response_from_fd_at_offset64(
+        end - start + 1, fd, start);
+    if (response == nullptr) {
+        LOGERR("PlgUprcl: could not create response for " << path << endl);
+        close(fd);
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, MHD_HTTP_HEADER_ACCEPT_RANGES, "bytes");
+    MHD_add_response_header(response, MHD_HTTP_HEADER_LAST_MODIFIED,
+                            lastmod.c_str());
+    string mime = audioMimeForPath(path);
+    if (mime.empty()) {
+        // Cover art
+        string suff = stringtolower(path_suffix(path));
+        if (suff == "jpg" || suff == "jpeg") {
+            mime = "image/jpeg";
+        } else if (suff == "png") {
+            mime = "image/png";
+        }
+    }
+    if (!mime.empty()) {
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE,
+                                mime.c_str());
+    }
+    if (rangestatus > 0) {
+        MHD_add_response_header(
+            response, MHD_HTTP_HEADER_CONTENT_RANGE,
+            (string("bytes ") + lltodecstr(start) + "-" + lltodecstr(end) +
+             "/" + lltodecstr(size)).c_str());
+    }
+    int ret = queueStatus(connection, rangestatus > 0 ?
+                          MHD_HTTP_PARTIAL_CONTENT : MHD_HTTP_OK, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+static int accept_policy(void *, const struct sockaddr* sa, socklen_t addrlen)
+{
+    return MHD_YES;
+}
+
+bool PlgUprcl::Internal::startHttp()
+{
+    string::size_type colon = httphp.find(':');
+    if (colon == string::npos) {
+        LOGERR("PlgUprcl: bad uprclhostport: " << httphp << endl);
+        return false;
+    }
+    int port = atoi(httphp.c_str() + colon + 1);
+    LOGDEB("PlgUprcl: starting httpd on port " << port << endl);
+    mhd = MHD_start_daemon(
+        MHD_USE_SELECT_INTERNALLY, port,
+        /* Accept policy callback and arg */
+        accept_policy, NULL,
+        /* handler and arg */
+        &answer_to_connection, this,
+        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)o_httpthreads,
+        MHD_OPTION_CONNECTION_LIMIT, (unsigned int)o_httpmaxconns,
+        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int)o_httptimeoutsecs,
+        MHD_OPTION_END);
+    if (nullptr == mhd) {
+        LOGERR("PlgUprcl: MHD_start_daemon failed\n");
+        return false;
+    }
+    return true;
+}
+
+string PlgUprcl::Internal::trackuri(const string& path)
+{
+    string upath(path);
+    for (const auto& ent : pathmap) {
+        if (beginswith(path, ent.second)) {
+            upath = ent.first + path.substr(ent.second.size());
+            break;
+        }
+    }
+    return string("http://") + httphp + url_encode(pathprefix + upath, 0);
+}
+
+// Translate the URL path (already decoded by microhttpd) to a local
+// file path. Only paths inside the uprclpaths translations are served.
+string PlgUprcl::Internal::urltopath(const string& url)
+{
+    if (!beginswith(url, pathprefix)) {
+        return string();
+    }
+    string upath = url.substr(pathprefix.size());
+    for (const auto& ent : pathmap) {
+        if (!beginswith(upath, ent.first) ||
+            (upath.size() != ent.first.size() && ent.first.back() != '/' &&
+             upath[ent.first.size()] != '/')) {
+            continue;
+        }
+        // Resolve any "..", or symbolic link, and check that the result
+        // is still inside the translated directory.
+        string path = ent.second + upath.substr(ent.first.size());
+        char *rpath = realpath(path.c_str(), nullptr);
+        char *rtop = realpath(ent.second.c_str(), nullptr);
+        string result;
+        if (rpath && rtop) {
+            string spath(rpath), stop(rtop);
+            if (beginswith(spath, stop) &&
+                (spath.size() == stop.size() || stop.back() == '/' ||
+                 spath[stop.size()] == '/')) {
+                result = spath;
+            }
+        }
+        free(rpath);
+        free(rtop);
+        return result;
+    }
+    return string();
+}
+
+string PlgUprcl::Internal::folderpath(int f)
+{
+    const TagIndex::Folder& fld = index->folders[f];
+    if (fld.parent == 0) {
+        return fld.name;
+    }
+    return path_cat(folderpath(fld.parent), fld.name);
+}
+
+string PlgUprcl::Internal::arturi(int f)
+{
+    if (f <= 0 || index->folders[f].artname.empty()) {
+        return string();
+    }
+    return trackuri(path_cat(folderpath(f), index->folders[f].artname));
+}
+
+UpSong PlgUprcl::Internal::trackEntry(const string& pid, int t)
+{
+    const TagIndex::Track& trk = index->tracks[t];
+    const AudioTags& tags = trk.tags;
+    UpSong song = UpSong::item(pid + "$i" + lltodecstr(t), pid,
+                               tags.title.empty() ?
+                               path_getsimple(trk.path) : tags.title);
+    song.uri = trackuri(trk.path);
+    song.artist = tags.artist.empty() ? tags.albumartist : tags.artist;
+    song.album = tags.album;
+    song.tracknum = tags.tracknum;
+    song.genre = tags.genre;
+    song.mime = trk.mime;
+    song.artUri = arturi(trk.folder);
+    song.size = trk.size;
+    song.duration_secs = tags.duration_secs;
+    // The UPnP res bitrate is in bytes per second
+    if (tags.bitrate) {
+        song.bitrate = tags.bitrate / 8;
+    }
+    if (tags.samplefreq) {
+        song.samplefreq = tags.samplefreq;
+    }
+    if (tags.channels) {
+        song.channels = tags.channels;
+    }
+    return song;
+}
+
+UpSong PlgUprcl::Internal::albumEntry(const string& pid, int a)
+{
+    const TagIndex::Album& alb = index->albums[a];
+    UpSong song = UpSong::container(pid + "$*" + lltodecstr(a), pid,
+                                    alb.title);
+    song.upnpClass = "object.container.album.musicAlbum";
+    song.artist = alb.artist;
+    song.artUri = arturi(alb.folder);
+    return song;
+}
+
+// If there is a single top directory, we skip the virtual root level
+int PlgUprcl::Internal::folderDisplayRoot()
+{
+    return index->folders[0].subdirs.size() == 1 ? 1 : 0;
+}
+
+string PlgUprcl::Internal::folderId(int f)
+{
+    if (f == folderDisplayRoot()) {
+        return o_foldersid;
+    }
+    return o_foldersid + "$d" + lltodecstr(f);
+}
+
+// Call make(i) for the requested slice of [0, total), and return total
+template <class F> static int slice(int total, int stidx, int cnt,
+                                    vector<UpSong>& entries, F make)
+{
+    if (cnt <= 0) {
+        cnt = total;
+    }
+    for (int i = max(stidx, 0); i < total && i < stidx + cnt; i++) {
+        entries.push_back(make(i));
+    }
+    return total;
+}
+
+int PlgUprcl::Internal::browseFolder(const string& objid, int f, int stidx,
+                                     int cnt, vector<UpSong>& entries)
+{
+    const TagIndex::Folder& fld = index->folders[f];
+    int ndirs = fld.subdirs.size();
+    return slice(ndirs + fld.tracks.size(), stidx, cnt, entries,
+                 [&](int i) -> UpSong {
+                     if (i < ndirs) {
+                         int sub = fld.subdirs[i];
+                         UpSong song = UpSong::container(
+                             folderId(sub), objid, index->folders[sub].name);
+                         song.artUri = arturi(sub);
+                         return song;
+                     }
+                     return trackEntry(objid, fld.tracks[i - ndirs]);
+                 });
+}
+
+static const string& tagValue(const AudioTags& tags, TagIndex::TagTable tt)
+{
+    switch (tt) {
+    case TagIndex::TTArtist:
+        return tags.artist.empty() ? tags.albumartist : tags.artist;
+    case TagIndex::TTGenre: return tags.genre;
+    case TagIndex::TTComposer: return tags.composer;
+    default: break;
+    }
+    static const string empty;
+    return empty;
+}
+
+// elts is the rest of the id after the "=tagname" element.
+int PlgUprcl::Internal::browseTag(const string& objid, TagIndex::TagTable tt,
+                                  const vector<string>& elts, int stidx,
+                                  int cnt, vector<UpSong>& entries)
+{
+    const vector<TagIndex::TagValue>& table = index->tagtables[tt];
+    if (elts.empty()) {
+        // List of values
+        return slice(table.size(), stidx, cnt, entries, [&](int i) {
+                return UpSong::container(objid + "$" + lltodecstr(i), objid,
+                                         table[i].value);});
+    }
+    int v = atoi(elts[0].c_str());
+    if (v < 0 || v >= int(table.size())) {
+        LOGERR("PlgUprcl::browse: bad value index in " << objid << endl);
+        return 0;
+    }
+    const TagIndex::TagValue& tv = table[v];
+    if (elts.size() == 1) {
+        // Albums for the value, then all the tracks.
+        int nalbs = tv.albums.size();
+        return slice(nalbs + 1, stidx, cnt, entries, [&](int i) {
+                if (i < nalbs) {
+                    return albumEntry(objid, tv.albums[i]);
+                }
+                return UpSong::container(
+                    objid + "$items", objid,
+                    lltodecstr(tv.tracks.size()) + " items");});
+    }
+    if (elts[1] == "items") {
+        return slice(tv.tracks.size(), stidx, cnt, entries, [&](int i) {
+                return trackEntry(objid, tv.tracks[i]);});
+    }
+    if (elts[1][0] == '*') {
+        int a = atoi(elts[1].c_str() + 1);
+        if (a < 0 || a >= int(index->albums.size())) {
+            LOGERR("PlgUprcl::browse: bad album index in " << objid << endl);
+            return 0;
+        }
+        // Only the album tracks which have the value
+        vector<int> trks;
+        for (auto t : index->albums[a].tracks) {
+            if (tagValue(index->tracks[t].tags, tt) == tv.value) {
+                trks.push_back(t);
+            }
+        }
+        return slice(trks.size(), stidx, cnt, entries, [&](int i) {
+                return trackEntry(objid, trks[i]);});
+    }
+    LOGERR("PlgUprcl::browse: bad id " << objid << endl);
+    return 0;
+}
+
+int PlgUprcl::Internal::browseChildren(const string& objid, int stidx, int cnt,
+                                       vector<UpSong>& entries)
+{
+    if (objid == o_idprefix) {
+        vector<UpSong> root;
+        root.push_back(UpSong::container(o_foldersid, objid, "[folders]"));
+        root.push_back(UpSong::container(
+                           o_albumsid, objid,
+                           lltodecstr(index->albums.size()) + " albums"));
+        root.push_back(UpSong::container(
+                           o_itemsid, objid,
+                           lltodecstr(index->tracks.size()) + " items"));
+        for (int tt = 0; tt < TagIndex::TTCount; tt++) {
+            const string& nm =
+                TagIndex::tagTableName(TagIndex::TagTable(tt));
+            root.push_back(UpSong::container(o_idprefix + "=" + nm,
+                                             objid, nm));
+        }
+        return slice(root.size(), stidx, cnt, entries,
+                     [&root](int i) {return root[i];});
+    }
+    if (!beginswith(objid, o_idprefix)) {
+        LOGERR("PlgUprcl::browse: bad id " << objid << endl);
+        return 0;
+    }
+
+    vector<string> elts;
+    stringToTokens(objid.substr(o_idprefix.size()), elts, "$");
+    if (elts.empty() || isTrackElt(elts.back())) {
+        // Track or bad id
+        return 0;
+    }
+    if (elts[0] == "folders") {
+        int f = folderDisplayRoot();
+        if (elts.size() > 1) {
+            f = atoi(elts[1].c_str() + 1);
+        }
+        if (f < 0 || f >= int(index->folders.size())) {
+            LOGERR("PlgUprcl::browse: bad folder index in " << objid << endl);
+            return 0;
+        }
+        return browseFolder(objid, f, stidx, cnt, entries);
+    } else if (elts[0] == "albums") {
+        if (elts.size() == 1) {
+            return slice(index->albums.size(), stidx, cnt, entries,
+                         [&](int i) {return albumEntry(objid, i);});
+        }
+        int a = atoi(elts[1].c_str() + 1);
+        if (a < 0 || a >= int(index->albums.size())) {
+            LOGERR("PlgUprcl::browse: bad album index in " << objid << endl);
+            return 0;
+        }
+        const vector<int>& trks = index->albums[a].tracks;
+        return slice(trks.size(), stidx, cnt, entries,
+                     [&](int i) {return trackEntry(objid, trks[i]);});
+    } else if (elts[0] == "items") {
+        return slice(index->tracks.size(), stidx, cnt, entries,
+                     [&](int i) {return trackEntry(objid, i);});
+    } else if (elts[0][0] == '=') {
+        string nm = elts[0].substr(1);
+        for (int tt = 0; tt < TagIndex::TTCount; tt++) {
+            if (nm == TagIndex::tagTableName(TagIndex::TagTable(tt))) {
+                elts.erase(elts.begin());
+                return browseTag(objid, TagIndex::TagTable(tt), elts,
+                                 stidx, cnt, entries);
+            }
+        }
+    }
+    LOGERR("PlgUprcl::browse: bad id " << objid << endl);
+    return 0;
+}
+
+// Better return a bogus informative entry than an outright error:
+static int errorEntries(const string& pid, vector<UpSong>& entries)
+{
+    entries.push_back(
+        UpSong::item(pid + "$bogus", pid,
+                     "Local media index initialization failed"));
+    return 1;
+}
+
+int PlgUprcl::browse(const string& objid, int stidx, int cnt,
+                     vector<UpSong>& entries,
+                     const vector<string>& sortcrits,
+                     BrowseFlag flg)
+{
+    LOGDEB("PlgUprcl::browse: " << objid << " stidx " << stidx << " cnt " <<
+           cnt << endl);
+    entries.clear();
+    std::unique_lock<std::mutex> lock(m->mtx);
+    if (!m->maybeInit()) {
+        return errorEntries(objid, entries);
+    }
+    if (flg == BFChildren) {
+        UpSongSorter sorter(sortcrits);
+        if (sorter.empty()) {
+            return m->browseChildren(objid, stidx, cnt, entries);
+        }
+        string key = "b:" + objid + ":" + sorter.key();
+        if (key != m->sortedkey) {
+            m->sortedresults.clear();
+            m->browseChildren(objid, 0, 0, m->sortedresults);
+            sorter.sort(m->sortedresults);
+            m->sortedkey = key;
+        }
+        const vector<UpSong>& res = m->sortedresults;
+        return slice(res.size(), stidx, cnt, entries,
+                     [&res](int i) {return res[i];});
+    }
+
+    // Metadata: tracks are built directly, containers are looked up
+    // in the parent listing.
+    if (objid == o_idprefix) {
+        entries.push_back(UpSong::container(objid, "0", "Uprcl"));
+        return 1;
+    }
+    string::size_type dol = objid.find_last_of('$');
+    if (dol == string::npos) {
+        return 0;
+    }
+    string pid = objid.substr(0, dol);
+    if (pid + "$" == o_idprefix) {
+        pid = o_idprefix;
+    }
+    if (isTrackElt(objid.substr(dol + 1))) {
+        int t = atoi(objid.c_str() + dol + 2);
+        if (t < 0 || t >= int(m->index->tracks.size())) {
+            return 0;
+        }
+        entries.push_back(m->trackEntry(pid, t));
+        return 1;
+    }
+    vector<UpSong> siblings;
+    m->browseChildren(pid, 0, 0, siblings);
+    for (const auto& song : siblings) {
+        if (song.id == objid) {
+            entries.push_back(song);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Evaluate the [field op value (and|or)]... sequence for a track,
+// left to right. upnp:class clauses are handled by the caller and
+// count as true.
+bool PlgUprcl::Internal::trackMatches(const TagIndex::Track& t,
+                                      const vector<string>& vs)
+{
+    bool result = true;
+    for (unsigned int i = 0; i < vs.size() - 2; i += 4) {
+        const string& field = vs[i];
+        const string& op = vs[i+1];
+        const AudioTags& tags = t.tags;
+        vector<const string*> values;
+        if (field == "upnp:artist" || field == "dc:creator") {
+            values.push_back(&tags.artist);
+            values.push_back(&tags.albumartist);
+        } else if (field == "upnp:album") {
+            values.push_back(&tags.album);
+        } else if (field == "dc:title") {
+            values.push_back(&tags.title);
+        } else if (field == "upnp:genre") {
+            values.push_back(&tags.genre);
+        }
+        bool match = true;
+        if (!values.empty()) {
+            string value = stringtolower(vs[i+2]);
+            match = false;
+            for (const auto vp : values) {
+                string lv = stringtolower(*vp);
+                if (op == "contains") {
+                    match = lv.find(value) != string::npos;
+                } else if (op == "doesNotContain") {
+                    match = lv.find(value) == string::npos;
+                } else if (op == "=") {
+                    match = lv == value;
+                } else if (op == "!=") {
+                    match = lv != value;
+                } else if (op == "exists") {
+                    match = stringToBool(value) == !lv.empty();
+                }
+                if (match) {
+                    break;
+                }
+            }
+        }
+        if (i == 0) {
+            result = match;
+        } else if (!stringlowercmp("or", vs[i-1])) {
+            result = result || match;
+        } else {
+            result = result && match;
+        }
+    }
+    return result;
+}
+
+// Build the entry for the i'th element of the last search results
+UpSong PlgUprcl::Internal::searchEntry(int i)
+{
+    int idx = lastresults[i];
+    switch (lastkind) {
+    case SKAlbums:
+        return albumEntry(o_albumsid, idx);
+    case SKArtists:
+    {
+        const string pid(o_idprefix + "=" +
+                         TagIndex::tagTableName(TagIndex::TTArtist));
+        UpSong song = UpSong::container(
+            pid + "$" + lltodecstr(idx), pid,
+            index->tagtables[TagIndex::TTArtist][idx].value);
+        song.upnpClass = "object.container.person.musicArtist";
+        return song;
+    }
+    case SKTracks:
+    default:
+        return trackEntry(o_itemsid, idx);
+    }
+}
+
+int PlgUprcl::search(const string& ctid, int stidx, int cnt,
+                     const string& searchstr,
+                     vector<UpSong>& entries,
+                     const vector<string>& sortcrits)
+{
+    LOGDEB("PlgUprcl::search: [" << searchstr << "]\n");
+    entries.clear();
+    std::unique_lock<std::mutex> lock(m->mtx);
+    if (!m->maybeInit()) {
+        return errorEntries(ctid, entries);
+    }
+
+    if (searchstr != m->lastsearch) {
+        string ss;
+        neutchars(searchstr, ss, "()");
+        vector<string> vs;
+        stringToStrings(ss, vs);
+        if ((vs.size() + 1) % 4 != 0) {
+            LOGERR("PlgUprcl::search: bad search string: [" << searchstr <<
+                   "]\n");
+            return 0;
+        }
+        SearchKind kind = SKTracks;
+        for (unsigned int i = 0; i < vs.size() - 2; i += 4) {
+            if (vs[i] == "upnp:class") {
+                if (beginswith(vs[i+2], "object.container.person")) {
+                    kind = SKArtists;
+                } else if (beginswith(vs[i+2], "object.container")) {
+                    kind = SKAlbums;
+                }
+            }
+        }
+
+        const vector<TagIndex::Track>& tracks = m->index->tracks;
+        vector<char> matched(tracks.size());
+        for (unsigned int t = 0; t < tracks.size(); t++) {
+            matched[t] = m->trackMatches(tracks[t], vs);
+        }
+
+        m->lastresults.clear();
+        switch (kind) {
+        case SKTracks:
+            for (unsigned int t = 0; t < tracks.size(); t++) {
+                if (matched[t]) {
+                    m->lastresults.push_back(t);
+                }
+            }
+            break;
+        case SKAlbums:
+            for (unsigned int a = 0; a < m->index->albums.size(); a++) {
+                for (auto t : m->index->albums[a].tracks) {
+                    if (matched[t]) {
+                        m->lastresults.push_back(a);
+                        break;
+                    }
+                }
+            }
+            break;
+        case SKArtists:
+        {
+            const auto& table = m->index->tagtables[TagIndex::TTArtist];
+            for (unsigned int v = 0; v < table.size(); v++) {
+                for (auto t : table[v].tracks) {
+                    if (matched[t]) {
+                        m->lastresults.push_back(v);
+                        break;
+                    }
+                }
+            }
+        }
+        break;
+        }
+        m->lastsearch = searchstr;
+        m->lastkind = kind;
+    }
+
+    UpSongSorter sorter(sortcrits);
+    if (sorter.empty()) {
+        return slice(m->lastresults.size(), stidx, cnt, entries,
+                     [&](int i) {return m->searchEntry(i);});
+    }
+    string key = "s:" + searchstr + ":" + sorter.key();
+    if (key != m->sortedkey) {
+        m->sortedresults.clear();
+        slice(m->lastresults.size(), 0, 0, m->sortedresults,
+              [&](int i) {return m->searchEntry(i);});
+        sorter.sort(m->sortedresults);
+        m->sortedkey = key;
+    }
+    const vector<UpSong>& res = m->sortedresults;
+    return slice(res.size(), stidx, cnt, entries,
+                 [&res](int i) {return res[i];});
+}
+
+#ifdef PLGUPRCL_TEST
+// Browse tests on a small generated library. Build in src with:
+//   c++ -std=c++11 -DPLGUPRCL_TEST -I. -I/usr/include/libupnpp
+//       -o plguprcl mediaserver/cdplugins/plguprcl.cxx
+//       mediaserver/cdplugins/tagindex.cxx
+//       mediaserver/cdplugins/audiotags.cxx
+//       mediaserver/cdplugins/upsongsort.cxx upmpdutils.cxx conftree.cpp
+//       pathut.cpp readfile.cpp smallut.cpp -lmicrohttpd -lupnpp
+#include <stdio.h>
+
+#include <fstream>
+
+string g_cachedir;
+
+class TestServices : public CDPluginServices {
+public:
+    TestServices(const string& conf) : m_conf(conf, 1) {}
+    virtual string getpathprefix(CDPlugin *) {
+        return "/uprcl";
+    }
+    virtual CDPlugin *getpluginforpath(const string&) {
+        return nullptr;
+    }
+    virtual string getupnpaddr(CDPlugin *) {
+        return "127.0.0.1";
+    }
+    virtual int getupnpport(CDPlugin *) {
+        return 49152;
+    }
+    virtual bool setfileops(CDPlugin *, const string&,
+                            UPnPProvider::VirtualDir::FileOps) {
+        return true;
+    }
+    virtual ConfSimple *getconfig(CDPlugin *) {
+        return &m_conf;
+    }
+    virtual string getexecpath(CDPlugin *) {
+        return string();
+    }
+    ConfSimple m_conf;
+};
+
+static string le32s(unsigned int v)
+{
+    string s;
+    for (int i = 0; i < 4; i++) {
+        s += char((v >> (8 * i)) & 0xff);
+    }
+    return s;
+}
+
+// Minimal FLAC file: STREAMINFO and VORBIS_COMMENT metadata blocks.
+static void makeFlac(const string& path, const vector<string>& comments)
+{
+    string vc = le32s(4) + "test" + le32s(comments.size());
+    for (const auto& c : comments) {
+        vc += le32s(c.size()) + c;
+    }
+    string data("fLaC");
+    data += string("\0\0\0\x22", 4) + string(34, '\0');
+    data += char(0x84);
+    data += char((vc.size() >> 16) & 0xff);
+    data += char((vc.size() >> 8) & 0xff);
+    data += char(vc.size() & 0xff);
+    data += vc;
+    ofstream out(path, ios::out | ios::trunc | ios::binary);
+    out << data;
+}
+
+static int fails;
+#define CHECK(X) do {                                                   \
+        if (!(X)) {                                                     \
+            fprintf(stderr, "Line %d: check failed: %s\n", __LINE__, #X); \
+            fails++;                                                    \
+        }                                                               \
+    } while (0)
+
+static bool allTracks(const vector<UpSong>& entries)
+{
+    for (const auto& e : entries) {
+        if (e.iscontainer) {
+            return false;
+        }
+    }
+    return !entries.empty();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: plguprcl <testdir>\n");
+        return 1;
+    }
+    string top(argv[1]);
+    string media = path_cat(top, "media/album");
+    g_cachedir = path_cat(top, "cache");
+    path_makepath(media, 0755);
+    makeFlac(path_cat(media, "1.flac"), {"TITLE=One", "ARTIST=A", "ALBUM=X"});
+    makeFlac(path_cat(media, "2.flac"), {"TITLE=Two", "ARTIST=A", "ALBUM=X"});
+    makeFlac(path_cat(media, "3.flac"), {"TITLE=Three", "ARTIST=B",
+                "ALBUM=X"});
+
+    TestServices services("uprclhostport = 127.0.0.1:49333\n"
+                          "uprclpaths = /media:" + path_cat(top, "media") +
+                          "\n");
+    PlgUprcl plg("uprcl", &services);
+    vector<UpSong> entries;
+
+    // All tracks
+    CHECK(plg.browse("0$uprcl$items", 0, 0, entries) == 3);
+    CHECK(entries.size() == 3 && allTracks(entries));
+    // The container metadata, and a track
+    CHECK(plg.browse("0$uprcl$items", 0, 0, entries, {},
+                     CDPlugin::BFMeta) == 1);
+    CHECK(entries.size() == 1 && entries[0].iscontainer);
+    CHECK(plg.browse("0$uprcl$items$i1", 0, 0, entries, {},
+                     CDPlugin::BFMeta) == 1);
+    CHECK(entries.size() == 1 && !entries[0].iscontainer);
+    CHECK(plg.browse("0$uprcl$items$i1", 0, 0, entries) == 0);
+
+    // Tag value tracks: "A" and "B", then the tracks for each.
+    CHECK(plg.browse("0$uprcl$=Artist", 0, 0, entries) == 2);
+    int total = 0;
+    for (int v = 0; v < 2; v++) {
+        string id("0$uprcl$=Artist$" + lltodecstr(v) + "$items");
+        int cnt = plg.browse(id, 0, 0, entries);
+        CHECK(cnt > 0 && int(entries.size()) == cnt && allTracks(entries));
+        total += cnt;
+    }
+    CHECK(total == 3);
+
+    // Range headers: invalid ones are ignored, unsatisfiable ones
+    // are errors.
+    int64_t start, end;
+    CHECK(parseRange("bytes=10-19", 100, start, end) == 1 &&
+          start == 10 && end == 19);
+    CHECK(parseRange("bytes=90-", 100, start, end) == 1 &&
+          start == 90 && end == 99);
+    CHECK(parseRange("bytes=-10", 100, start, end) == 1 &&
+          start == 90 && end == 99);
+    CHECK(parseRange("bytes=50-200", 100, start, end) == 1 && end == 99);
+    CHECK(parseRange("bytes=20-10", 100, start, end) == 0);
+    CHECK(parseRange("bytes=-0", 100, start, end) == 0);
+    CHECK(parseRange("items=0-10", 100, start, end) == 0);
+    CHECK(parseRange("bytes=100-", 100, start, end) == -1);
+
+    printf("%s\n", fails ? "FAILED" : "OK");
+    return fails ? 1 : 0;
+}
+#endif // PLGUPRCL_TEST
@@ -0,0 +1,51 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _PLGUPRCL_H_INCLUDED_
+#define _PLGUPRCL_H_INCLUDED_
+
+#include <vector>
+
+#include "cdplugin.hxx"
+
+// Local media library, implemented natively in C++ (as opposed to
+// the Python/Recoll uprcl module). This uses the same "uprcl" name
+// and object ids namespace, and is selected by the "uprclnative"
+// configuration variable.
+class PlgUprcl : public CDPlugin {
+public:
+    PlgUprcl(const std::string& name, CDPluginServices *services);
+    virtual ~PlgUprcl();
+
+    // Returns totalmatches
+    virtual int browse(
+	const std::string& objid, int stidx, int cnt,
+	std::vector<UpSong>& entries,
+	const std::vector<std::string>& sortcrits = std::vector<std::string>(),
+	BrowseFlag flg = BFChildren);
+
+    virtual int search(
+	const std::string& ctid, int stidx, int cnt,
+	const std::string& searchstr,
+	std::vector<UpSong>& entries,
+	const std::vector<std::string>& sortcrits = std::vector<std::string>());
+
+    class Internal;
+private:
+    Internal *m;
+};
+
+#endif /* _PLGUPRCL_H_INCLUDED_ */
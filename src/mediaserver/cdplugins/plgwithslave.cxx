@@ -20,20 +20,32 @@
 
 #include <fcntl.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <sstream>
 #include <string.h>
 #include <upnp/upnp.h>
 #include <microhttpd.h>
-#include <json/json.h>
 
 #include "cmdtalk.h"
+#include "diskcache.hxx"
+#include "jsonentries.hxx"
 #include "pathut.h"
 #include "smallut.h"
 #include "libupnpp/log.hxx"
 #include "main.hxx"
 #include "conftree.h"
+#include "upsongsort.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -62,6 +74,11 @@ public:
     time_t opentime;
 };
 
+class ContentCacheEntry;
+// Optional persistent second level for the browse cache, shared by
+// the plugins (the keys begin with the plugin name).
+static DiskCache *o_dcache;
+
 class PlgWithSlave::Internal {
 public:
     Internal(PlgWithSlave *_plg, const string& exe, const string& hst,
@@ -69,11 +86,55 @@ public:
         : plg(_plg), exepath(exe), upnphost(hst), upnpport(prt), pathprefix(pp), 
           laststream(this) {
     }
+    ~Internal() {
+        if (startfut.valid()) {
+            startfut.wait();
+        }
+        {
+            lock_guard<mutex> lock(refreshmutex);
+            refreshstop = true;
+        }
+        refreshcv.notify_all();
+        if (refresher.joinable()) {
+            refresher.join();
+        }
+    }
 
+    // Start the slave if it is not running, or wait for the warmup
+    // task if one is active.
     bool maybeStartCmd();
+    bool startCmd();
+    bool running() {
+        lock_guard<mutex> lock(cmdmutex);
+        return cmd.running();
+    }
+    // Timed call to the slave. Fails if the slave is not running.
+    bool callproc(const string& proc,
+                  const unordered_map<string, string>& args,
+                  unordered_map<string, string>& res);
+
+    // Decode browse results and store them in the memory and disk
+    // caches. Returns nullptr if the results can't be decoded.
+    shared_ptr<ContentCacheEntry> storeBrowse(const string& cachekey,
+                                              const string& encoded);
+    // Look for browse results in the disk cache. Stale results are
+    // returned, and a refresh is queued.
+    shared_ptr<ContentCacheEntry> diskCacheGet(const string& objid,
+                                               const string& cachekey);
+    void queueRefresh(const string& objid);
+    void refreshLoop();
+    // The local media library (uprcl) is not worth caching on disk,
+    // and its contents change.
+    bool useDiskCache() {
+        return o_dcache && plg->getname() != "uprcl";
+    }
 
     PlgWithSlave *plg;
     CmdTalk cmd;
+    // Serializes the slave start and the calls: the requests, the
+    // warmup and the refresher can run in different threads, and
+    // startCmd() replaces the process.
+    mutex cmdmutex;
     string exepath;
     // Upnp Host and port. This would only be used to generate URLsif
     // we were using the libupnp miniserver. We currently use
@@ -85,11 +146,28 @@ public:
     
     // Cached uri translation
     StreamHandle laststream;
+
+    // Result of the background startup, if warmup() was called and
+    // the result was not consumed yet. The first request waits on
+    // it. startmutex protects startfut, and is held by
+    // maybeStartCmd() until the slave is started.
+    shared_future<bool> startfut;
+    mutex startmutex;
+
+    // Background refresh of stale disk cache entries: object ids to
+    // browse, and the worker thread, started on first use.
+    deque<string> refreshq;
+    bool refreshstop{false};
+    mutex refreshmutex;
+    condition_variable refreshcv;
+    thread refresher;
 };
 
 // microhttpd daemon handle. There is only one of these, and one port, we find
 // the right plugin by looking at the url path.
 static struct MHD_Daemon *mhd;
+// The plugins can be started in parallel (warmup, root search)
+static mutex o_mhdmutex;
 
 // Microhttpd connection handler. We re-build the complete url + query
 // string (&trackid=value), use this to retrieve a service URL
@@ -133,6 +211,7 @@ static int answer_to_connection(void *cls, struct MHD_Connection *connection,
     //                               upload_data, upload_data_size, con_cls);
 
     string path(url);
+    TraceSpan span("PlgWithSlave::redirect", path);
 
     // The streaming services plugins set a trackId parameter in the
     // URIs. This gets parsed out by mhttpd. We rebuild a full url
@@ -179,9 +258,27 @@ static int accept_policy(void *, const struct sockaddr* sa, socklen_t addrlen)
     return MHD_YES;
 }
 
-// Called once for starting the Python program and do other initialization.
 bool PlgWithSlave::Internal::maybeStartCmd()
 {
+    lock_guard<mutex> lock(startmutex);
+    if (startfut.valid()) {
+        // Don't start a second slave while the warmup is running.
+        if (startfut.wait_for(chrono::seconds(0)) != future_status::ready) {
+            LOGDEB("PlgWithSlave: " << plg->getname() <<
+                   ": waiting for startup\n");
+        }
+        startfut.get();
+        // Done with it. We go through the normal path from now on,
+        // e.g. for restarting the slave if it exits.
+        startfut = shared_future<bool>();
+    }
+    return startCmd();
+}
+
+// Called once for starting the Python program and do other initialization.
+bool PlgWithSlave::Internal::startCmd()
+{
+    lock_guard<mutex> cmdlock(cmdmutex);
     if (cmd.running()) {
         return true;
     }
@@ -192,6 +289,7 @@ bool PlgWithSlave::Internal::maybeStartCmd()
     if (conf->get("plgmicrohttpport", sport)) {
         port = atoi(sport.c_str());
     }
+    unique_lock<mutex> mhdlock(o_mhdmutex);
     if (nullptr == mhd) {
 
         // Start the microhttpd daemon. There can be only one, and it
@@ -214,6 +312,7 @@ bool PlgWithSlave::Internal::maybeStartCmd()
             return false;
         }
     }
+    mhdlock.unlock();
     
     string pythonpath = string("PYTHONPATH=") +
         path_cat(g_datadir, "cdplugins") + ":" +
@@ -224,6 +323,9 @@ bool PlgWithSlave::Internal::maybeStartCmd()
     ss << upnphost << ":" << port;
     string hostport = string("UPMPD_HTTPHOSTPORT=") + ss.str();
     string pp = string("UPMPD_PATHPREFIX=") + pathprefix;
+    static MetricsHistogram *exechist =
+        metricsHistogram("upmpdcli_exec_seconds", "cmd=\"cdplugin\"");
+    MetricsTimer timer(exechist);
     if (!cmd.startCmd(exepath, {/*args*/},
                       /* env */ {pythonpath, configname, hostport, pp})) {
         LOGERR("PlgWithSlave::maybeStartCmd: startCmd failed\n");
@@ -232,6 +334,24 @@ bool PlgWithSlave::Internal::maybeStartCmd()
     return true;
 }
 
+bool PlgWithSlave::Internal::callproc(
+    const string& proc, const unordered_map<string, string>& args,
+    unordered_map<string, string>& res)
+{
+    // The lookup cost is negligible compared to the slave round trip
+    TraceSpan span("CmdTalk::callproc", proc);
+    MetricsTimer timer(
+        metricsHistogram("upmpdcli_plugin_call_seconds", "plugin=\"" +
+                         plg->getname() + "\",proc=\"" + proc + "\""));
+    lock_guard<mutex> lock(cmdmutex);
+    if (!cmd.running()) {
+        LOGERR("PlgWithSlave::callproc: " << plg->getname() <<
+               ": slave not running\n");
+        return false;
+    }
+    return cmd.callproc(proc, args, res);
+}
+
 // Translate the slave-generated HTTP URL (based on the trackid), to
 // an actual temporary service (e.g. tidal one), which will be an HTTP
 // URL pointing to either an AAC or a FLAC stream.
@@ -244,6 +364,7 @@ bool PlgWithSlave::Internal::maybeStartCmd()
 string PlgWithSlave::get_media_url(const string& path)
 {
     LOGDEB0("PlgWithSlave::get_media_url: " << path << endl);
+    TraceSpan span("PlgWithSlave::get_media_url");
     if (!m->maybeStartCmd()) {
         return string();
     }
@@ -251,7 +372,7 @@ string PlgWithSlave::get_media_url(const string& path)
     if (m->laststream.path.compare(path) ||
         (now - m->laststream.opentime > 10)) {
         unordered_map<string, string> res;
-        if (!m->cmd.callproc("trackuri", {{"path", path}}, res)) {
+        if (!m->callproc("trackuri", {{"path", path}}, res)) {
             LOGERR("PlgWithSlave::get_media_url: slave failure\n");
             return string();
         }
@@ -272,6 +393,8 @@ string PlgWithSlave::get_media_url(const string& path)
 }
 
 
+static void diskCacheInit(ConfSimple *conf);
+
 PlgWithSlave::PlgWithSlave(const string& name, CDPluginServices *services)
     : CDPlugin(name, services)
 {
@@ -279,6 +402,8 @@ PlgWithSlave::PlgWithSlave(const string& name, CDPluginServices *services)
                      services->getupnpaddr(this),
                      services->getupnpport(this),
                      services->getpathprefix(this));
+    static once_flag dcacheonce;
+    call_once(dcacheonce, diskCacheInit, services->getconfig(this));
 }
 
 PlgWithSlave::~PlgWithSlave()
@@ -286,113 +411,93 @@ PlgWithSlave::~PlgWithSlave()
     delete m;
 }
 
-static void catstring(string& dest, const string& s2)
+// Start the slave and browse the plugin root in the background: this
+// makes the slave log in to the service, and caches the top level
+// entries.
+void PlgWithSlave::warmup()
 {
-    if (s2.empty()) {
+    lock_guard<mutex> lock(m->startmutex);
+    if (m->startfut.valid() || m->running()) {
         return;
     }
-    if (dest.empty()) {
-        dest = s2;
-    } else {
-        dest += string(" ") + s2;
-    }
+    m->startfut = async(launch::async, [this] () {
+            TraceSpan span("PlgWithSlave::warmup", m_name);
+            auto start = chrono::steady_clock::now();
+            if (!m->startCmd()) {
+                return false;
+            }
+            string objid("0$" + m_name + "$");
+            unordered_map<string, string> res;
+            if (m->callproc("browse", {{"objid", objid}, {"flag", "children"}},
+                            res)) {
+                auto it = res.find("entries");
+                if (it != res.end()) {
+                    m->storeBrowse(m_name + ":" + objid, it->second);
+                }
+            } else {
+                LOGERR("PlgWithSlave::warmup: " << m_name <<
+                       ": root browse failed\n");
+            }
+            LOGINF("PlgWithSlave: " << m_name << " ready after " <<
+                   chrono::duration_cast<chrono::milliseconds>(
+                       chrono::steady_clock::now() - start).count() <<
+                   " ms\n");
+            // The slave is running, even if the service login failed:
+            // let the requests go on and report the errors.
+            return true;
+        }).share();
 }
 
+// Returns -1 if the data can't be decoded. The partial results are
+// not usable (and must not be cached).
 static int resultToEntries(const string& encoded, int stidx, int cnt,
                            vector<UpSong>& entries)
 {
-    Json::Value decoded;
-    istringstream input(encoded);
-    input >> decoded;
-    LOGDEB0("PlgWithSlave::results: got " << decoded.size() << " entries \n");
-    LOGDEB1("PlgWithSlave::results: undecoded: " << decoded.dump() << endl);
-    bool dolimit = cnt > 0;
-    
-    for (unsigned int i = stidx; i < decoded.size(); i++) {
-#define JSONTOUPS(fld, nm) {catstring(song.fld, \
-                                      decoded[i].get(#nm, "").asString());}
-        if (dolimit && --cnt < 0) {
-            break;
-        }
-        UpSong song;
-        JSONTOUPS(id, id);
-        JSONTOUPS(parentid, pid);
-        JSONTOUPS(title, tt);
-        JSONTOUPS(artUri, upnp:albumArtURI);
-        JSONTOUPS(artist, upnp:artist);
-        JSONTOUPS(upnpClass, upnp:class);
-        // tp is container ("ct") or item ("it")
-        string stp = decoded[i].get("tp", "").asString();
-        if (!stp.compare("ct")) {
-            song.iscontainer = true;
-            string ss = decoded[i].get("searchable", "").asString();
-            if (!ss.empty()) {
-                song.searchable = stringToBool(ss);
-            }
-        } else  if (!stp.compare("it")) {
-            song.iscontainer = false;
-            JSONTOUPS(uri, uri);
-            JSONTOUPS(artist, dc:creator);
-            JSONTOUPS(genre, upnp:genre);
-            JSONTOUPS(album, upnp:album);
-            JSONTOUPS(tracknum, upnp:originalTrackNumber);
-            JSONTOUPS(mime, res:mime);
-
-            string ss = decoded[i].get("duration", "").asString();
-            if (!ss.empty()) {
-                song.duration_secs = atoi(ss.c_str());
-            }
-            ss = decoded[i].get("res:size", "").asString();
-            if (!ss.empty()) {
-                song.size = atoll(ss.c_str());
-            }
-            ss = decoded[i].get("res:bitrate", "").asString();
-            if (!ss.empty()) {
-                song.bitrate = atoi(ss.c_str());
-            }
-            ss = decoded[i].get("res:samplefreq", "").asString();
-            if (!ss.empty()) {
-                song.samplefreq = atoi(ss.c_str());
-            }
-            ss = decoded[i].get("res:channels", "").asString();
-            if (!ss.empty()) {
-                song.channels = atoi(ss.c_str());
-            }
-        } else {
-            LOGERR("PlgWithSlave::result: bad type in entry: " << stp <<
-                   "(title: " << song.title << ")\n");
-            continue;
-        }
-        LOGDEB1("PlgWitSlave::result: pushing: " << song.dump() << endl);
-        entries.push_back(song);
-    }
+    TraceSpan span("resultToEntries");
+    LOGDEB1("PlgWithSlave::results: undecoded: " << encoded << endl);
+    int total = jsonToEntries(encoded, stidx, cnt, entries);
+    if (total < 0) {
+        LOGERR("PlgWithSlave::results: could not decode plugin data\n");
+        entries.clear();
+        return -1;
+    }
+    LOGDEB0("PlgWithSlave::results: got " << total << " entries \n");
     // We return the total match size, the count of actually returned
     // entries can be obtained from the vector
-    return decoded.size();
+    return total;
 }
 
 
+// Cache entries are not modified after creation, and shared by the
+// cache and the users.
 class ContentCacheEntry {
 public:
-    ContentCacheEntry()
-        : m_time(time(0)) {
+    ContentCacheEntry(const vector<UpSong>& results)
+        : m_time(time(0)), m_results(results) {
+    }
+    ContentCacheEntry(CompactSongList&& results)
+        : m_time(time(0)), m_results(std::move(results)) {
     }
     int toResult(const string& classfilter, int stidx, int cnt,
                  vector<UpSong>& entries) const;
+    // Return a new entry with the sorted results
+    shared_ptr<ContentCacheEntry> sorted(const UpSongSorter& sorter) const;
     time_t m_time;
-    vector<UpSong> m_results;
+    CompactSongList m_results;
 };
 
 int ContentCacheEntry::toResult(const string& classfilter, int stidx, int cnt,
                                 vector<UpSong>& entries) const
 {
-    const vector<UpSong>& res = m_results;
+    const CompactSongList& res = m_results;
     LOGDEB0("searchCacheEntryToResult: filter " << classfilter << " start " <<
             stidx << " cnt " << cnt << " res.size " << res.size() << endl);
     entries.reserve(cnt);
     int total = 0;
     for (unsigned int i = 0; i < res.size(); i++) {
-        if (!classfilter.empty() && res[i].upnpClass.find(classfilter) != 0) {
+        if (!classfilter.empty() &&
+            strncmp(res.upnpClass(i), classfilter.c_str(),
+                    classfilter.size())) {
             continue;
         }
         total++;
@@ -402,23 +507,37 @@ int ContentCacheEntry::toResult(const string& classfilter, int stidx, int cnt,
         if (cnt && int(entries.size()) >= cnt) {
             break;
         }
+        entries.push_back(res.get(i));
         LOGDEB1("ContentCacheEntry::toResult: pushing class " <<
-                res[i].upnpClass << " tt " << res[i].title << endl);
-        entries.push_back(res[i]);
+                entries.back().upnpClass << " tt " << entries.back().title <<
+                endl);
     }
     return res.size();
 }
 
+shared_ptr<ContentCacheEntry>
+ContentCacheEntry::sorted(const UpSongSorter& sorter) const
+{
+    vector<UpSong> songs;
+    m_results.get(songs);
+    sorter.sort(songs);
+    return make_shared<ContentCacheEntry>(songs);
+}
+
 class ContentCache {
 public:
     ContentCache(int retention_secs = 300);
-    ContentCacheEntry *get(const string& query);
-    void set(const string& query, ContentCacheEntry &entry);
-    void purge();
+    shared_ptr<ContentCacheEntry> get(const string& query);
+    void set(const string& query, shared_ptr<ContentCacheEntry> entry);
+    // Forget the entries with keys beginning with prefix.
+    void erasePrefix(const string& prefix);
 private:
+    void purge();
     time_t m_lastpurge;
     int m_retention_secs;
-    unordered_map<string, ContentCacheEntry> m_cache;
+    unordered_map<string, shared_ptr<ContentCacheEntry> > m_cache;
+    // The browse cache is also updated by the refresh threads
+    mutex m_mutex;
 };
 
 ContentCache::ContentCache(int retention_secs)
@@ -433,7 +552,7 @@ void ContentCache::purge()
         return;
     }
     for (auto it = m_cache.begin(); it != m_cache.end(); ) {
-        if (now - it->second.m_time > m_retention_secs) {
+        if (now - it->second->m_time > m_retention_secs) {
             LOGDEB0("ContentCache::purge: erasing " << it->first << endl);
             it = m_cache.erase(it);
         } else {
@@ -443,30 +562,169 @@ void ContentCache::purge()
     m_lastpurge = now;
 }
 
-ContentCacheEntry *ContentCache::get(const string& key)
+shared_ptr<ContentCacheEntry> ContentCache::get(const string& key)
 {
+    lock_guard<mutex> lock(m_mutex);
     purge();
     auto it = m_cache.find(key);
     if (it != m_cache.end()) {
         LOGDEB0("ContentCache::get: found " << key << endl);
-        // we return a copy of the vector. Make our multi-access life simpler...
-        return new ContentCacheEntry(it->second);
+        // The entry stays valid for the caller even if it is purged
+        return it->second;
     }
     LOGDEB0("ContentCache::get: not found " << key << endl);
     return nullptr;
 }
 
-void ContentCache::set(const string& key, ContentCacheEntry &entry)
+void ContentCache::set(const string& key, shared_ptr<ContentCacheEntry> entry)
 {
     LOGDEB0("ContentCache::set: " << key << endl);
+    lock_guard<mutex> lock(m_mutex);
     m_cache[key] = entry;
 }
 
+void ContentCache::erasePrefix(const string& prefix)
+{
+    lock_guard<mutex> lock(m_mutex);
+    for (auto it = m_cache.begin(); it != m_cache.end(); ) {
+        if (beginswith(it->first, prefix)) {
+            it = m_cache.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
 // Cache for searches
 static ContentCache o_scache(300);
 // Cache for browsing
 static ContentCache o_bcache(180);
 
+// Disk cache results younger than o_dcachefresh are used as is. Older
+// ones are used, and refreshed in the background. Results older than
+// o_dcachemaxage are ignored.
+static int o_dcachefresh = 3600;
+static int o_dcachemaxage = 7 * 24 * 3600;
+
+static void diskCacheInit(ConfSimple *conf)
+{
+    string value;
+    int megabytes = 0;
+    if (conf->get("plgdiskcachemb", value)) {
+        megabytes = atoi(value.c_str());
+    }
+    if (megabytes <= 0) {
+        return;
+    }
+    if (conf->get("plgdiskcachefresh", value)) {
+        o_dcachefresh = atoi(value.c_str());
+    }
+    if (conf->get("plgdiskcachemaxage", value)) {
+        o_dcachemaxage = atoi(value.c_str());
+    }
+    o_dcache = new DiskCache(path_cat(g_cachedir, "plgcache"),
+                             int64_t(megabytes) * 1024 * 1024);
+}
+
+shared_ptr<ContentCacheEntry>
+PlgWithSlave::Internal::storeBrowse(const string& cachekey,
+                                    const string& encoded)
+{
+    vector<UpSong> songs;
+    if (resultToEntries(encoded, 0, 0, songs) < 0) {
+        return nullptr;
+    }
+    auto cep = make_shared<ContentCacheEntry>(songs);
+    // The sorted versions of the previous results are obsolete
+    o_bcache.erasePrefix(cachekey + ":");
+    o_bcache.set(cachekey, cep);
+    if (useDiskCache()) {
+        string data;
+        cep->m_results.serialize(data);
+        o_dcache->put(cachekey, data);
+    }
+    return cep;
+}
+
+shared_ptr<ContentCacheEntry>
+PlgWithSlave::Internal::diskCacheGet(const string& objid,
+                                     const string& cachekey)
+{
+    if (!useDiskCache()) {
+        return nullptr;
+    }
+    static MetricsCounter *fresh = metricsCounter(
+        "upmpdcli_plugin_diskcache_total", "result=\"fresh\"");
+    static MetricsCounter *stale = metricsCounter(
+        "upmpdcli_plugin_diskcache_total", "result=\"stale\"");
+    static MetricsCounter *miss = metricsCounter(
+        "upmpdcli_plugin_diskcache_total", "result=\"miss\"");
+    string data;
+    time_t stored;
+    CompactSongList results;
+    if (!o_dcache->get(cachekey, data, &stored) ||
+        time(0) - stored > o_dcachemaxage || !results.unserialize(data)) {
+        miss->inc();
+        return nullptr;
+    }
+    auto cep = make_shared<ContentCacheEntry>(std::move(results));
+    o_bcache.set(cachekey, cep);
+    if (time(0) - stored > o_dcachefresh) {
+        LOGDEB0("PlgWithSlave::diskCacheGet: stale: " << cachekey << endl);
+        stale->inc();
+        queueRefresh(objid);
+    } else {
+        fresh->inc();
+    }
+    return cep;
+}
+
+void PlgWithSlave::Internal::queueRefresh(const string& objid)
+{
+    lock_guard<mutex> lock(refreshmutex);
+    if (find(refreshq.begin(), refreshq.end(), objid) != refreshq.end()) {
+        return;
+    }
+    refreshq.push_back(objid);
+    if (!refresher.joinable()) {
+        refresher = thread(&PlgWithSlave::Internal::refreshLoop, this);
+    } else {
+        refreshcv.notify_one();
+    }
+}
+
+// The slave calls are serialized by callproc() (cmdmutex), so the
+// refreshes just get in line with the browse requests.
+void PlgWithSlave::Internal::refreshLoop()
+{
+    unique_lock<mutex> lock(refreshmutex);
+    for (;;) {
+        refreshcv.wait(lock, [this] {
+                return refreshstop || !refreshq.empty();});
+        if (refreshstop) {
+            return;
+        }
+        string objid = refreshq.front();
+        refreshq.pop_front();
+        lock.unlock();
+        unordered_map<string, string> res;
+        // Don't restart the slave from here, this is done by
+        // browse(). callproc() fails if the slave is not running.
+        if (callproc("browse", {{"objid", objid}, {"flag", "children"}}, res)) {
+            auto it = res.find("entries");
+            // On a decoding error, we keep the stale entry
+            if (it != res.end() &&
+                storeBrowse(plg->getname() + ":" + objid, it->second)) {
+                LOGDEB0("PlgWithSlave::refresh: updated " << objid << endl);
+            }
+        } else {
+            LOGERR("PlgWithSlave::refresh: slave failure for " << objid <<
+                   endl);
+        }
+        lock.lock();
+    }
+}
+
 // Better return a bogus informative entry than an outright error:
 static int errorEntries(const string& pid, vector<UpSong>& entries)
 {
@@ -488,6 +746,7 @@ int PlgWithSlave::browse(const string& objid, int stidx, int cnt,
                          BrowseFlag flg)
 {
     LOGDEB1("PlgWithSlave::browse\n");
+    TraceSpan span("PlgWithSlave::browse", objid);
     entries.clear();
     if (!m->maybeStartCmd()) {
         return errorEntries(objid, entries);
@@ -503,19 +762,34 @@ int PlgWithSlave::browse(const string& objid, int stidx, int cnt,
         break;
     }
 
+    UpSongSorter sorter(sortcrits);
     string cachekey(m_name + ":" + objid);
+    string sortedkey(sorter.empty() ? cachekey :
+                     cachekey + ":" + sorter.key());
     if (flg == CDPlugin::BFChildren) {
         // Check cache
-        ContentCacheEntry *cep;
-        if ((cep = o_bcache.get(cachekey)) != nullptr) {
-            int total = cep->toResult("", stidx, cnt, entries);
-            delete cep;
-            return total;
+        shared_ptr<ContentCacheEntry> cep;
+        if ((cep = o_bcache.get(sortedkey)) != nullptr) {
+            return cep->toResult("", stidx, cnt, entries);
+        }
+        if (!sorter.empty() && (cep = o_bcache.get(cachekey)) != nullptr) {
+            // Have the unsorted results: sort them once and cache
+            // the sorted version for the next pages.
+            cep = cep->sorted(sorter);
+            o_bcache.set(sortedkey, cep);
+            return cep->toResult("", stidx, cnt, entries);
+        }
+        if ((cep = m->diskCacheGet(objid, cachekey)) != nullptr) {
+            if (!sorter.empty()) {
+                cep = cep->sorted(sorter);
+                o_bcache.set(sortedkey, cep);
+            }
+            return cep->toResult("", stidx, cnt, entries);
         }
     }
     
     unordered_map<string, string> res;
-    if (!m->cmd.callproc("browse", {{"objid", objid}, {"flag", sbflg}}, res)) {
+    if (!m->callproc("browse", {{"objid", objid}, {"flag", sbflg}}, res)) {
         LOGERR("PlgWithSlave::browse: slave failure\n");
         return errorEntries(objid, entries);
     }
@@ -527,12 +801,18 @@ int PlgWithSlave::browse(const string& objid, int stidx, int cnt,
     }
 
     if (flg == CDPlugin::BFChildren) {
-        ContentCacheEntry e;
-        resultToEntries(it->second, 0, 0, e.m_results);
-        o_bcache.set(cachekey, e);
-        return e.toResult("", stidx, cnt, entries);
+        auto cep = m->storeBrowse(cachekey, it->second);
+        if (!cep) {
+            return errorEntries(objid, entries);
+        }
+        if (!sorter.empty()) {
+            cep = cep->sorted(sorter);
+            o_bcache.set(sortedkey, cep);
+        }
+        return cep->toResult("", stidx, cnt, entries);
     } else {
-        return resultToEntries(it->second, stidx, cnt, entries);
+        int total = resultToEntries(it->second, stidx, cnt, entries);
+        return total < 0 ? errorEntries(objid, entries) : total;
     }
 }
 
@@ -619,17 +899,23 @@ int PlgWithSlave::search(const string& ctid, int stidx, int cnt,
     }
 
     // In cache ?
-    ContentCacheEntry *cep;
+    shared_ptr<ContentCacheEntry> cep;
+    UpSongSorter sorter(sortcrits);
     string cachekey(m_name + ":" + ctid + ":" + searchstr);
-    if ((cep = o_scache.get(cachekey)) != nullptr) {
-        int total = cep->toResult(classfilter, stidx, cnt, entries);
-        delete cep;
-        return total;
+    string sortedkey(sorter.empty() ? cachekey :
+                     cachekey + ":" + sorter.key());
+    if ((cep = o_scache.get(sortedkey)) != nullptr) {
+        return cep->toResult(classfilter, stidx, cnt, entries);
+    }
+    if (!sorter.empty() && (cep = o_scache.get(cachekey)) != nullptr) {
+        cep = cep->sorted(sorter);
+        o_scache.set(sortedkey, cep);
+        return cep->toResult(classfilter, stidx, cnt, entries);
     }
 
     // Run query
     unordered_map<string, string> res;
-    if (!m->cmd.callproc("search", {
+    if (!m->callproc("search", {
                 {"objid", ctid},
                 {"objkind", objkind},
                 {"origsearch", searchstr},
@@ -645,8 +931,16 @@ int PlgWithSlave::search(const string& ctid, int stidx, int cnt,
         return errorEntries(ctid, entries);
     }
     // Convert the whole set and store in cache
-    ContentCacheEntry e;
-    resultToEntries(it->second, 0, 0, e.m_results);
-    o_scache.set(cachekey, e);
-    return e.toResult(classfilter, stidx, cnt, entries);
+    vector<UpSong> songs;
+    if (resultToEntries(it->second, 0, 0, songs) < 0) {
+        return errorEntries(ctid, entries);
+    }
+    cep = make_shared<ContentCacheEntry>(songs);
+    o_scache.set(cachekey, cep);
+    if (!sorter.empty()) {
+        sorter.sort(songs);
+        cep = make_shared<ContentCacheEntry>(songs);
+        o_scache.set(sortedkey, cep);
+    }
+    return cep->toResult(classfilter, stidx, cnt, entries);
 }
@@ -42,6 +42,8 @@ public:
 	std::vector<UpSong>& entries,
 	const std::vector<std::string>& sortcrits = std::vector<std::string>());
 
+    virtual void warmup();
+
     // This is for internal use only, but moving it to Internal would
     // make things quite more complicated for a number of reasons.
     virtual std::string get_media_url(const std::string& path);
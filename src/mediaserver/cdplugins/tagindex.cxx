@@ -0,0 +1,394 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "tagindex.hxx"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <utility>
+
+#include "libupnpp/log.hxx"
+
+#include "pathut.h"
+#include "readfile.h"
+#include "smallut.h"
+
+using namespace std;
+
+// Bump the version if the record format changes. The index will be
+// rebuilt from scratch.
+static const string o_magic("upmpdcli-tagindex 1");
+static const unsigned int o_nfields = 16;
+
+// Cover art file names, by order of preference
+static const vector<string> o_artnames{
+    "folder.jpg", "folder.png", "cover.jpg", "cover.png"};
+
+TagIndex::TagIndex(const string& dbpath, const vector<string>& topdirs)
+    : m_dbpath(dbpath), m_topdirs(topdirs)
+{
+}
+
+const string& TagIndex::tagTableName(TagTable tt)
+{
+    static const string names[] = {"Artist", "Genre", "Composer"};
+    static const string empty;
+    if (tt < 0 || tt >= TTCount) {
+        return empty;
+    }
+    return names[tt];
+}
+
+static void splitfields(const string& data, string::size_type pos,
+                        string::size_type eol, vector<string>& fields)
+{
+    fields.clear();
+    for (;;) {
+        string::size_type tab = data.find('\t', pos);
+        if (tab == string::npos || tab > eol) {
+            fields.push_back(data.substr(pos, eol - pos));
+            return;
+        }
+        fields.push_back(data.substr(pos, tab - pos));
+        pos = tab + 1;
+    }
+}
+
+bool TagIndex::load(vector<Track>& stored)
+{
+    if (!path_exists(m_dbpath)) {
+        LOGDEB("TagIndex::load: no index at " << m_dbpath << endl);
+        return true;
+    }
+    string data, reason;
+    if (!file_to_string(m_dbpath, data, &reason)) {
+        LOGERR("TagIndex::load: " << reason << endl);
+        return false;
+    }
+    string::size_type pos = data.find('\n');
+    if (pos == string::npos || data.compare(0, pos, o_magic)) {
+        LOGINF("TagIndex::load: bad or obsolete format, rebuilding\n");
+        return true;
+    }
+    pos++;
+    vector<string> f;
+    while (pos < data.size()) {
+        string::size_type eol = data.find('\n', pos);
+        if (eol == string::npos) {
+            eol = data.size();
+        }
+        splitfields(data, pos, eol, f);
+        pos = eol + 1;
+        if (f.size() != o_nfields) {
+            continue;
+        }
+        Track t;
+        t.path = f[0];
+        t.mtime = atoll(f[1].c_str());
+        t.size = atoll(f[2].c_str());
+        t.mime = f[3];
+        t.tags.title = f[4];
+        t.tags.artist = f[5];
+        t.tags.albumartist = f[6];
+        t.tags.album = f[7];
+        t.tags.genre = f[8];
+        t.tags.date = f[9];
+        t.tags.tracknum = f[10];
+        t.tags.composer = f[11];
+        t.tags.duration_secs = atoi(f[12].c_str());
+        t.tags.samplefreq = atoi(f[13].c_str());
+        t.tags.channels = atoi(f[14].c_str());
+        t.tags.bitrate = atoi(f[15].c_str());
+        stored.push_back(t);
+    }
+    return true;
+}
+
+bool TagIndex::save()
+{
+    string dir = path_getfather(m_dbpath);
+    if (!path_makepath(dir, 0755)) {
+        LOGERR("TagIndex::save: can't create " << dir << " errno " <<
+               errno << endl);
+        return false;
+    }
+    string tmp = m_dbpath + ".tmp";
+    ofstream out(tmp, ios::out | ios::trunc);
+    if (!out.is_open()) {
+        LOGERR("TagIndex::save: can't open " << tmp << endl);
+        return false;
+    }
+    out << o_magic << "\n";
+    for (const auto& t : tracks) {
+        out << t.path << '\t' << t.mtime << '\t' << t.size << '\t' <<
+            t.mime << '\t' << t.tags.title << '\t' << t.tags.artist << '\t' <<
+            t.tags.albumartist << '\t' << t.tags.album << '\t' <<
+            t.tags.genre << '\t' << t.tags.date << '\t' <<
+            t.tags.tracknum << '\t' << t.tags.composer << '\t' <<
+            t.tags.duration_secs << '\t' << t.tags.samplefreq << '\t' <<
+            t.tags.channels << '\t' << t.tags.bitrate << '\n';
+    }
+    out.close();
+    if (out.fail()) {
+        LOGERR("TagIndex::save: write failed for " << tmp << endl);
+        unlink(tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), m_dbpath.c_str()) < 0) {
+        LOGERR("TagIndex::save: rename to " << m_dbpath << " errno " <<
+               errno << endl);
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
+
+void TagIndex::walk(const string& dir, int folder, vector<Track>& stored,
+                    int& reused)
+{
+    struct stat st;
+    if (stat(dir.c_str(), &st) < 0) {
+        LOGERR("TagIndex::walk: can't stat " << dir << endl);
+        return;
+    }
+    if (!m_visited.insert(pair<uint64_t, uint64_t>(st.st_dev,
+                                                   st.st_ino)).second) {
+        LOGDEB("TagIndex::walk: already visited: " << dir << endl);
+        return;
+    }
+    set<string> entries;
+    string reason;
+    if (!readdir(dir, reason, entries)) {
+        LOGERR("TagIndex::walk: " << reason << endl);
+        return;
+    }
+
+    unsigned int artrank = o_artnames.size();
+    for (const auto& nm : entries) {
+        if (nm[0] == '.') {
+            continue;
+        }
+        string path = path_cat(dir, nm);
+        if (stat(path.c_str(), &st) < 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            Folder fld;
+            fld.name = nm;
+            fld.parent = folder;
+            folders.push_back(fld);
+            int idx = folders.size() - 1;
+            folders[folder].subdirs.push_back(idx);
+            walk(path, idx, stored, reused);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            continue;
+        }
+        const string& mime = audioMimeForPath(nm);
+        if (mime.empty()) {
+            string lnm = stringtolower(nm);
+            for (unsigned int i = 0; i < artrank; i++) {
+                if (lnm == o_artnames[i]) {
+                    folders[folder].artname = nm;
+                    artrank = i;
+                    break;
+                }
+            }
+            continue;
+        }
+        if (path.find_first_of("\t\n") != string::npos) {
+            LOGINF("TagIndex::walk: skipping file with tab or newline in "
+                   "name: " << path << endl);
+            continue;
+        }
+
+        Track t;
+        auto it = m_storedidx.find(path);
+        if (it != m_storedidx.end() &&
+            stored[it->second].mtime == st.st_mtime &&
+            stored[it->second].size == st.st_size) {
+            t = std::move(stored[it->second]);
+            reused++;
+        } else {
+            LOGDEB1("TagIndex::walk: reading tags for " << path << endl);
+            t.path = path;
+            t.mtime = st.st_mtime;
+            t.size = st.st_size;
+            t.mime = mime;
+            audioTagsRead(path, mime, t.tags);
+            m_dirty = true;
+        }
+        t.folder = folder;
+        t.album = -1;
+        folders[folder].tracks.push_back(tracks.size());
+        tracks.push_back(std::move(t));
+    }
+}
+
+static int tracknum(const TagIndex::Track& t)
+{
+    return atoi(t.tags.tracknum.c_str());
+}
+
+void TagIndex::buildTables()
+{
+    // Albums are identified by title and folder, as the same title is
+    // often used for different albums.
+    vector<Album> tmpalbums;
+    unordered_map<string, int> albidx;
+    for (unsigned int i = 0; i < tracks.size(); i++) {
+        Track& t = tracks[i];
+        if (t.tags.album.empty()) {
+            continue;
+        }
+        string key = t.tags.album + '\0' + lltodecstr(t.folder);
+        auto it = albidx.find(key);
+        if (it == albidx.end()) {
+            Album alb;
+            alb.title = t.tags.album;
+            alb.folder = t.folder;
+            tmpalbums.push_back(alb);
+            it = albidx.insert(
+                pair<string,int>(key, tmpalbums.size() - 1)).first;
+        }
+        Album& alb = tmpalbums[it->second];
+        if (alb.artist.empty()) {
+            alb.artist = t.tags.albumartist.empty() ? t.tags.artist :
+                t.tags.albumartist;
+        }
+        alb.tracks.push_back(i);
+    }
+
+    // Sort the albums by title, and set the track album indexes.
+    vector<int> order(tmpalbums.size());
+    for (unsigned int i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&tmpalbums](int a, int b) {
+            return stringicmp(tmpalbums[a].title, tmpalbums[b].title) < 0;});
+    albums.clear();
+    albums.reserve(tmpalbums.size());
+    for (auto idx : order) {
+        albums.push_back(std::move(tmpalbums[idx]));
+        Album& alb = albums.back();
+        const vector<Track>& trks = tracks;
+        sort(alb.tracks.begin(), alb.tracks.end(), [&trks](int a, int b) {
+                int na = tracknum(trks[a]), nb = tracknum(trks[b]);
+                return na != nb ? na < nb : trks[a].path < trks[b].path;});
+        for (auto t : alb.tracks) {
+            tracks[t].album = albums.size() - 1;
+        }
+    }
+
+    // Tag value tables
+    for (int tt = 0; tt < TTCount; tt++) {
+        vector<TagValue>& table = tagtables[tt];
+        table.clear();
+        unordered_map<string, int> validx;
+        for (unsigned int i = 0; i < tracks.size(); i++) {
+            const AudioTags& tags = tracks[i].tags;
+            const string *value = nullptr;
+            switch (tt) {
+            case TTArtist:
+                value = tags.artist.empty() ? &tags.albumartist : &tags.artist;
+                break;
+            case TTGenre: value = &tags.genre; break;
+            case TTComposer: value = &tags.composer; break;
+            }
+            if (value == nullptr || value->empty()) {
+                continue;
+            }
+            auto it = validx.find(*value);
+            if (it == validx.end()) {
+                TagValue tv;
+                tv.value = *value;
+                table.push_back(tv);
+                it = validx.insert(
+                    pair<string,int>(*value, table.size() - 1)).first;
+            }
+            TagValue& tv = table[it->second];
+            tv.tracks.push_back(i);
+            if (tracks[i].album >= 0) {
+                tv.albums.push_back(tracks[i].album);
+            }
+        }
+        for (auto& tv : table) {
+            sort(tv.albums.begin(), tv.albums.end());
+            tv.albums.erase(unique(tv.albums.begin(), tv.albums.end()),
+                            tv.albums.end());
+        }
+        sort(table.begin(), table.end(), [](const TagValue& a,
+                                            const TagValue& b) {
+                 return stringicmp(a.value, b.value) < 0;});
+    }
+}
+
+bool TagIndex::update()
+{
+    auto start = chrono::steady_clock::now();
+
+    vector<Track> stored;
+    load(stored);
+    m_storedidx.clear();
+    for (unsigned int i = 0; i < stored.size(); i++) {
+        m_storedidx[stored[i].path] = i;
+    }
+
+    tracks.clear();
+    albums.clear();
+    folders.clear();
+    m_visited.clear();
+    m_dirty = false;
+    folders.push_back(Folder());
+    int reused = 0;
+    for (const auto& topdir : m_topdirs) {
+        Folder fld;
+        fld.name = topdir;
+        fld.parent = 0;
+        folders.push_back(fld);
+        folders[0].subdirs.push_back(folders.size() - 1);
+        walk(topdir, folders.size() - 1, stored, reused);
+    }
+    if (reused != int(stored.size())) {
+        // Some files were deleted
+        m_dirty = true;
+    }
+    m_storedidx.clear();
+    m_visited.clear();
+
+    buildTables();
+
+    auto ms = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - start).count();
+    LOGINF("TagIndex::update: " << tracks.size() << " tracks (" <<
+           tracks.size() - reused << " new or modified), " << albums.size() <<
+           " albums, " << folders.size() << " folders, in " << ms << " ms\n");
+
+    if (m_dirty) {
+        return save();
+    }
+    return true;
+}
@@ -0,0 +1,109 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _TAGINDEX_H_INCLUDED_
+#define _TAGINDEX_H_INCLUDED_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+
+#include "audiotags.hxx"
+
+// Local music library index, used by the native uprcl plugin.
+//
+// The track records (path, mtime, size, tags) are stored in a flat
+// file under the cache directory. On startup, we load it, then walk
+// the media directories and only read the tags for new or modified
+// files (based on mtime and size). The browsing tables (folders,
+// albums, tag values) are rebuilt in memory from the records, which
+// is fast compared to the file system walk.
+class TagIndex {
+public:
+    class Track {
+    public:
+        std::string path;
+        int64_t mtime{0};
+        int64_t size{0};
+        std::string mime;
+        AudioTags tags;
+        // Set by the table build
+        int album{-1};
+        int folder{-1};
+    };
+    class Album {
+    public:
+        std::string title;
+        std::string artist;
+        int folder{-1};
+        // Sorted by track number
+        std::vector<int> tracks;
+    };
+    class Folder {
+    public:
+        // Simple name, except for the top directories (full path)
+        std::string name;
+        int parent{0};
+        std::vector<int> subdirs;
+        std::vector<int> tracks;
+        // Cover art file name, or empty
+        std::string artname;
+    };
+    // Distinct value for a tag (e.g. one artist), with the albums and
+    // tracks which have it.
+    class TagValue {
+    public:
+        std::string value;
+        std::vector<int> albums;
+        std::vector<int> tracks;
+    };
+    enum TagTable {TTArtist, TTGenre, TTComposer, TTCount};
+
+    TagIndex(const std::string& dbpath, const std::vector<std::string>& topdirs);
+
+    /// Load the stored data, walk the media directories to update it,
+    /// and build the browsing tables. Saves the index if anything
+    /// changed.
+    bool update();
+
+    static const std::string& tagTableName(TagTable tt);
+
+    std::vector<Track> tracks;
+    std::vector<Album> albums;
+    // folders[0] is a virtual root, with the top directories as children.
+    std::vector<Folder> folders;
+    std::vector<TagValue> tagtables[TTCount];
+
+private:
+    bool load(std::vector<Track>& stored);
+    bool save();
+    void walk(const std::string& path, int folder,
+              std::vector<Track>& stored, int& reused);
+    void buildTables();
+
+    std::string m_dbpath;
+    std::vector<std::string> m_topdirs;
+    // Stored path -> index in stored vector
+    std::unordered_map<std::string, int> m_storedidx;
+    // Visited directories (dev, ino), to avoid symlink loops
+    std::set<std::pair<uint64_t, uint64_t> > m_visited;
+    bool m_dirty{false};
+};
+
+#endif /* _TAGINDEX_H_INCLUDED_ */
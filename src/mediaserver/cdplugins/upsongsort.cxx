@@ -0,0 +1,156 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "upsongsort.hxx"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "libupnpp/log.hxx"
+#include "smallut.h"
+
+using namespace std;
+
+static const struct {
+    const char *prop;
+    int field;
+} o_props[] = {
+    {"dc:title", 0},
+    {"upnp:artist", 1},
+    {"dc:creator", 1},
+    {"upnp:album", 2},
+    {"upnp:originalTrackNumber", 3},
+    {"upnp:genre", 4},
+};
+
+const string& UpSongSorter::capabilities()
+{
+    static string caps;
+    if (caps.empty()) {
+        for (const auto& prop : o_props) {
+            caps += string(caps.empty() ? "" : ",") + prop.prop;
+        }
+    }
+    return caps;
+}
+
+UpSongSorter::UpSongSorter(const vector<string>& sortcrits)
+{
+    for (const auto& crit : sortcrits) {
+        if (crit.empty()) {
+            continue;
+        }
+        bool ascending = true;
+        string prop(crit);
+        if (crit[0] == '+' || crit[0] == '-') {
+            ascending = crit[0] == '+';
+            prop = crit.substr(1);
+        }
+        bool found = false;
+        for (const auto& p : o_props) {
+            if (!prop.compare(p.prop)) {
+                m_crits.push_back(Crit{Field(p.field), ascending});
+                m_key += string(ascending ? "+" : "-") + p.prop;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            LOGDEB("UpSongSorter: ignoring unsupported criterion " << crit <<
+                   endl);
+        }
+    }
+}
+
+// Compute a collation key for the value, using the environment
+// locale (LC_COLLATE/LANG), without changing the process locale. If
+// this is the C locale, this amounts to a case-insensitive byte
+// comparison.
+static string collkey(const string& value)
+{
+    static locale_t loc = newlocale(LC_COLLATE_MASK, "", (locale_t)0);
+    string lower = stringtolower(value);
+    if (loc == (locale_t)0) {
+        return lower;
+    }
+    size_t len = strxfrm_l(nullptr, lower.c_str(), 0, loc);
+    string key(len + 1, '\0');
+    strxfrm_l(&key[0], lower.c_str(), len + 1, loc);
+    key.resize(len);
+    return key;
+}
+
+void UpSongSorter::sort(vector<UpSong>& songs) const
+{
+    size_t nc = m_crits.size();
+    size_t n = songs.size();
+    if (nc == 0 || n < 2) {
+        return;
+    }
+
+    // One flat key table: keys[i * nc + c] is the key for entry i and
+    // criterion c.
+    vector<string> keys(n * nc);
+    for (size_t i = 0; i < n; i++) {
+        const UpSong& song = songs[i];
+        for (size_t c = 0; c < nc; c++) {
+            string& key = keys[i * nc + c];
+            switch (m_crits[c].field) {
+            case SFTitle: key = collkey(song.title); break;
+            case SFArtist: key = collkey(song.artist); break;
+            case SFAlbum: key = collkey(song.album); break;
+            case SFGenre: key = collkey(song.genre); break;
+            case SFTrackNum:
+            {
+                // Numeric: zero-pad so that byte order is numeric order
+                char buf[30];
+                snprintf(buf, sizeof(buf), "%010d",
+                         abs(atoi(song.tracknum.c_str())));
+                key = buf;
+            }
+            break;
+            }
+        }
+    }
+
+    vector<int> order(n);
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    const vector<Crit>& crits = m_crits;
+    stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            for (size_t c = 0; c < nc; c++) {
+                int r = keys[a * nc + c].compare(keys[b * nc + c]);
+                if (r != 0) {
+                    return crits[c].ascending ? r < 0 : r > 0;
+                }
+            }
+            return false;
+        });
+
+    vector<UpSong> sorted;
+    sorted.reserve(n);
+    for (auto idx : order) {
+        sorted.push_back(std::move(songs[idx]));
+    }
+    songs.swap(sorted);
+}
@@ -0,0 +1,60 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _UPSONGSORT_H_INCLUDED_
+#define _UPSONGSORT_H_INCLUDED_
+
+#include <string>
+#include <vector>
+
+#include "upmpdutils.hxx"
+
+/// Server-side sorting of Browse/Search results, according to the
+/// UPnP SortCriteria (e.g. "+upnp:artist,-dc:title").
+///
+/// The collation keys are computed once for each entry when sorting,
+/// using the locale from the environment, and the entries are then
+/// moved in place. Unsupported properties are ignored.
+class UpSongSorter {
+public:
+    UpSongSorter(const std::vector<std::string>& sortcrits);
+
+    /// True if no usable criterion was found: nothing to do.
+    bool empty() const {
+        return m_crits.empty();
+    }
+    /// Canonical form of the criteria, for use in cache keys. Empty if
+    /// empty() is true.
+    const std::string& key() const {
+        return m_key;
+    }
+    /// Stable sort of the entries.
+    void sort(std::vector<UpSong>& songs) const;
+
+    /// Value for GetSortCapabilities
+    static const std::string& capabilities();
+
+private:
+    enum Field {SFTitle, SFArtist, SFAlbum, SFTrackNum, SFGenre};
+    struct Crit {
+        Field field;
+        bool ascending;
+    };
+    std::vector<Crit> m_crits;
+    std::string m_key;
+};
+
+#endif /* _UPSONGSORT_H_INCLUDED_ */
@@ -19,9 +19,16 @@
 
 #include <upnp/upnp.h>
 
+#include <time.h>
+
+#include <chrono>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <utility>
 #include <unordered_map>
 #include <sstream>
@@ -34,19 +41,35 @@
 #include "smallut.h"
 #include "upmpdutils.hxx"
 #include "main.hxx"
+#include "cdplugins/plguprcl.hxx"
 #include "cdplugins/plgwithslave.hxx"
+#include "cdplugins/upsongsort.hxx"
 #include "conftree.h"
+#include "metrics.hxx"
+#include "trace.hxx"
 
 using namespace std;
 using namespace std::placeholders;
 using namespace UPnPProvider;
 
+// Use the native local media library instead of the Python/Recoll
+// uprcl module ?
+static bool uprclnative()
+{
+    string value;
+    return g_config->get("uprclnative", value) && atoi(value.c_str()) != 0;
+}
+
+class RootSearchState;
+
 class ContentDirectory::Internal {
 public:
     Internal (ContentDirectory *sv)
 	: service(sv), updateID("1") {
     }
     ~Internal() {
+	// The late root search threads use the plugins
+	reapSearchThreads(true);
 	for (auto& it : plugins) {
 	    delete it.second;
 	}
@@ -68,6 +91,9 @@ public:
             port = usport;
 	    LOGDEB("ContentDirectory: host "<< host<< " port " << port << endl);
 	}
+        if (!appname.compare("uprcl") && uprclnative()) {
+            return new PlgUprcl(appname, service);
+        }
         return new PlgWithSlave(appname, service);
     }
     CDPlugin *pluginForApp(const string& appname) {
@@ -82,7 +108,18 @@ public:
 	    return plug;
 	}
     }
+    size_t rootSearch(const string& searchstr, const vector<string>& sortcrits,
+                      int stidx, int cnt, vector<UpSong>& entries);
+    void reapSearchThreads(bool all);
+    void warmup();
+
     unordered_map<string, CDPlugin *> plugins;
+    // Merged root search results, with creation time.
+    unordered_map<string, pair<time_t, vector<UpSong> > > rootsearchcache;
+    std::mutex rootsearchmutex;
+    // Root search threads which did not answer before the deadline,
+    // with their search state. Protected by rootsearchmutex.
+    vector<pair<shared_ptr<RootSearchState>, std::thread> > latesearches;
     ContentDirectory *service;
     string host;
     int port;
@@ -98,21 +135,25 @@ ContentDirectory::ContentDirectory(UPnPProvider::UpnpDevice *dev)
     : UpnpService(sTpContentDirectory, sIdContentDirectory, dev),
       m(new Internal(this))
 {
-    dev->addActionMapping(
-        this, "GetSearchCapabilities",
+    metricsAddAction(
+        dev, this, "GetSearchCapabilities",
         bind(&ContentDirectory::actGetSearchCapabilities, this, _1, _2));
-    dev->addActionMapping(
-        this, "GetSortCapabilities",
+    metricsAddAction(
+        dev, this, "GetSortCapabilities",
         bind(&ContentDirectory::actGetSortCapabilities, this, _1, _2));
-    dev->addActionMapping(
-        this, "GetSystemUpdateID",
+    metricsAddAction(
+        dev, this, "GetSystemUpdateID",
         bind(&ContentDirectory::actGetSystemUpdateID, this, _1, _2));
-    dev->addActionMapping(
-        this, "Browse",
+    metricsAddAction(
+        dev, this, "Browse",
         bind(&ContentDirectory::actBrowse, this, _1, _2));
-    dev->addActionMapping(
-        this, "Search",
+    metricsAddAction(
+        dev, this, "Search",
         bind(&ContentDirectory::actSearch, this, _1, _2));
+    string value;
+    if (g_config->get("plgwarmup", value) && atoi(value.c_str()) != 0) {
+        m->warmup();
+    }
 }
 
 ContentDirectory::~ContentDirectory()
@@ -134,7 +175,7 @@ int ContentDirectory::actGetSortCapabilities(const SoapIncoming& sc, SoapOutgoin
 {
     LOGDEB("ContentDirectory::actGetSortCapabilities: " << endl);
 
-    std::string out_SortCaps;
+    std::string out_SortCaps(UpSongSorter::capabilities());
     data.addarg("SortCaps", out_SortCaps);
     return UPNP_E_SUCCESS;
 }
@@ -152,17 +193,22 @@ static vector<UpSong> rootdir;
 static bool makerootdir()
 {
     rootdir.clear();
+    bool native = uprclnative();
+    if (native) {
+        rootdir.push_back(UpSong::container("0$uprcl$", "0", "Uprcl"));
+    }
     string pathplg = path_cat(g_datadir, "cdplugins");
     string reason;
     set<string> entries;
     if (!readdir(pathplg, reason, entries)) {
         LOGERR("ContentDirectory::makerootdir: can't read " << pathplg <<
                " : " << reason << endl);
-        return false;
+        return native;
     }
 
     for (const auto& entry : entries) {
-        if (!entry.compare("pycommon")) {
+        if (!entry.compare("pycommon") ||
+            (native && !entry.compare("uprcl"))) {
             continue;
         }
         // We compute the title from the plugin name. Maybe it would
@@ -234,12 +280,187 @@ static string appForId(const string& id)
     return id.substr(dol0 + 1, dol1 - dol0 -1);
 }
 
-// Really preposterous: bubble (and maybe others) searches in root,
-// but we can't do this. So memorize the last browsed object ID and
-// use this as a replacement when root search is requested. Forget
-// about multiaccess, god forbid multithreading etc. Will work in most
-// cases though :)
-static string last_objid;
+// Create all the configured plugins, and let them start their
+// initialization in the background (the plugins start their own
+// threads).
+void ContentDirectory::Internal::warmup()
+{
+    if (rootdir.empty()) {
+        makerootdir();
+    }
+    for (const auto& ent : rootdir) {
+        if (!ent.iscontainer) {
+            continue;
+        }
+        CDPlugin *plg = pluginForApp(appForId(ent.id));
+        if (plg) {
+            LOGDEB("ContentDirectory: warming up " << plg->getname() << endl);
+            plg->warmup();
+        }
+    }
+}
+
+// Search in root (e.g. from bubble): we run the search on all the
+// plugins in parallel, and merge the results in root directory
+// order. A plugin which does not answer before the deadline is left
+// out (its thread completes in the background, the result is dropped,
+// and the thread is joined later). The merged results are cached for
+// paging, if all the plugins answered. The concurrent calls to a
+// plugin are serialized by the plugin itself.
+static const int o_rootsearchtimeoutsecs = 10;
+static const int o_rootsearchretentionsecs = 300;
+
+class RootSearchState {
+public:
+    RootSearchState(int n)
+        : pending(n), results(n), done(n, false) {
+    }
+    std::mutex mtx;
+    std::condition_variable cv;
+    int pending;
+    vector<vector<UpSong> > results;
+    vector<bool> done;
+};
+
+// Join the late search threads which are done, or all of them. Called
+// with rootsearchmutex held, or from the destructor.
+void ContentDirectory::Internal::reapSearchThreads(bool all)
+{
+    for (auto it = latesearches.begin(); it != latesearches.end(); ) {
+        bool finished = all;
+        if (!finished) {
+            std::unique_lock<std::mutex> slock(it->first->mtx);
+            finished = it->first->pending == 0;
+        }
+        if (finished) {
+            it->second.join();
+            it = latesearches.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+// Errors are returned by the plugins as a single informative entry
+static bool isErrorEntry(const UpSong& song)
+{
+    static const string bogus("$bogus");
+    return song.id.size() >= bogus.size() &&
+        !song.id.compare(song.id.size() - bogus.size(), bogus.size(), bogus);
+}
+
+size_t ContentDirectory::Internal::rootSearch(
+    const string& searchstr, const vector<string>& sortcrits,
+    int stidx, int cnt, vector<UpSong>& entries)
+{
+    UpSongSorter sorter(sortcrits);
+    string cachekey(searchstr + ":" + sorter.key());
+    time_t now = time(0);
+
+    std::unique_lock<std::mutex> lock(rootsearchmutex);
+    reapSearchThreads(false);
+    for (auto it = rootsearchcache.begin(); it != rootsearchcache.end(); ) {
+        if (now - it->second.first > o_rootsearchretentionsecs) {
+            it = rootsearchcache.erase(it);
+        } else {
+            it++;
+        }
+    }
+    // Results for this call if they can't be cached
+    vector<UpSong> uncached;
+    const vector<UpSong> *resp = &uncached;
+    auto it = rootsearchcache.find(cachekey);
+    if (it != rootsearchcache.end()) {
+        resp = &it->second.second;
+    } else {
+        // Don't hold the cache lock during the search
+        lock.unlock();
+        if (rootdir.empty()) {
+            makerootdir();
+        }
+        // Create the plugins in this thread, the map is not protected.
+        vector<pair<string, CDPlugin*> > plgs;
+        for (const auto& ent : rootdir) {
+            if (!ent.iscontainer) {
+                continue;
+            }
+            CDPlugin *plg = pluginForApp(appForId(ent.id));
+            if (plg) {
+                plgs.push_back(pair<string, CDPlugin*>(ent.id, plg));
+            }
+        }
+
+        auto state = std::make_shared<RootSearchState>(plgs.size());
+        vector<std::thread> threads;
+        for (unsigned int i = 0; i < plgs.size(); i++) {
+            threads.push_back(
+                std::thread([state, i, plgs, searchstr, sortcrits]() {
+                        vector<UpSong> res;
+                        plgs[i].second->search(plgs[i].first, 0, 0, searchstr,
+                                               res, sortcrits);
+                        std::unique_lock<std::mutex> slock(state->mtx);
+                        state->results[i].swap(res);
+                        state->done[i] = true;
+                        state->pending--;
+                        state->cv.notify_all();
+                    }));
+        }
+        std::unique_lock<std::mutex> slock(state->mtx);
+        state->cv.wait_for(slock,
+                           std::chrono::seconds(o_rootsearchtimeoutsecs),
+                           [&state]() {return state->pending == 0;});
+
+        bool complete = true;
+        vector<UpSong> merged;
+        vector<bool> done(state->done);
+        for (unsigned int i = 0; i < plgs.size(); i++) {
+            if (!done[i]) {
+                LOGERR("ContentDirectory::rootSearch: no answer from " <<
+                       plgs[i].first << " before deadline\n");
+                complete = false;
+                continue;
+            }
+            for (auto& song : state->results[i]) {
+                if (isErrorEntry(song)) {
+                    LOGERR("ContentDirectory::rootSearch: search failed for "
+                           << plgs[i].first << endl);
+                    complete = false;
+                    continue;
+                }
+                merged.push_back(std::move(song));
+            }
+        }
+        slock.unlock();
+        // The plugins sorted their own results, we need a global order
+        sorter.sort(merged);
+        lock.lock();
+        for (unsigned int i = 0; i < plgs.size(); i++) {
+            if (done[i]) {
+                threads[i].join();
+            } else {
+                latesearches.push_back(
+                    make_pair(state, std::move(threads[i])));
+            }
+        }
+        if (complete) {
+            auto& ent = rootsearchcache[cachekey];
+            ent.first = now;
+            ent.second.swap(merged);
+            resp = &ent.second;
+        } else {
+            uncached.swap(merged);
+        }
+    }
+
+    const vector<UpSong>& res = *resp;
+    if (cnt <= 0) {
+        cnt = res.size();
+    }
+    for (int i = max(stidx, 0); i < int(res.size()) && i < stidx + cnt; i++) {
+        entries.push_back(res[i]);
+    }
+    return res.size();
+}
 
 int ContentDirectory::actBrowse(const SoapIncoming& sc, SoapOutgoing& data)
 {
@@ -250,6 +471,7 @@ int ContentDirectory::actBrowse(const SoapIncoming& sc, SoapOutgoing& data)
         LOGERR("ContentDirectory::actBrowse: no ObjectID in params\n");
         return UPNP_E_INVALID_PARAM;
     }
+    TraceSpan span("ContentDirectory::actBrowse", in_ObjectID);
     std::string in_BrowseFlag;
     ok = sc.get("BrowseFlag", &in_BrowseFlag);
     if (!ok) {
@@ -287,10 +509,9 @@ int ContentDirectory::actBrowse(const SoapIncoming& sc, SoapOutgoing& data)
 	   " RequestedCount " << in_RequestedCount <<
 	   " SortCriteria " << in_SortCriteria << endl);
 
-    last_objid = in_ObjectID;
-    
+    // SortCriteria is a CSV list, e.g. "+upnp:artist,-dc:title"
     vector<string> sortcrits;
-    stringToStrings(in_SortCriteria, sortcrits);
+    stringToTokens(in_SortCriteria, sortcrits, ", ");
 
     CDPlugin::BrowseFlag bf;
     if (!in_BrowseFlag.compare("BrowseMetadata")) {
@@ -328,8 +549,9 @@ int ContentDirectory::actBrowse(const SoapIncoming& sc, SoapOutgoing& data)
     out_TotalMatches = ulltodecstr(totalmatches);
     out_UpdateID = m->updateID;
     out_Result = headDIDL();
+    unsigned int props = didlFilterMask(in_Filter);
     for (unsigned int i = 0; i < entries.size(); i++) {
-	out_Result += entries[i].didl();
+	out_Result += entries[i].didl(props);
     } 
     out_Result += tailDIDL();
     LOGDEB1("ContentDirectory::Browse: didl: " << out_Result << endl);
@@ -389,8 +611,9 @@ int ContentDirectory::actSearch(const SoapIncoming& sc, SoapOutgoing& data)
 	   " RequestedCount " << in_RequestedCount <<
 	   " SortCriteria " << in_SortCriteria << endl);
 
+    // SortCriteria is a CSV list, e.g. "+upnp:artist,-dc:title"
     vector<string> sortcrits;
-    stringToStrings(in_SortCriteria, sortcrits);
+    stringToTokens(in_SortCriteria, sortcrits, ", ");
 
     std::string out_Result;
     std::string out_NumberReturned = "0";
@@ -401,24 +624,22 @@ int ContentDirectory::actSearch(const SoapIncoming& sc, SoapOutgoing& data)
     vector<UpSong> entries;
     size_t totalmatches = 0;
     if (!in_ContainerID.compare("0")) {
-	// Root directory: can't search in there: we don't know what
-	// plugin to pass the search to. Substitute last browsed. Yes
-	// it does break in multiuser mode, and yes it's preposterous.
-	LOGERR("ContentDirectory::actSearch: Can't search in root. "
-               "Substituting last browsed container\n");
-        in_ContainerID = last_objid;
-    }
-
-    // Pass off request to appropriate app, defined by 1st elt in id
-    string app = appForId(in_ContainerID);
-    CDPlugin *plg = m->pluginForApp(app);
-    if (plg) {
-        totalmatches = plg->search(in_ContainerID, in_StartingIndex,
-                                   in_RequestedCount, in_SearchCriteria,
-                                   entries, sortcrits);
+        // Root directory: search all the plugins.
+        totalmatches = m->rootSearch(in_SearchCriteria, sortcrits,
+                                     in_StartingIndex, in_RequestedCount,
+                                     entries);
     } else {
-        LOGERR("ContentDirectory::Search: unknown app: [" << app << "]\n");
-        return UPNP_E_INVALID_PARAM;
+        // Pass off request to appropriate app, defined by 1st elt in id
+        string app = appForId(in_ContainerID);
+        CDPlugin *plg = m->pluginForApp(app);
+        if (plg) {
+            totalmatches = plg->search(in_ContainerID, in_StartingIndex,
+                                       in_RequestedCount, in_SearchCriteria,
+                                       entries, sortcrits);
+        } else {
+            LOGERR("ContentDirectory::Search: unknown app: [" << app << "]\n");
+            return UPNP_E_INVALID_PARAM;
+        }
     }
 
     // Process and send out result
@@ -426,8 +647,9 @@ int ContentDirectory::actSearch(const SoapIncoming& sc, SoapOutgoing& data)
     out_TotalMatches = ulltodecstr(totalmatches);
     out_UpdateID = m->updateID;
     out_Result = headDIDL();
+    unsigned int props = didlFilterMask(in_Filter);
     for (unsigned int i = 0; i < entries.size(); i++) {
-	out_Result += entries[i].didl();
+	out_Result += entries[i].didl(props);
     } 
     out_Result += tailDIDL();
     
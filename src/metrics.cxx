@@ -0,0 +1,217 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "metrics.hxx"
+
+#include <stdio.h>
+#include <string.h>
+#include <upnp/upnp.h>
+#include <microhttpd.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "libupnpp/log.hxx"
+#include "trace.hxx"
+
+using namespace std;
+using namespace UPnPProvider;
+
+// Registered metrics: family name -> label set -> object. The lock
+// is only taken for registration and export.
+static mutex o_lock;
+static map<string, map<string, unique_ptr<MetricsHistogram> > > o_hists;
+static map<string, map<string, unique_ptr<MetricsCounter> > > o_counters;
+
+MetricsHistogram *metricsHistogram(const string& name, const string& labels)
+{
+    lock_guard<mutex> lock(o_lock);
+    unique_ptr<MetricsHistogram>& hist = o_hists[name][labels];
+    if (!hist) {
+        hist = unique_ptr<MetricsHistogram>(new MetricsHistogram);
+    }
+    return hist.get();
+}
+
+MetricsCounter *metricsCounter(const string& name, const string& labels)
+{
+    lock_guard<mutex> lock(o_lock);
+    unique_ptr<MetricsCounter>& counter = o_counters[name][labels];
+    if (!counter) {
+        counter = unique_ptr<MetricsCounter>(new MetricsCounter);
+    }
+    return counter.get();
+}
+
+// Use the last element of the service id as label, e.g. AVTransport
+static string servicelabel(const string& sid)
+{
+    string::size_type colon = sid.find_last_of(':');
+    return "service=\"" +
+        (colon == string::npos ? sid : sid.substr(colon + 1)) + "\"";
+}
+
+MetricsHistogram *metricsEventHistogram(const string& serviceid)
+{
+    return metricsHistogram("upmpdcli_event_generation_seconds",
+                            servicelabel(serviceid));
+}
+
+// Actions which control points send in series to read or edit the
+// queues or browse the directory.
+static const set<string> o_bulkactions{
+    "Browse", "DeleteId", "IdArray", "IdArrayChanged", "Insert", "Read",
+    "ReadList", "Search"};
+
+static thread_local bool o_inbulk;
+
+bool inBulkAction()
+{
+    return o_inbulk;
+}
+
+void metricsAddAction(UpnpDevice *dev, const UpnpService *svc,
+                      const string& action, soapfun fun)
+{
+    string labels =
+        servicelabel(svc->getServiceId()) + ",action=\"" + action + "\"";
+    MetricsHistogram *hist =
+        metricsHistogram("upmpdcli_soap_action_seconds", labels);
+    MetricsCounter *errors =
+        metricsCounter("upmpdcli_soap_action_errors_total", labels);
+    // Trace span name. Lives in the closure, as long as the mapping.
+    string spanname = "action:" + action;
+    bool bulk = o_bulkactions.find(action) != o_bulkactions.end();
+    dev->addActionMapping(
+        svc, action,
+        [hist, errors, fun, spanname, bulk](const UPnPP::SoapIncoming& sc,
+                                            UPnPP::SoapOutgoing& data) -> int {
+            TraceSpan span(spanname.c_str());
+            MetricsTimer timer(hist);
+            o_inbulk = bulk;
+            int ret = fun(sc, data);
+            o_inbulk = false;
+            if (ret != UPNP_E_SUCCESS) {
+                errors->inc();
+            }
+            return ret;
+        });
+}
+
+string metricsText()
+{
+    string out;
+    char buf[100];
+    lock_guard<mutex> lock(o_lock);
+    for (const auto& family : o_hists) {
+        const string& name = family.first;
+        out += "# TYPE " + name + " histogram\n";
+        for (const auto& ent : family.second) {
+            const MetricsHistogram *hist = ent.second.get();
+            string sep = ent.first.empty() ? "" : ",";
+            // Buckets are cumulative in the exposition format. The
+            // total count is the +Inf bucket value.
+            uint64_t cumul = 0;
+            for (int i = 0; i < MetricsHistogram::NBUCKETS; i++) {
+                cumul += hist->buckets[i].load(memory_order_relaxed);
+                if (i == MetricsHistogram::NBUCKETS - 1) {
+                    strcpy(buf, "+Inf");
+                } else {
+                    snprintf(buf, sizeof(buf), "%.9g",
+                             double(1ULL << (i + MetricsHistogram::MINSHIFT))
+                             / 1e6);
+                }
+                out += name + "_bucket{" + ent.first + sep + "le=\"" +
+                    buf + "\"} " + to_string(cumul) + "\n";
+            }
+            snprintf(buf, sizeof(buf), "%.6f",
+                     double(hist->sumus.load(memory_order_relaxed)) / 1e6);
+            string labels = ent.first.empty() ? "" : "{" + ent.first + "}";
+            out += name + "_sum" + labels + " " + buf + "\n";
+            out += name + "_count" + labels + " " + to_string(cumul) + "\n";
+        }
+    }
+    for (const auto& family : o_counters) {
+        const string& name = family.first;
+        out += "# TYPE " + name + " counter\n";
+        for (const auto& ent : family.second) {
+            string labels = ent.first.empty() ? "" : "{" + ent.first + "}";
+            out += name + labels + " " +
+                to_string(ent.second->value.load(memory_order_relaxed)) + "\n";
+        }
+    }
+    return out;
+}
+
+static int answer_to_connection(void *cls, struct MHD_Connection *connection,
+                                const char *url, const char *method,
+                                const char *version, const char *upload_data,
+                                size_t *upload_data_size, void **con_cls)
+{
+    static int aptr;
+    if (&aptr != *con_cls) {
+        /* do not respond on first call */
+        *con_cls = &aptr;
+        return MHD_YES;
+    }
+    LOGDEB1("metrics: answer_to_connection: " << method << " " << url << endl);
+    unsigned int status = MHD_HTTP_OK;
+    string data;
+    if (strcmp(method, MHD_HTTP_METHOD_GET) &&
+        strcmp(method, MHD_HTTP_METHOD_HEAD)) {
+        status = MHD_HTTP_METHOD_NOT_ALLOWED;
+    } else if (!strcmp(url, "/metrics") || !strcmp(url, "/")) {
+        data = metricsText();
+    } else if (!strcmp(url, "/trace")) {
+        data = traceDump();
+    } else {
+        status = MHD_HTTP_NOT_FOUND;
+    }
+    struct MHD_Response *response = MHD_create_response_from_buffer(
+        data.size(), (void*)data.c_str(), MHD_RESPMEM_MUST_COPY);
+    if (response == nullptr) {
+        LOGERR("metrics: MHD_create_response_from_buffer failed\n");
+        return MHD_NO;
+    }
+    MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE,
+                            strcmp(url, "/trace") ? "text/plain; version=0.0.4"
+                            : "application/json");
+    int ret = MHD_queue_response(connection, status, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+bool metricsStartHttp(int port)
+{
+    LOGDEB("metrics: starting httpd on port " << port << endl);
+    struct MHD_Daemon *mhd = MHD_start_daemon(
+        MHD_USE_SELECT_INTERNALLY, port,
+        /* Accept policy callback and arg */
+        nullptr, nullptr,
+        /* handler and arg */
+        &answer_to_connection, nullptr,
+        MHD_OPTION_CONNECTION_LIMIT, (unsigned int)8,
+        MHD_OPTION_CONNECTION_TIMEOUT, (unsigned int)30,
+        MHD_OPTION_END);
+    if (nullptr == mhd) {
+        LOGERR("metrics: MHD_start_daemon failed for port " << port << endl);
+        return false;
+    }
+    return true;
+}
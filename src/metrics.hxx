@@ -0,0 +1,122 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _METRICS_H_X_INCLUDED_
+#define _METRICS_H_X_INCLUDED_
+
+// Internal latency metrics, exported in Prometheus text format.
+//
+// Histograms and counters are created (registered) once, usually
+// through a function-local static pointer, and then updated with
+// relaxed atomic operations only: there is no locking on the
+// measurement paths, and nothing is computed until the export text is
+// requested.
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include "libupnpp/device/device.hxx"
+
+// Latency histogram with power of 2 bucket bounds, from 16 uS to
+// about 8 S, plus the +Inf bucket.
+class MetricsHistogram {
+public:
+    enum {NBUCKETS = 21, MINSHIFT = 4};
+    MetricsHistogram() : sumus(0) {
+        for (auto& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+    void record(uint64_t us) {
+        int idx = 0;
+        if (us > (1ULL << MINSHIFT)) {
+            // Bit length of (us-1): the smallest n such that us <= 2^n
+            idx = 64 - __builtin_clzll(us - 1) - MINSHIFT;
+            if (idx >= NBUCKETS) {
+                idx = NBUCKETS - 1;
+            }
+        }
+        buckets[idx].fetch_add(1, std::memory_order_relaxed);
+        sumus.fetch_add(us, std::memory_order_relaxed);
+    }
+    // Non-cumulative bucket counts
+    std::atomic<uint64_t> buckets[NBUCKETS];
+    std::atomic<uint64_t> sumus;
+};
+
+class MetricsCounter {
+public:
+    MetricsCounter() : value(0) {}
+    void inc() {
+        value.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::atomic<uint64_t> value;
+};
+
+// Return the histogram or counter for the metric family name and
+// label set (e.g.: 'action="Play"'), creating it if needed. The
+// returned object lives as long as the process. These take a lock:
+// callers should keep the pointer rather than calling them for each
+// measurement.
+extern MetricsHistogram *metricsHistogram(const std::string& name,
+                                          const std::string& labels);
+extern MetricsCounter *metricsCounter(const std::string& name,
+                                      const std::string& labels);
+
+// Measure the lifetime of the object.
+class MetricsTimer {
+public:
+    MetricsTimer(MetricsHistogram *hist)
+        : m_hist(hist), m_start(std::chrono::steady_clock::now()) {
+    }
+    ~MetricsTimer() {
+        m_hist->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - m_start).count());
+    }
+private:
+    MetricsHistogram *m_hist;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Register an action with the device, measuring its execution time
+// and counting errors. Use instead of dev->addActionMapping(svc,...)
+extern void metricsAddAction(UPnPProvider::UpnpDevice *dev,
+                             const UPnPProvider::UpnpService *svc,
+                             const std::string& action,
+                             UPnPProvider::soapfun fun);
+
+// Actions registered by metricsAddAction() are classified as
+// interactive (transport, volume, source...) or bulk (queue and
+// directory reading and editing, which control points send in long
+// series). While a bulk action executes, this returns true in the
+// executing thread. Used to merge the event loop wakeups of a series
+// of bulk actions (see UpMpd::loopWakeup()).
+extern bool inBulkAction();
+
+// Histogram for the state variables/event data computation time for
+// the service (getEventData()).
+extern MetricsHistogram *metricsEventHistogram(const std::string& serviceid);
+
+// Prometheus text exposition of all the registered metrics.
+extern std::string metricsText();
+
+// Start the HTTP server for the metrics on the given port. This
+// serves the metrics text at /metrics and the trace buffer (see
+// trace.hxx) at /trace.
+extern bool metricsStartHttp(int port);
+
+#endif /* _METRICS_H_X_INCLUDED_ */
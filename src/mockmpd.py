@@ -0,0 +1,395 @@
+#!/usr/bin/env python
+# Copyright (C) 2017 J.F.Dockes
+#   This program is free software; you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation; either version 2 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program; if not, write to the
+#   Free Software Foundation, Inc.,
+#   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+#
+# Minimal MPD protocol stand-in, for testing and benchmarking upmpdcli
+# without a real MPD. Only the commands used by upmpdcli (mpdcli.cxx)
+# are implemented. Nothing is actually played: the play position
+# advances with the wall clock while in "play" state.
+#
+# Usage: mockmpd.py [-p port] [-q queuelen] [-l latencyms]
+#   -q: preload the queue with this many synthetic tracks.
+#   -l: delay each command response by this many milliseconds.
+
+from __future__ import print_function
+
+import sys
+import time
+import getopt
+import shlex
+import threading
+try:
+    import socketserver
+except ImportError:
+    import SocketServer as socketserver
+
+PROTOVERSION = "0.19.0"
+
+# Tag names accepted by addtagid, and output order for song descriptions
+TAGS = ("Artist", "AlbumArtist", "Album", "Title", "Track", "Genre",
+        "Date", "Composer", "Performer", "Name")
+
+
+class Song(object):
+    def __init__(self, uri, id):
+        self.uri = uri
+        self.id = id
+        self.duration = 240.0
+        self.tags = {}
+        # Queue version when this song was last added or moved
+        self.version = 0
+
+
+class Player(object):
+    def __init__(self, queuelen):
+        self.lock = threading.Lock()
+        self.queue = []
+        self.nextid = 1
+        self.version = 1
+        self.volume = 50
+        self.flags = {"repeat": 0, "random": 0, "single": 0, "consume": 0}
+        self.state = "stop"
+        self.cur = -1
+        # Elapsed seconds at playstart, and wall clock time then
+        self.elapsed0 = 0.0
+        self.playstart = 0.0
+        for i in range(queuelen):
+            s = self._add("http://mock.invalid/track%d.flac" % i, -1)
+            s.tags = {"Title": "Track %d" % i, "Artist": "Artist %d" % (i % 50),
+                      "Album": "Album %d" % (i // 12), "Track": str(i % 12 + 1),
+                      "Genre": "Genre"}
+
+    def _touch(self, frompos):
+        self.version += 1
+        for s in self.queue[frompos:]:
+            s.version = self.version
+
+    def _add(self, uri, pos):
+        s = Song(uri, self.nextid)
+        self.nextid += 1
+        if pos < 0 or pos > len(self.queue):
+            pos = len(self.queue)
+        self.queue.insert(pos, s)
+        if self.cur >= pos:
+            self.cur += 1
+        self._touch(pos)
+        return s
+
+    def elapsed(self):
+        if self.state == "play":
+            return self.elapsed0 + time.time() - self.playstart
+        return self.elapsed0
+
+    def _setstate(self, state, pos=None, elapsed=0.0):
+        if pos is not None:
+            self.cur = pos
+        self.elapsed0 = elapsed
+        self.playstart = time.time()
+        self.state = state
+
+    def posforid(self, id):
+        for i, s in enumerate(self.queue):
+            if s.id == id:
+                return i
+        raise MpdError(50, "No such song")
+
+    def checkpos(self, pos):
+        if pos < 0 or pos >= len(self.queue):
+            raise MpdError(2, "Bad song index")
+        return pos
+
+
+class MpdError(Exception):
+    def __init__(self, code, msg):
+        Exception.__init__(self, msg)
+        self.code = code
+        self.msg = msg
+
+
+def songlines(s, pos):
+    out = ["file: %s" % s.uri, "Time: %d" % int(s.duration),
+           "duration: %.3f" % s.duration]
+    for t in TAGS:
+        if t in s.tags:
+            out.append("%s: %s" % (t, s.tags[t]))
+    out += ["Pos: %d" % pos, "Id: %d" % s.id]
+    return out
+
+
+def arg(args, i, default=None):
+    if i < len(args):
+        return args[i]
+    if default is None:
+        raise MpdError(2, "missing argument")
+    return default
+
+
+def execute(p, cmd, args):
+    """Execute one command with the player lock held. Returns a list of
+    response lines, not including the final OK"""
+    q = p.queue
+    if cmd in ("ping", "password", "clearerror"):
+        return []
+    if cmd == "commands":
+        return ["command: %s" % c for c in sorted(COMMANDS)]
+    if cmd == "status":
+        out = ["volume: %d" % p.volume]
+        for f in ("repeat", "random", "single", "consume"):
+            out.append("%s: %d" % (f, p.flags[f]))
+        out += ["playlist: %d" % p.version, "playlistlength: %d" % len(q),
+                "mixrampdb: 0.000000", "state: %s" % p.state]
+        if 0 <= p.cur < len(q):
+            s = q[p.cur]
+            out += ["song: %d" % p.cur, "songid: %d" % s.id]
+            if p.state != "stop":
+                el = p.elapsed()
+                out += ["time: %d:%d" % (int(el), int(s.duration)),
+                        "elapsed: %.3f" % el, "bitrate: 1411",
+                        "audio: 44100:16:2"]
+            if p.cur + 1 < len(q):
+                out += ["nextsong: %d" % (p.cur + 1),
+                        "nextsongid: %d" % q[p.cur + 1].id]
+        return out
+    if cmd == "currentsong":
+        if 0 <= p.cur < len(q):
+            return songlines(q[p.cur], p.cur)
+        return []
+    if cmd == "playlistinfo":
+        if args:
+            pos = p.checkpos(int(args[0].split(":")[0]))
+            return songlines(q[pos], pos)
+        out = []
+        for i, s in enumerate(q):
+            out += songlines(s, i)
+        return out
+    if cmd == "playlistid":
+        if args:
+            pos = p.posforid(int(args[0]))
+            return songlines(q[pos], pos)
+        return execute(p, "playlistinfo", [])
+    if cmd == "playlistfind":
+        if arg(args, 0) != "file":
+            raise MpdError(2, "only file searches are supported")
+        out = []
+        for i, s in enumerate(q):
+            if s.uri == arg(args, 1):
+                out += songlines(s, i)
+        return out
+    if cmd == "plchanges":
+        vers = int(arg(args, 0))
+        out = []
+        for i, s in enumerate(q):
+            if s.version > vers:
+                out += songlines(s, i)
+        return out
+    if cmd == "plchangesposid":
+        vers = int(arg(args, 0))
+        out = []
+        for i, s in enumerate(q):
+            if s.version > vers:
+                out += ["cpos: %d" % i, "Id: %d" % s.id]
+        return out
+    if cmd in ("add", "addid"):
+        s = p._add(arg(args, 0), int(arg(args, 1, "-1")))
+        return ["Id: %d" % s.id] if cmd == "addid" else []
+    if cmd == "addtagid":
+        pos = p.posforid(int(arg(args, 0)))
+        tag = arg(args, 1)
+        for t in TAGS:
+            if t.lower() == tag.lower():
+                tag = t
+        q[pos].tags[tag] = arg(args, 2)
+        p.version += 1
+        q[pos].version = p.version
+        return []
+    if cmd in ("deleteid", "delete"):
+        if cmd == "deleteid":
+            start = p.posforid(int(arg(args, 0)))
+            end = start + 1
+        else:
+            rng = arg(args, 0).split(":")
+            start = int(rng[0])
+            end = int(rng[1]) if len(rng) > 1 and rng[1] else start + 1
+            if start < 0 or end > len(q) or start >= end:
+                raise MpdError(2, "Bad song index")
+        if start <= p.cur < end:
+            p._setstate("stop", -1)
+        elif p.cur >= end:
+            p.cur -= end - start
+        del q[start:end]
+        p._touch(start)
+        return []
+    if cmd == "clear":
+        del q[:]
+        p._setstate("stop", -1)
+        p._touch(0)
+        return []
+    if cmd in ("play", "playid"):
+        if args:
+            pos = p.checkpos(int(args[0])) if cmd == "play" else \
+                p.posforid(int(args[0]))
+        else:
+            pos = p.cur if p.cur >= 0 else 0
+            if not q:
+                return []
+        p._setstate("play", pos)
+        return []
+    if cmd == "stop":
+        p._setstate("stop")
+        return []
+    if cmd == "pause":
+        pause = int(arg(args, 0, "1" if p.state == "play" else "0"))
+        if pause and p.state == "play":
+            p._setstate("pause", elapsed=p.elapsed())
+        elif not pause and p.state == "pause":
+            p._setstate("play", elapsed=p.elapsed0)
+        return []
+    if cmd in ("next", "previous"):
+        pos = p.cur + (1 if cmd == "next" else -1)
+        if 0 <= pos < len(q):
+            p._setstate(p.state, pos)
+        else:
+            p._setstate("stop", -1)
+        return []
+    if cmd in ("seek", "seekid"):
+        pos = p.checkpos(int(arg(args, 0))) if cmd == "seek" else \
+            p.posforid(int(arg(args, 0)))
+        p._setstate("play" if p.state == "stop" else p.state, pos,
+                    float(arg(args, 1)))
+        return []
+    if cmd == "setvol":
+        p.volume = max(0, min(100, int(arg(args, 0))))
+        return []
+    if cmd in p.flags:
+        p.flags[cmd] = int(arg(args, 0))
+        return []
+    raise MpdError(5, "unknown command \"%s\"" % cmd)
+
+
+COMMANDS = ("add", "addid", "addtagid", "clear", "clearerror", "close",
+            "command_list_begin", "command_list_end",
+            "command_list_ok_begin", "commands", "consume", "currentsong",
+            "delete", "deleteid", "idle", "next", "noidle", "password",
+            "pause", "ping", "play", "playid", "playlistfind", "playlistid",
+            "playlistinfo", "plchanges", "plchangesposid", "previous",
+            "random", "repeat",
+            "seek", "seekid", "setvol", "single", "status", "stop")
+
+
+class Handler(socketserver.StreamRequestHandler):
+    def send(self, lines):
+        data = "".join([l + "\n" for l in lines])
+        self.wfile.write(data.encode("utf-8"))
+        self.wfile.flush()
+
+    def handle(self):
+        player = self.server.player
+        latency = self.server.latency
+        self.send(["OK MPD " + PROTOVERSION])
+        cmdlist = None
+        listok = False
+        while True:
+            line = self.rfile.readline()
+            if not line:
+                return
+            line = line.decode("utf-8").rstrip("\n")
+            try:
+                words = shlex.split(line)
+            except ValueError:
+                self.send(["ACK [2@0] {} bad quoting"])
+                continue
+            if not words:
+                continue
+            cmd, args = words[0], words[1:]
+            if cmd == "close":
+                return
+            if cmd in ("command_list_begin", "command_list_ok_begin"):
+                cmdlist = []
+                listok = cmd == "command_list_ok_begin"
+                continue
+            if cmd == "idle":
+                # We never generate events. Wait for noidle.
+                continue
+            if cmd == "noidle":
+                self.send(["OK"])
+                continue
+            if cmdlist is not None and cmd != "command_list_end":
+                cmdlist.append((cmd, args))
+                continue
+            inlist = cmd == "command_list_end"
+            if inlist:
+                todo = cmdlist
+                cmdlist = None
+            else:
+                todo = [(cmd, args)]
+            if latency:
+                time.sleep(latency)
+            out = []
+            with player.lock:
+                for i, (c, a) in enumerate(todo):
+                    try:
+                        out += execute(player, c, a)
+                    except MpdError as e:
+                        out.append("ACK [%d@%d] {%s} %s" % (e.code, i, c, e.msg))
+                        break
+                    except (ValueError, IndexError) as e:
+                        out.append("ACK [2@%d] {%s} %s" % (i, c, e))
+                        break
+                    if listok and inlist:
+                        out.append("list_OK")
+                else:
+                    out.append("OK")
+            self.send(out)
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+def usage():
+    print("Usage: mockmpd.py [-p port] [-q queuelen] [-l latencyms]",
+          file=sys.stderr)
+    sys.exit(1)
+
+
+def main():
+    port = 6600
+    queuelen = 0
+    latency = 0.0
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "p:q:l:")
+    except getopt.GetoptError:
+        usage()
+    if args:
+        usage()
+    for o, a in opts:
+        if o == "-p":
+            port = int(a)
+        elif o == "-q":
+            queuelen = int(a)
+        elif o == "-l":
+            latency = float(a) / 1000.0
+    server = Server(("localhost", port), Handler)
+    server.player = Player(queuelen)
+    server.latency = latency
+    print("mockmpd: listening on port %d, queue length %d" % (port, queuelen),
+          file=sys.stderr)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -33,6 +33,9 @@
 #include "conftree.h"
 #include "execmd.h"
 #include "upmpdutils.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
+#include "confwatch.hxx"
 
 struct mpd_status;
 
@@ -44,8 +47,9 @@ using namespace UPnPP;
 MPDCli::MPDCli(const string& host, int port, const string& pass)
     : m_conn(0), m_ok(false), m_premutevolume(0), m_cachedvolume(50),
       m_host(host), m_port(port), m_password(pass),
-      m_externalvolumecontrol(false),
-      m_lastinsertid(-1), m_lastinsertpos(-1), m_lastinsertqvers(-1)
+      m_externalvolumecontrol(false), m_forceintvc(false), m_confgen(0),
+      m_lastinsertid(-1), m_lastinsertpos(-1), m_lastinsertqvers(-1),
+      m_songsqvers(-1), m_songspos(-1)
 {
     regcomp(&m_tpuexpr, "^[[:alpha:]]+://.+", REG_EXTENDED|REG_NOSUB);
     if (!openconn()) {
@@ -53,20 +57,9 @@ MPDCli::MPDCli(const string& host, int port, const string& pass)
     }
     m_have_addtagid = checkForCommand("addtagid");
 
-    std::unique_lock<std::mutex>(g_configlock);
-    g_config->get("onstart", m_onstart);
-    g_config->get("onplay", m_onplay);
-    g_config->get("onstop", m_onstop);
-    string scratch;
-    g_config->get("onvolumechange", scratch);
-    stringToStrings(scratch,  m_onvolumechange);
-    g_config->get("getexternalvolume", scratch);
-    stringToStrings(scratch, m_getexternalvolume);
-    
-    m_externalvolumecontrol = false;
-    string value;
-    if (g_config->get("externalvolumecontrol", value)) {
-        m_externalvolumecontrol = atoi(value.c_str()) != 0;
+    {
+        std::unique_lock<std::mutex> lock(g_configlock);
+        readConfig(g_config);
     }
 
     m_ok = true;
@@ -80,11 +73,42 @@ MPDCli::~MPDCli()
     regfree(&m_tpuexpr);
 }
 
+// Read the hook scripts and volume control parameters. Called from
+// the constructor, and from updStatus() when the configuration was
+// changed (see confwatch.hxx).
+void MPDCli::readConfig(ConfSimple *conf)
+{
+    m_onstart.clear();
+    m_onplay.clear();
+    m_onstop.clear();
+    m_onvolumechange.clear();
+    m_getexternalvolume.clear();
+    conf->get("onstart", m_onstart);
+    conf->get("onplay", m_onplay);
+    conf->get("onstop", m_onstop);
+    string scratch;
+    conf->get("onvolumechange", scratch);
+    stringToStrings(scratch,  m_onvolumechange);
+    scratch.clear();
+    conf->get("getexternalvolume", scratch);
+    stringToStrings(scratch, m_getexternalvolume);
+    
+    m_externalvolumecontrol = false;
+    string value;
+    if (conf->get("externalvolumecontrol", value)) {
+        m_externalvolumecontrol = atoi(value.c_str()) != 0;
+    }
+    if (m_forceintvc) {
+        forceInternalVControl();
+    }
+}
+
 // This is used on the auxiliary songcast mpd in a configuration where
 // volume is normally controlled by an external script, but we still
 // want to scale the Songcast stream.
 void MPDCli::forceInternalVControl()
 {
+    m_forceintvc = true;
     m_getexternalvolume.clear();
     if (m_externalvolumecontrol)
         m_onvolumechange.clear();
@@ -98,6 +122,7 @@ bool MPDCli::looksLikeTransportURI(const string& path)
 
 bool MPDCli::openconn()
 {
+    m_songsqvers = m_songspos = -1;
     if (m_conn) {
         mpd_connection_free(M_CONN);
         m_conn = 0;
@@ -155,7 +180,17 @@ bool MPDCli::showError(const string& who)
     return false;
 }
 
+// Per-method latency histogram and trace span for the MPD
+// requests. The histogram is looked up once for each call site.
+#define MPD_TIMER()                                                     \
+    TraceSpan mpdspan_(__func__);                                       \
+    static MetricsHistogram *mpdhist_ =                                 \
+        metricsHistogram("upmpdcli_mpd_request_seconds",                \
+                         string("call=\"") + __func__ + "\"");          \
+    MetricsTimer mpdtimer_(mpdhist_)
+
 #define RETRY_CMD(CMD) {                                \
+    MPD_TIMER();                                        \
     for (int i = 0; i < 2; i++) {                       \
         if ((CMD))                                      \
             break;                                      \
@@ -165,6 +200,7 @@ bool MPDCli::showError(const string& who)
     }
 
 #define RETRY_CMD_WITH_SLEEP(CMD) {                     \
+    MPD_TIMER();                                        \
     for (int i = 0; i < 2; i++) {                       \
         if ((CMD))                                      \
             break;                                      \
@@ -181,8 +217,20 @@ bool MPDCli::updStatus()
         return false;
     }
 
+    if (confWatchGeneration() != m_confgen) {
+        m_confgen = confWatchGeneration();
+        shared_ptr<ConfSimple> conf = confWatchConfig();
+        if (conf) {
+            LOGDEB("MPDCli::updStatus: rereading configuration\n");
+            readConfig(conf.get());
+        }
+    }
+
     mpd_status *mpds = 0;
-    mpds = mpd_run_status(M_CONN);
+    {
+        MPD_TIMER();
+        mpds = mpd_run_status(M_CONN);
+    }
     if (mpds == 0) {
         openconn();
         mpds = mpd_run_status(M_CONN);
@@ -195,6 +243,9 @@ bool MPDCli::updStatus()
 
     if (m_externalvolumecontrol && !m_getexternalvolume.empty()) {
         string result;
+        static MetricsHistogram *exechist =
+            metricsHistogram("upmpdcli_exec_seconds", "cmd=\"getvolume\"");
+        MetricsTimer timer(exechist);
         if (ExecCmd::backtick(m_getexternalvolume, result)) {
             //LOGDEB("MPDCli::volume retrieved: " << result << endl);
             m_stat.volume = atoi(result.c_str());
@@ -251,9 +302,13 @@ bool MPDCli::updStatus()
     m_stat.mixrampdelay = mpd_status_get_mixrampdelay(mpds);
     m_stat.songpos = mpd_status_get_song_pos(mpds);
     m_stat.songid = mpd_status_get_song_id(mpds);
-    if (m_stat.songpos >= 0) {
+    if (m_stat.songpos >= 0 &&
+        (m_stat.qvers != m_songsqvers || m_stat.songpos != m_songspos)) {
         string prevuri = m_stat.currentsong.uri;
-        statSong(m_stat.currentsong);
+        if (statSong(m_stat.currentsong)) {
+            m_songsqvers = m_stat.qvers;
+            m_songspos = m_stat.songpos;
+        }
         if (m_stat.currentsong.uri.compare(prevuri)) {
             m_stat.trackcounter++;
             m_stat.detailscounter = 0;
@@ -494,6 +549,9 @@ bool MPDCli::setVolume(int volume, bool isMute)
     	RETRY_CMD(mpd_run_set_volume(M_CONN, volume));
     }
     if (!m_onvolumechange.empty()) {
+        static MetricsHistogram *exechist = metricsHistogram(
+            "upmpdcli_exec_seconds", "cmd=\"onvolumechange\"");
+        MetricsTimer timer(exechist);
         ExecCmd ecmd;
         vector<string> args = m_onvolumechange;
         stringstream ss;
@@ -655,6 +713,7 @@ static const string upmpdcli_comment("client=upmpdcli;");
 bool MPDCli::send_tag_data(int id, const UpSong& meta)
 {
     LOGDEB1("MPDCli::send_tag_data" << endl);
+    TraceSpan span("MPDCli::send_tag_data");
     if (!m_have_addtagid)
         return false;
 
@@ -695,6 +754,7 @@ int MPDCli::insert(const string& uri, int pos, const UpSong& meta)
 int MPDCli::insertAfterId(const string& uri, int id, const UpSong& meta)
 {
     LOGDEB("MPDCli::insertAfterId: id " << id << " uri " << uri << endl);
+    TraceSpan span("MPDCli::insertAfterId", uri);
     if (!ok())
         return -1;
 
@@ -775,6 +835,29 @@ bool MPDCli::statId(int id)
     return false;
 }
 
+// This uses a server-side search, which is much cheaper than listing
+// the queue when it is big.
+bool MPDCli::getIdsForUri(const string& uri, vector<int>& ids)
+{
+    LOGDEB1("MPDCli::getIdsForUri: " << uri << endl);
+    ids.clear();
+    if (!ok())
+        return false;
+
+    RETRY_CMD(mpd_send_command(M_CONN, "playlistfind", "file", uri.c_str(),
+                               NULL));
+    struct mpd_song *song;
+    while ((song = mpd_recv_song(M_CONN)) != NULL) {
+        ids.push_back(mpd_song_get_id(song));
+        mpd_song_free(song);
+    }
+    if (!mpd_response_finish(M_CONN)) {
+        LOGERR("MPDCli::getIdsForUri: playlistfind failed"<< endl);
+        return false;
+    }
+    return true;
+}
+
 bool MPDCli::getQueueSongs(vector<mpd_song*>& songs)
 {
     //LOGDEB1("MPDCli::getQueueSongs" << endl);
@@ -839,16 +922,28 @@ int MPDCli::curpos()
 #include <errno.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <string>
 #include <iostream>
 using namespace std;
 
 #include "mpdcli.hxx"
+#include "conftree.h"
+
+// These normally live in main.cxx
+ConfSimple *g_config;
+std::mutex g_configlock;
 
 static char *thisprog;
 
 static char usage [] =
-"  \n\n"
+"-s [-p port] : seek to near the end of the current song\n"
+"-B [-p port] [-b count] : benchmark the main MPD operations.\n"
+"   Meant to be run against mockmpd.py with various queue sizes, e.g.:\n"
+"     mockmpd.py -p 6601 -q 10000 & mpdcli -B -p 6601 -b 100\n"
+"   Prints the median and 99th percentile durations.\n"
 ;
 static void
 Usage(void)
@@ -861,10 +956,92 @@ static int     op_flags;
 #define OPT_MOINS 0x1
 #define OPT_s	  0x2 
 #define OPT_b	  0x4 
+#define OPT_B	  0x8 
+#define OPT_p	  0x10 
+
+// Run op count times and print the p50/p99 durations.
+static bool bench(const string& what, int count, std::function<bool()> op)
+{
+    if (count <= 0) {
+        return true;
+    }
+    vector<double> times;
+    times.reserve(count);
+    for (int i = 0; i < count; i++) {
+        auto t0 = chrono::steady_clock::now();
+        if (!op()) {
+            cerr << what << " failed" << endl;
+            return false;
+        }
+        times.push_back(chrono::duration<double, micro>(
+                            chrono::steady_clock::now() - t0).count());
+    }
+    sort(times.begin(), times.end());
+    printf("%-12s n %6d  p50 %10.1f us  p99 %10.1f us\n", what.c_str(), count,
+           times[count / 2], times[min(count - 1, count * 99 / 100)]);
+    return true;
+}
+
+// The operations are the ones performed by the OpenHome Playlist and
+// AVTransport actions, and by the status polling which drives the
+// event generation.
+static int runbench(MPDCli& cli, int count)
+{
+    int qlen = cli.getStatus().qlen;
+    printf("Queue length %d\n", qlen);
+
+    bench("status", count, [&cli]() {cli.getStatus(); return true;});
+    if (qlen > 0) {
+        UpSong song;
+        bench("statsong", count, [&]() {
+                return cli.statSong(song, qlen / 2);});
+    }
+    bench("queuedata", count, [&cli]() {
+            vector<UpSong> vdata;
+            return cli.getQueueData(vdata);});
+    // Looking up the Songcast Receiver uri in the queue
+    bench("finduri", count, [&cli]() {
+            vector<int> ids;
+            return cli.getIdsForUri("http://localhost:8768/Songcast.wav",
+                                    ids);});
+
+    // Insert a series of tracks at the end of the queue (as done by
+    // an OHPlaylist Insert sequence), then remove them.
+    UpSong meta;
+    meta.title = "Benchmark track";
+    meta.artist = "Benchmark artist";
+    meta.album = "Benchmark album";
+    meta.tracknum = "1";
+    int afterid = 0;
+    if (qlen > 0) {
+        UpSong last;
+        if (cli.statSong(last, qlen - 1)) {
+            afterid = last.mpdid;
+        }
+    }
+    vector<int> ids;
+    bench("insert", count, [&]() {
+            int id = cli.insertAfterId("http://mock.invalid/bench.flac",
+                                       afterid, meta);
+            if (id < 0) {
+                return false;
+            }
+            ids.push_back(id);
+            afterid = id;
+            return true;});
+    // The insert bench may have failed early
+    if (!ids.empty()) {
+        unsigned int idx = 0;
+        bench("deleteid", ids.size(),
+              [&]() {return cli.deleteId(ids[idx++]);});
+    }
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
   int count = 10;
+  int port = 6600;
     
   thisprog = argv[0];
   argc--; argv++;
@@ -877,24 +1054,39 @@ int main(int argc, char **argv)
     while (**argv)
       switch (*(*argv)++) {
       case 's':	op_flags |= OPT_s; break;
+      case 'B':	op_flags |= OPT_B; break;
       case 'b':	op_flags |= OPT_b; if (argc < 2)  Usage();
 	if ((sscanf(*(++argv), "%d", &count)) != 1) 
 	  Usage(); 
 	argc--; 
 	goto b1;
+      case 'p':	op_flags |= OPT_p; if (argc < 2)  Usage();
+	if ((sscanf(*(++argv), "%d", &port)) != 1) 
+	  Usage(); 
+	argc--; 
+	goto b1;
       default: Usage();	break;
       }
   b1: argc--; argv++;
   }
 
-  if (argc != 0)
+  if (argc != 0 || count <= 0)
     Usage();
 
-  MPDCli cli("localhost");
+  g_config = new ConfSimple(string(), 1);
+  // Debug logging would dominate the timings
+  Logger::getTheLog("")->setLogLevel(Logger::LLERR);
+
+  MPDCli cli("localhost", port);
   if (!cli.ok()) {
       cerr << "Cli connection failed" << endl;
       return 1;
   }
+
+  if (op_flags & OPT_B) {
+      return runbench(cli, count);
+  }
+
   const MpdStatus& status = cli.getStatus();
   
   if (status.state != MpdStatus::MPDS_PLAY) {
@@ -912,5 +1104,4 @@ int main(int argc, char **argv)
   }
   return 0;
 }
-
 #endif
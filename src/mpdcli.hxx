@@ -26,6 +26,7 @@
 #include "upmpdutils.hxx"
 
 struct mpd_song;
+class ConfSimple;
 
 class MpdStatus {
 public:
@@ -98,6 +99,8 @@ public:
     // start included, end excluded
     bool deletePosRange(unsigned int start, unsigned int end);
     bool statId(int id);
+    // Ids of the queue entries for uri (normally 0 or 1)
+    bool getIdsForUri(const std::string& uri, std::vector<int>& ids);
     int curpos();
     bool getQueueData(std::vector<UpSong>& vdata);
     bool statSong(UpSong& usong, int pos = -1, bool isId = false);
@@ -132,6 +135,10 @@ private:
     bool m_externalvolumecontrol;
     std::vector<std::string> m_onvolumechange;
     std::vector<std::string> m_getexternalvolume;
+    // forceInternalVControl() was called: keep it after a reload
+    bool m_forceintvc;
+    // Configuration generation (confwatch) for the above
+    int m_confgen;
     regex_t m_tpuexpr;
     // addtagid command only exists for mpd 0.19 and later.
     bool m_have_addtagid; 
@@ -143,8 +150,16 @@ private:
     int m_lastinsertid;
     int m_lastinsertpos;
     int m_lastinsertqvers;
+    // Queue version and position for which the current and next song
+    // details in m_stat were fetched. They can't change without one
+    // of these changing (MPD also bumps the queue version when a
+    // stream sends new tags), so the status update can skip the two
+    // song queries.
+    int m_songsqvers;
+    int m_songspos;
 
     bool openconn();
+    void readConfig(ConfSimple *conf);
     bool updStatus();
     bool getQueueSongs(std::vector<mpd_song*>& songs);
     void freeSongs(std::vector<mpd_song*>& songs);
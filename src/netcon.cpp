@@ -43,6 +43,9 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#ifdef NETCON_EPOLL
+#include <sys/epoll.h>
+#endif
 
 #include <map>
 
@@ -109,6 +112,33 @@ int Netcon::select1(int fd, int timeo, int write)
     return ret;
 }
 
+SelectLoop::SelectLoop()
+    : m_selectloopDoReturn(false), m_selectloopReturnValue(0),
+      m_placetostart(0),
+      m_periodichandler(0), m_periodicparam(0), m_periodicmillis(0)
+{
+#ifdef NETCON_EPOLL
+    m_nactive = 0;
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0) {
+        LOGSYSERR("SelectLoop::SelectLoop", "epoll_create1", "");
+    }
+#endif
+}
+
+SelectLoop::~SelectLoop()
+{
+    // The connections may outlive us
+    for (auto& ent : m_polldata) {
+        ent.second->setloop(0);
+    }
+#ifdef NETCON_EPOLL
+    if (m_epfd >= 0) {
+        close(m_epfd);
+    }
+#endif
+}
+
 void SelectLoop::setperiodichandler(int (*handler)(void *), void *p, int ms)
 {
     m_periodichandler = handler;
@@ -166,6 +196,8 @@ int SelectLoop::maybecallperiodic()
     return 1;
 }
 
+#ifndef NETCON_EPOLL
+
 int SelectLoop::doLoop()
 {
     for (;;) {
@@ -284,6 +316,161 @@ int SelectLoop::doLoop()
     return -1;
 }
 
+#else // NETCON_EPOLL ->
+
+// Remember that the connection's events changed. The epoll set is
+// updated before the next wait. This avoids walking all the
+// connections on each loop iteration, most of them usually don't
+// change.
+void SelectLoop::selevschanged(Netcon *con)
+{
+    if (con->m_wantedEvents != con->m_loopEvents) {
+        m_changed.push_back(con->m_fd);
+    }
+}
+
+static uint32_t epollevents(int nevs)
+{
+    return ((nevs & Netcon::NETCONPOLL_READ) ? uint32_t(EPOLLIN) : 0u) |
+        ((nevs & Netcon::NETCONPOLL_WRITE) ? uint32_t(EPOLLOUT) : 0u);
+}
+
+void SelectLoop::syncevents()
+{
+    for (auto fd : m_changed) {
+        map<int, NetconP>::iterator it = m_polldata.find(fd);
+        if (it == m_polldata.end()) {
+            continue;
+        }
+        Netcon *con = it->second.get();
+        int wanted = con->m_wantedEvents &
+            (Netcon::NETCONPOLL_READ | Netcon::NETCONPOLL_WRITE);
+        if (wanted == con->m_loopEvents) {
+            continue;
+        }
+        if (wanted == 0) {
+            epollremove(con);
+            continue;
+        }
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = epollevents(wanted);
+        ev.data.fd = fd;
+        int op = con->m_loopEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        int ret = epoll_ctl(m_epfd, op, fd, &ev);
+        // The kernel forgets closed fds, and a new connection may
+        // reuse an fd which we did not unregister: adjust.
+        if (ret < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+            ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev);
+        } else if (ret < 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+            ret = epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ev);
+        }
+        if (ret < 0) {
+            LOGSYSERR("Netcon::selectloop", "epoll_ctl", "");
+            continue;
+        }
+        if (con->m_loopEvents == 0) {
+            m_nactive++;
+        }
+        con->m_loopEvents = wanted;
+    }
+    m_changed.clear();
+}
+
+void SelectLoop::epollremove(Netcon *con)
+{
+    if (con->m_loopEvents) {
+        // Errors are normal here if the fd was closed already
+        struct epoll_event ev;
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, con->m_fd, &ev);
+        m_nactive--;
+        con->m_loopEvents = 0;
+    }
+}
+
+int SelectLoop::doLoop()
+{
+    if (m_epfd < 0) {
+        return -1;
+    }
+    const int maxevents = 64;
+    struct epoll_event events[maxevents];
+    for (;;) {
+        if (m_selectloopDoReturn) {
+            m_selectloopDoReturn = false;
+            LOGDEB("Netcon::selectloop: returning on request\n" );
+            return m_selectloopReturnValue;
+        }
+
+        syncevents();
+        if (m_nactive == 0) {
+            // See the select() version
+            m_polldata.clear();
+            LOGDEB1("Netcon::selectloop: no fds\n" );
+            return 0;
+        }
+
+        struct timeval tv;
+        periodictimeout(&tv);
+        int ret = epoll_wait(m_epfd, events, maxevents,
+                             tv.tv_sec * 1000 + tv.tv_usec / 1000);
+        LOGDEB2("Netcon::selectloop: epoll_wait returns "  << ret << "\n" );
+        if (ret < 0) {
+            LOGSYSERR("Netcon::selectloop", "epoll_wait", "");
+            return -1;
+        }
+        if (m_periodicmillis > 0)
+            if (maybecallperiodic() <= 0) {
+                return 1;
+            }
+
+        // epoll returns the ready connections only, in an order which
+        // does not favor the low fds.
+        for (int i = 0; i < ret; i++) {
+            int fd = events[i].data.fd;
+            map<int, NetconP>::iterator it = m_polldata.find(fd);
+            if (it == m_polldata.end()) {
+                LOGDEB2("Netcon::selectloop: fd "  << fd << " not found\n" );
+                continue;
+            }
+            // Keep a reference: the callback may remove the connection
+            NetconP pll = it->second;
+            uint32_t evs = events[i].events;
+            // Let the callback see errors and hangups as read/write
+            // events, as select() would.
+            if (evs & (EPOLLERR | EPOLLHUP)) {
+                evs |= EPOLLIN | EPOLLOUT;
+            }
+            if ((evs & EPOLLIN) &&
+                (pll->m_wantedEvents & Netcon::NETCONPOLL_READ) &&
+                pll->cando(Netcon::NETCONPOLL_READ) <= 0) {
+                pll->m_wantedEvents &= ~Netcon::NETCONPOLL_READ;
+            }
+            if ((evs & EPOLLOUT) &&
+                (pll->m_wantedEvents & Netcon::NETCONPOLL_WRITE) &&
+                pll->cando(Netcon::NETCONPOLL_WRITE) <= 0) {
+                pll->m_wantedEvents &= ~Netcon::NETCONPOLL_WRITE;
+            }
+            if (!(pll->m_wantedEvents &
+                  (Netcon::NETCONPOLL_WRITE | Netcon::NETCONPOLL_READ))) {
+                it = m_polldata.find(fd);
+                if (it != m_polldata.end() && it->second == pll) {
+                    LOGDEB0("Netcon::selectloop: fd "  << fd <<
+                            " has 0 mask, erasing\n");
+                    epollremove(pll.get());
+                    m_polldata.erase(it);
+                }
+            } else {
+                selevschanged(pll.get());
+            }
+        }
+    } // forever loop
+    LOGERR("SelectLoop::doLoop: got out of loop !\n" );
+    return -1;
+}
+
+#endif // NETCON_EPOLL
+
 // Add a connection to the monitored set.
 int SelectLoop::addselcon(NetconP con, int events)
 {
@@ -293,8 +480,18 @@ int SelectLoop::addselcon(NetconP con, int events)
     LOGDEB1("Netcon::addselcon: fd "  << (con->m_fd) << "\n" );
     con->set_nonblock(1);
     con->setselevents(events);
+#ifdef NETCON_EPOLL
+    map<int, NetconP>::iterator it = m_polldata.find(con->m_fd);
+    if (it != m_polldata.end() && it->second != con) {
+        epollremove(it->second.get());
+        it->second->setloop(0);
+    }
+#endif
     m_polldata[con->m_fd] = con;
     con->setloop(this);
+#ifdef NETCON_EPOLL
+    selevschanged(con.get());
+#endif
     return 0;
 }
 
@@ -310,6 +507,9 @@ int SelectLoop::remselcon(NetconP con)
         LOGDEB1("Netcon::remselcon: con not found for fd "  << (con->m_fd) << "\n" );
         return -1;
     }
+#ifdef NETCON_EPOLL
+    epollremove(con.get());
+#endif
     con->setloop(0);
     m_polldata.erase(it);
     return 0;
@@ -317,6 +517,17 @@ int SelectLoop::remselcon(NetconP con)
 
 //////////////////////////////////////////////////////////
 // Base class (Netcon) methods
+int Netcon::setselevents(int evs)
+{
+    m_wantedEvents = evs;
+#ifdef NETCON_EPOLL
+    if (m_loop) {
+        m_loop->selevschanged(this);
+    }
+#endif
+    return m_wantedEvents;
+}
+
 Netcon::~Netcon()
 {
     closeconn();
@@ -1054,3 +1265,112 @@ NetconServLis::checkperms(void *cl, int)
     return -1;
 }
 #endif /* NETCON_ACCESSCONTROL */
+
+#ifdef NETCON_TEST
+// SelectLoop benchmark: one connection exchanging data while many
+// others stay idle. Build with -DNETCON_NO_EPOLL to compare with
+// select(), e.g.:
+// c++ -std=c++11 -DNETCON_TEST -DHAVE_CONFIG_H -I. -I/usr/include/libupnpp
+//     -o trnetcon netcon.cpp -lupnpp
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+// Echo back the byte to the peer fd until we've done the count
+class PingWorker : public NetconWorker {
+public:
+    PingWorker(int peerfd, int count) : m_peerfd(peerfd), m_count(count) {}
+    virtual int data(NetconData *con, Netcon::Event reason) {
+        char c;
+        if (read(con->getfd(), &c, 1) != 1) {
+            return -1;
+        }
+        if (--m_count <= 0) {
+            con->getloop()->loopReturn(0);
+            return 1;
+        }
+        if (write(m_peerfd, &c, 1) != 1) {
+            return -1;
+        }
+        return 1;
+    }
+    int m_peerfd;
+    int m_count;
+};
+
+static void usage()
+{
+    cerr << "Usage: trnetcon [-n idleconns] [-c roundtrips]\n";
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int nidle = 1000;
+    int count = 100000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            nidle = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#ifndef NETCON_EPOLL
+    if (2 * nidle + 10 >= FD_SETSIZE) {
+        cerr << "select() can't handle more than " << FD_SETSIZE << " fds\n";
+        return 1;
+    }
+#endif
+
+    SelectLoop loop;
+    vector<int> peers;
+    for (int i = 0; i < nidle; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+            perror("socketpair");
+            return 1;
+        }
+        NetconCli *con = new NetconCli;
+        con->setconn(fds[0]);
+        loop.addselcon(NetconP(con), Netcon::NETCONPOLL_READ);
+        peers.push_back(fds[1]);
+    }
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    NetconCli *active = new NetconCli;
+    active->setconn(fds[0]);
+    active->setcallback(make_shared<PingWorker>(fds[1], count));
+    loop.addselcon(NetconP(active), Netcon::NETCONPOLL_READ);
+
+    auto start = chrono::steady_clock::now();
+    char c = 'x';
+    if (write(fds[1], &c, 1) != 1) {
+        return 1;
+    }
+    int ret = loop.doLoop();
+    auto us = chrono::duration_cast<chrono::microseconds>(
+        chrono::steady_clock::now() - start).count();
+#ifdef NETCON_EPOLL
+    cout << "epoll: ";
+#else
+    cout << "select: ";
+#endif
+    cout << nidle << " idle connections, " << count << " loop iterations: " <<
+        double(us) / count << " uS per iteration (doLoop returned " <<
+        ret << ")\n";
+    return 0;
+}
+#endif // NETCON_TEST
@@ -25,9 +25,18 @@
 #include <sys/time.h>
 #include <map>
 #include <string>
+#include <vector>
 
 #include <memory>
 
+// Use epoll() instead of select() in the SelectLoop on Linux. This
+// removes the FD_SETSIZE limit, and the cost of the select() set up
+// for many mostly idle connections. Define NETCON_NO_EPOLL to force
+// select().
+#if defined(__linux__) && !defined(NETCON_NO_EPOLL)
+#define NETCON_EPOLL
+#endif
+
 /// A set of classes to manage client-server communication over a
 /// connection-oriented network, or a pipe.
 ///
@@ -51,7 +60,7 @@ public:
     enum Event {NETCONPOLL_READ = 0x1, NETCONPOLL_WRITE = 0x2};
     Netcon()
         : m_peer(0), m_fd(-1), m_ownfd(true), m_didtimo(0), m_wantedEvents(0),
-          m_loop(0) {
+          m_loopEvents(0), m_loop(0) {
     }
     virtual ~Netcon();
     /// Remember whom we're talking to. We let external code do this because
@@ -85,20 +94,18 @@ public:
 
     /// Decide what events the connection will be looking for
     /// (NETCONPOLL_READ, NETCONPOLL_WRITE)
-    int setselevents(int evs) {
-        return m_wantedEvents = evs;
-    }
+    int setselevents(int evs);
     /// Retrieve the connection's currently monitored set of events
     int getselevents() {
         return m_wantedEvents;
     }
     /// Add events to current set
     int addselevents(int evs) {
-        return m_wantedEvents |= evs;
+        return setselevents(m_wantedEvents | evs);
     }
     /// Clear events from current set
     int clearselevents(int evs) {
-        return m_wantedEvents &= ~evs;
+        return setselevents(m_wantedEvents & ~evs);
     }
 
     friend class SelectLoop;
@@ -117,6 +124,8 @@ protected:
     int   m_didtimo;
     // Used when part of the selectloop map.
     short m_wantedEvents;
+    // Events currently registered with epoll
+    short m_loopEvents;
     SelectLoop *m_loop;
     // Method called by the selectloop when something can be done with a netcon
     virtual int cando(Netcon::Event reason) = 0;
@@ -135,11 +144,8 @@ protected:
 // thread.
 class SelectLoop {
 public:
-    SelectLoop()
-        : m_selectloopDoReturn(false), m_selectloopReturnValue(0),
-          m_placetostart(0),
-          m_periodichandler(0), m_periodicparam(0), m_periodicmillis(0) {
-    }
+    SelectLoop();
+    ~SelectLoop();
 
     /// Loop waiting for events on the connections and call the
     /// cando() method on the object when something happens (this will in
@@ -172,6 +178,7 @@ public:
     ///   before return. Set to 0 for no periodic handler.
     void setperiodichandler(int (*handler)(void *), void *clp, int ms);
 
+    friend class Netcon;
 private:
     // Set by client callback to tell selectloop to return.
     bool m_selectloopDoReturn;
@@ -190,6 +197,18 @@ private:
     int m_periodicmillis;
     void periodictimeout(struct timeval *tv);
     int maybecallperiodic();
+
+#ifdef NETCON_EPOLL
+    int m_epfd;
+    // Connections (fds) whose wanted events changed since the last
+    // epoll_ctl() call.
+    std::vector<int> m_changed;
+    // Count of connections registered with a non-empty set of events
+    int m_nactive;
+    void selevschanged(Netcon *con);
+    void syncevents();
+    void epollremove(Netcon *con);
+#endif
 };
 
 ///////////////////////
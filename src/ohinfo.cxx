@@ -33,6 +33,7 @@
 #include "upmpd.hxx"
 #include "upmpdutils.hxx"
 #include "ohplaylist.hxx"
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -43,13 +44,13 @@ static const string sIdProduct("urn:av-openhome-org:serviceId:Info");
 OHInfo::OHInfo(UpMpd *dev)
     : OHService(sTpProduct, sIdProduct, dev), m_ohpl(0)
 {
-    dev->addActionMapping(this, "Counters", 
+    metricsAddAction(dev, this, "Counters", 
                           bind(&OHInfo::counters, this, _1, _2));
-    dev->addActionMapping(this, "Track", 
+    metricsAddAction(dev, this, "Track", 
                           bind(&OHInfo::track, this, _1, _2));
-    dev->addActionMapping(this, "Details", 
+    metricsAddAction(dev, this, "Details", 
                           bind(&OHInfo::details, this, _1, _2));
-    dev->addActionMapping(this, "Metatext", 
+    metricsAddAction(dev, this, "Metatext", 
                           bind(&OHInfo::metatext, this, _1, _2));
 }
 
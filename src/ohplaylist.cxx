@@ -38,6 +38,8 @@
 #include "upmpdutils.hxx"
 #include "smallut.h"
 #include "ohproduct.hxx"
+#include "metrics.hxx"
+#include "trace.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -48,55 +50,56 @@ static const string sIdProduct("urn:av-openhome-org:serviceId:Playlist");
 // Playlist is the default oh service, so it's active when starting up
 OHPlaylist::OHPlaylist(UpMpd *dev, unsigned int cssleep)
     : OHService(sTpProduct, sIdProduct, dev),
-      m_active(true), m_cachedirty(false), m_mpdqvers(-1)
+      m_active(true), m_cachedirty(false), m_mpdqvers(-1),
+      m_protocolInfo(g_protocolInfo)
 {
-    dev->addActionMapping(this, "Play", 
+    metricsAddAction(dev, this, "Play", 
                           bind(&OHPlaylist::play, this, _1, _2));
-    dev->addActionMapping(this, "Pause", 
+    metricsAddAction(dev, this, "Pause", 
                           bind(&OHPlaylist::pause, this, _1, _2));
-    dev->addActionMapping(this, "Stop", 
+    metricsAddAction(dev, this, "Stop", 
                           bind(&OHPlaylist::stop, this, _1, _2));
-    dev->addActionMapping(this, "Next", 
+    metricsAddAction(dev, this, "Next", 
                           bind(&OHPlaylist::next, this, _1, _2));
-    dev->addActionMapping(this, "Previous", 
+    metricsAddAction(dev, this, "Previous", 
                           bind(&OHPlaylist::previous, this, _1, _2));
-    dev->addActionMapping(this, "SetRepeat",
+    metricsAddAction(dev, this, "SetRepeat",
                           bind(&OHPlaylist::setRepeat, this, _1, _2));
-    dev->addActionMapping(this, "Repeat",
+    metricsAddAction(dev, this, "Repeat",
                           bind(&OHPlaylist::repeat, this, _1, _2));
-    dev->addActionMapping(this, "SetShuffle",
+    metricsAddAction(dev, this, "SetShuffle",
                           bind(&OHPlaylist::setShuffle, this, _1, _2));
-    dev->addActionMapping(this, "Shuffle",
+    metricsAddAction(dev, this, "Shuffle",
                           bind(&OHPlaylist::shuffle, this, _1, _2));
-    dev->addActionMapping(this, "SeekSecondAbsolute",
+    metricsAddAction(dev, this, "SeekSecondAbsolute",
                           bind(&OHPlaylist::seekSecondAbsolute, this, _1, _2));
-    dev->addActionMapping(this, "SeekSecondRelative",
+    metricsAddAction(dev, this, "SeekSecondRelative",
                           bind(&OHPlaylist::seekSecondRelative, this, _1, _2));
-    dev->addActionMapping(this, "SeekId",
+    metricsAddAction(dev, this, "SeekId",
                           bind(&OHPlaylist::seekId, this, _1, _2));
-    dev->addActionMapping(this, "SeekIndex",
+    metricsAddAction(dev, this, "SeekIndex",
                           bind(&OHPlaylist::seekIndex, this, _1, _2));
-    dev->addActionMapping(this, "TransportState",
+    metricsAddAction(dev, this, "TransportState",
                           bind(&OHPlaylist::transportState, this, _1, _2));
-    dev->addActionMapping(this, "Id",
+    metricsAddAction(dev, this, "Id",
                           bind(&OHPlaylist::id, this, _1, _2));
-    dev->addActionMapping(this, "Read",
+    metricsAddAction(dev, this, "Read",
                           bind(&OHPlaylist::ohread, this, _1, _2));
-    dev->addActionMapping(this, "ReadList",
+    metricsAddAction(dev, this, "ReadList",
                           bind(&OHPlaylist::readList, this, _1, _2));
-    dev->addActionMapping(this, "Insert",
+    metricsAddAction(dev, this, "Insert",
                           bind(&OHPlaylist::insert, this, _1, _2));
-    dev->addActionMapping(this, "DeleteId",
+    metricsAddAction(dev, this, "DeleteId",
                           bind(&OHPlaylist::deleteId, this, _1, _2));
-    dev->addActionMapping(this, "DeleteAll",
+    metricsAddAction(dev, this, "DeleteAll",
                           bind(&OHPlaylist::deleteAll, this, _1, _2));
-    dev->addActionMapping(this, "TracksMax",
+    metricsAddAction(dev, this, "TracksMax",
                           bind(&OHPlaylist::tracksMax, this, _1, _2));
-    dev->addActionMapping(this, "IdArray",
+    metricsAddAction(dev, this, "IdArray",
                           bind(&OHPlaylist::idArray, this, _1, _2));
-    dev->addActionMapping(this, "IdArrayChanged",
+    metricsAddAction(dev, this, "IdArrayChanged",
                           bind(&OHPlaylist::idArrayChanged, this, _1, _2));
-    dev->addActionMapping(this, "ProtocolInfo",
+    metricsAddAction(dev, this, "ProtocolInfo",
                           bind(&OHPlaylist::protocolInfo, this, _1, _2));
     
     if ((dev->m_options & UpMpd::upmpdOhMetaPersist)) {
@@ -132,7 +135,7 @@ static string mpdstatusToTransportState(MpdStatus::State st)
 static string translateIdArray(const vector<UpSong>& in)
 {
     string out1;
-    string sdeb;
+    out1.reserve(4 * in.size());
     for (auto us = in.begin(); us != in.end(); us++) {
         unsigned int val = us->mpdid;
         if (val) {
@@ -141,9 +144,15 @@ static string translateIdArray(const vector<UpSong>& in)
             out1 += (unsigned char) ((val & 0x0000ff00) >> 8);
             out1 += (unsigned char) ((val & 0x000000ff));
         }
-        sdeb += SoapHelp::i2s(val) + " ";
     }
-    LOGDEB("OHPlaylist::translateIdArray: current ids: " << sdeb << endl);
+    // The id list can be long, only build it if it will be printed.
+    if (Logger::getTheLog("")->getloglevel() >= Logger::LLDEB1) {
+        string sdeb;
+        for (const auto& us : in) {
+            sdeb += SoapHelp::i2s(us.mpdid) + " ";
+        }
+        LOGDEB1("OHPlaylist::translateIdArray: current ids: " << sdeb << endl);
+    }
     return base64_encode(out1);
 }
 
@@ -222,9 +231,13 @@ bool OHPlaylist::makeIdArray(string& out)
         }
     }
 
-    for (unordered_map<string, string>::const_iterator it = m_metacache.begin();
-         it != m_metacache.end(); it++) {
-        LOGDEB("OHPlaylist::makeIdArray: dropping uri " << it->first << endl);
+    if (!m_metacache.empty()) {
+        LOGDEB("OHPlaylist::makeIdArray: dropping " << m_metacache.size() <<
+               " uris" << endl);
+        for (const auto& ent : m_metacache) {
+            LOGDEB1("OHPlaylist::makeIdArray: dropping uri " << ent.first <<
+                    endl);
+        }
     }
 
     // If we added entries or there are some stale entries, the new
@@ -251,12 +264,16 @@ bool OHPlaylist::makestate(unordered_map<string, string> &st)
     st["Shuffle"] = SoapHelp::i2s(mpds.random);
     st["Id"] = mpds.songid == -1 ? "0" : SoapHelp::i2s(mpds.songid);
     st["TracksMax"] = SoapHelp::i2s(tracksmax);
-    st["ProtocolInfo"] = g_protocolInfo;
     makeIdArray(st["IdArray"]);
 
     return true;
 }
 
+void OHPlaylist::makestaticstate(unordered_map<string, SharedStrValue>& st)
+{
+    st["ProtocolInfo"] = m_protocolInfo;
+}
+
 void OHPlaylist::refreshState()
 {
     m_mpdqvers = -1;
@@ -613,6 +630,7 @@ bool OHPlaylist::ireadList(const vector<int>& ids, vector<UpSong>& songs)
 int OHPlaylist::insert(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHPlaylist::insert" << endl);
+    TraceSpan span("OHPlaylist::insert");
     int afterid;
     string uri, metadata;
     bool ok = sc.get("AfterId", &afterid);
@@ -752,25 +770,6 @@ bool OHPlaylist::iidArray(string& idarray, int *token)
     return false;
 }
 
-bool OHPlaylist::urlMap(unordered_map<int, string>& umap)
-{
-    //LOGDEB1("OHPlaylist::urlMap\n");
-    string sarray; 
-    if (iidArray(sarray, 0)) {
-        vector<int> ids;
-        if (ohplIdArrayToVec(sarray, &ids)) {
-            vector<UpSong> songs;
-            if (ireadList(ids, songs)) {
-                for (auto it = songs.begin(); it != songs.end(); it++) {
-                    umap[it->mpdid] = it->uri;
-                }
-                return true;
-            }
-        }
-    }
-    return false;
-}
-
 // Check if id array changed since last call (which returned a gen token)
 int OHPlaylist::idArrayChanged(const SoapIncoming& sc, SoapOutgoing& data)
 {
@@ -792,6 +791,6 @@ int OHPlaylist::idArrayChanged(const SoapIncoming& sc, SoapOutgoing& data)
 int OHPlaylist::protocolInfo(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHPlaylist::protocolInfo" << endl);
-    data.addarg("Value", g_protocolInfo);
+    data.addarg("Value", m_protocolInfo.value());
     return UPNP_E_SUCCESS;
 }
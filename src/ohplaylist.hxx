@@ -41,7 +41,6 @@ public:
                    const std::string& metadata, int *newid = 0);
     bool ireadList(const std::vector<int>&, std::vector<UpSong>&);
     bool iidArray(std::string& idarray, int *token);
-    bool urlMap(std::unordered_map<int, std::string>& umap);
 
     int iStop();
     void refreshState();
@@ -51,6 +50,8 @@ public:
 
 protected:
     virtual bool makestate(std::unordered_map<std::string, std::string> &st);
+    virtual void makestaticstate(
+        std::unordered_map<std::string, SharedStrValue>& st);
 private:
     int play(const SoapIncoming& sc, SoapOutgoing& data);
     int pause(const SoapIncoming& sc, SoapOutgoing& data);
@@ -93,6 +94,7 @@ private:
     // queue version.
     int m_mpdqvers;
     std::string m_idArrayCached;
+    SharedStrValue m_protocolInfo;
 };
 
 #endif /* _OHPLAYLIST_H_X_INCLUDED_ */
@@ -20,6 +20,7 @@
 
 #include <upnp/upnp.h>                  // for UPNP_E_SUCCESS, etc
 
+#include <algorithm>                    // for find
 #include <functional>                   // for _Bind, bind, _1, _2
 #include <iostream>                     // for endl, etc
 #include <map>                          // for _Rb_tree_const_iterator, etc
@@ -41,20 +42,24 @@
 #include "ohsndrcv.hxx"
 #include "ohinfo.hxx"
 #include "conftree.h"
+#include "metrics.hxx"
+#include "confwatch.hxx"
 
 using namespace std;
 using namespace std::placeholders;
 
-static void listScripts(vector<pair<string, string> >& sources);
+static void listScripts(ConfSimple *conf,
+                        vector<pair<string, string> >& sources);
 
 static const string sTpProduct("urn:av-openhome-org:service:Product:1");
 static const string sIdProduct("urn:av-openhome-org:serviceId:Product");
 
-static string csxml("<SourceList>\n");
+static SharedStrValue csxml;
 static string csattrs("Info Time Volume");
 
 // This can be replaced by config data in listScripts()
-static string scripts_dir("/usr/share/upmpdcli/src_scripts");
+static const string dflt_scripts_dir("/usr/share/upmpdcli/src_scripts");
+static string scripts_dir(dflt_scripts_dir);
 
 // (Type, Name) list
 static vector<pair<string, string> > o_sources;
@@ -64,16 +69,75 @@ static const string SndRcvRDName("RD-to-Songcast");
 
 OHProduct::OHProduct(UpMpd *dev, ohProductDesc_t& ohProductDesc)
     : OHService(sTpProduct, sIdProduct, dev),
-      m_ohProductDesc(ohProductDesc), m_sourceIndex(0), m_standby(false)
+      m_ohProductDesc(ohProductDesc), m_sourceIndex(0), m_standby(false),
+      m_confgen(0)
 {
+    if (m_dev->m_ohrcv) {
+        csattrs.append(" Receiver");
+    }
+    buildSources(g_config, o_sources);
+    setSourceXml();
+    LOGDEB("OHProduct::OHProduct: sources: " << csxml.value() << endl);
+
+    m_descstate["ManufacturerName"].set(ohProductDesc.manufacturer.name);
+    m_descstate["ManufacturerInfo"].set(ohProductDesc.manufacturer.info);
+    m_descstate["ManufacturerUrl"].set(ohProductDesc.manufacturer.url);
+    m_descstate["ManufacturerImageUri"].set(
+        ohProductDesc.manufacturer.imageUri);
+    m_descstate["ModelName"].set(ohProductDesc.model.name);
+    m_descstate["ModelInfo"].set(ohProductDesc.model.info);
+    m_descstate["ModelUrl"].set(ohProductDesc.model.url);
+    m_descstate["ModelImageUri"].set(ohProductDesc.model.imageUri);
+    m_descstate["ProductRoom"].set(ohProductDesc.room);
+    m_descstate["ProductName"].set(ohProductDesc.product.name);
+    m_descstate["ProductInfo"].set(ohProductDesc.product.info);
+    m_descstate["ProductUrl"].set(ohProductDesc.product.url);
+    m_descstate["ProductImageUri"].set(ohProductDesc.product.imageUri);
+
+    metricsAddAction(dev, this, "Manufacturer", 
+                          bind(&OHProduct::manufacturer, this, _1, _2));
+    metricsAddAction(dev, this, "Model", bind(&OHProduct::model, this, _1, _2));
+    metricsAddAction(dev, this, "Product", 
+                          bind(&OHProduct::product, this, _1, _2));
+    metricsAddAction(dev, this, "Standby", 
+                          bind(&OHProduct::standby, this, _1, _2));
+    metricsAddAction(dev, this, "SetStandby", 
+                          bind(&OHProduct::setStandby, this, _1, _2));
+    metricsAddAction(dev, this, "SourceCount", 
+                          bind(&OHProduct::sourceCount, this, _1, _2));
+    metricsAddAction(dev, this, "SourceXml", 
+                          bind(&OHProduct::sourceXML, this, _1, _2));
+    metricsAddAction(dev, this, "SourceIndex", 
+                          bind(&OHProduct::sourceIndex, this, _1, _2));
+    metricsAddAction(dev, this, "SetSourceIndex", 
+                          bind(&OHProduct::setSourceIndex, this, _1, _2));
+    metricsAddAction(dev, this, "SetSourceIndexByName", 
+                          bind(&OHProduct::setSourceIndexByName, this, _1, _2));
+    metricsAddAction(dev, this, "Source", 
+                          bind(&OHProduct::source, this, _1, _2));
+    metricsAddAction(dev, this, "Attributes", 
+                          bind(&OHProduct::attributes, this, _1, _2));
+    metricsAddAction(dev, this, "SourceXmlChangeCount", 
+                          bind(&OHProduct::sourceXMLChangeCount, this, _1, _2));
+}
+
+OHProduct::~OHProduct()
+{
+}
+
+// Build the (Type, Name) source list. This depends on the
+// configuration through the scripts directory.
+void OHProduct::buildSources(ConfSimple *conf,
+                             vector<pair<string, string> >& sources)
+{
+    sources.clear();
     // Playlist must stay first.
-    o_sources.push_back(pair<string,string>("Playlist","Playlist"));
+    sources.push_back(pair<string,string>("Playlist","Playlist"));
     if (m_dev->m_ohrd) {
-        o_sources.push_back(pair<string, string>("Radio", "Radio"));
+        sources.push_back(pair<string, string>("Radio", "Radio"));
     }
     if (m_dev->m_ohrcv) {
-        o_sources.push_back(pair<string,string>("Receiver", "Receiver"));
-        csattrs.append(" Receiver");
+        sources.push_back(pair<string,string>("Receiver", "Receiver"));
         if (m_dev->m_sndrcv &&
             m_dev->m_ohrcv->playMethod() == OHReceiverParams::OHRP_ALSA) {
             // It might be possible to make things work with the MPD
@@ -82,83 +146,81 @@ OHProduct::OHProduct(UpMpd *dev, ohProductDesc_t& ohProductDesc)
             // original/saved one, not the current one, which is doing
             // the playing and sending to the fifo, so we'd need to
             // tell ohreceiver about using the right one.
-            o_sources.push_back(pair<string,string>("Playlist", SndRcvPLName));
+            sources.push_back(pair<string,string>("Playlist", SndRcvPLName));
             if (m_dev->m_ohrd) {
-                o_sources.push_back(pair<string,string>("Radio", SndRcvRDName));
+                sources.push_back(pair<string,string>("Radio", SndRcvRDName));
             }
-            listScripts(o_sources);
+            listScripts(conf, sources);
         }
     }
+}
 
-
+void OHProduct::setSourceXml()
+{
+    string xml("<SourceList>\n");
     for (auto it = o_sources.begin(); it != o_sources.end(); it++) {
         string visible = it->first.compare("Receiver") ? "1" : "0";
-        csxml += string(" <Source>\n") +
+        xml += string(" <Source>\n") +
             "  <Name>" + it->second + "</Name>\n" +
             "  <Type>" + it->first + "</Type>\n" +
             "  <Visible>" + visible + "</Visible>\n" +
             "  </Source>\n";
     }
-    csxml += string("</SourceList>\n");
-    LOGDEB("OHProduct::OHProduct: sources: " << csxml << endl);
-
-    dev->addActionMapping(this, "Manufacturer", 
-                          bind(&OHProduct::manufacturer, this, _1, _2));
-    dev->addActionMapping(this, "Model", bind(&OHProduct::model, this, _1, _2));
-    dev->addActionMapping(this, "Product", 
-                          bind(&OHProduct::product, this, _1, _2));
-    dev->addActionMapping(this, "Standby", 
-                          bind(&OHProduct::standby, this, _1, _2));
-    dev->addActionMapping(this, "SetStandby", 
-                          bind(&OHProduct::setStandby, this, _1, _2));
-    dev->addActionMapping(this, "SourceCount", 
-                          bind(&OHProduct::sourceCount, this, _1, _2));
-    dev->addActionMapping(this, "SourceXml", 
-                          bind(&OHProduct::sourceXML, this, _1, _2));
-    dev->addActionMapping(this, "SourceIndex", 
-                          bind(&OHProduct::sourceIndex, this, _1, _2));
-    dev->addActionMapping(this, "SetSourceIndex", 
-                          bind(&OHProduct::setSourceIndex, this, _1, _2));
-    dev->addActionMapping(this, "SetSourceIndexByName", 
-                          bind(&OHProduct::setSourceIndexByName, this, _1, _2));
-    dev->addActionMapping(this, "Source", 
-                          bind(&OHProduct::source, this, _1, _2));
-    dev->addActionMapping(this, "Attributes", 
-                          bind(&OHProduct::attributes, this, _1, _2));
-    dev->addActionMapping(this, "SourceXmlChangeCount", 
-                          bind(&OHProduct::sourceXMLChangeCount, this, _1, _2));
+    xml += string("</SourceList>\n");
+    csxml.set(xml);
 }
 
-OHProduct::~OHProduct()
+// Called from makestate() when the configuration changed. Only does
+// something if the source scripts changed. If the current source
+// disappeared, we switch to the playlist first.
+void OHProduct::reloadSources(ConfSimple *conf)
 {
+    vector<pair<string, string> > sources;
+    buildSources(conf, sources);
+    if (sources == o_sources) {
+        return;
+    }
+    auto it = find(sources.begin(), sources.end(), o_sources[m_sourceIndex]);
+    if (it == sources.end()) {
+        LOGINF("OHProduct: source " << o_sources[m_sourceIndex].second <<
+               " gone after configuration change\n");
+        // Playlist is first in both lists
+        iSetSourceIndex(0);
+        it = sources.begin();
+    }
+    m_sourceIndex = int(it - sources.begin());
+    o_sources.swap(sources);
+    setSourceXml();
+    LOGINF("OHProduct: source list changed: " << o_sources.size() <<
+           " sources\n");
 }
 
 bool OHProduct::makestate(unordered_map<string, string> &st)
 {
     st.clear();
 
-    st["ManufacturerName"] = m_ohProductDesc.manufacturer.name;
-    st["ManufacturerInfo"] = m_ohProductDesc.manufacturer.info;
-    st["ManufacturerUrl"] = m_ohProductDesc.manufacturer.url;
-    st["ManufacturerImageUri"] = m_ohProductDesc.manufacturer.imageUri;
-    st["ModelName"] = m_ohProductDesc.model.name;
-    st["ModelInfo"] = m_ohProductDesc.model.info;
-    st["ModelUrl"] = m_ohProductDesc.model.url;
-    st["ModelImageUri"] = m_ohProductDesc.model.imageUri;
-    st["ProductRoom"] = m_ohProductDesc.room;
-    st["ProductName"] = m_ohProductDesc.product.name;
-    st["ProductInfo"] = m_ohProductDesc.product.info;
-    st["ProductUrl"] = m_ohProductDesc.product.url;
-    st["ProductImageUri"] = m_ohProductDesc.product.imageUri;
+    if (confWatchGeneration() != m_confgen) {
+        m_confgen = confWatchGeneration();
+        shared_ptr<ConfSimple> conf = confWatchConfig();
+        if (conf) {
+            reloadSources(conf.get());
+        }
+    }
+
     st["Standby"] = m_standby ? "1" : "0";
     st["SourceCount"] = SoapHelp::i2s(o_sources.size());
-    st["SourceXml"] = csxml;
     st["SourceIndex"] = SoapHelp::i2s(m_sourceIndex);
     st["Attributes"] = csattrs;
 
     return true;
 }
 
+void OHProduct::makestaticstate(unordered_map<string, SharedStrValue>& st)
+{
+    st = m_descstate;
+    st["SourceXml"] = csxml;
+}
+
 int OHProduct::manufacturer(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHProduct::manufacturer" << endl);
@@ -217,7 +279,7 @@ int OHProduct::sourceCount(const SoapIncoming& sc, SoapOutgoing& data)
 int OHProduct::sourceXML(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHProduct::sourceXML" << endl);
-    data.addarg("Value", csxml);
+    data.addarg("Value", csxml.value());
     return UPNP_E_SUCCESS;
 }
 
@@ -368,7 +430,7 @@ int OHProduct::attributes(const SoapIncoming& sc, SoapOutgoing& data)
 int OHProduct::sourceXMLChangeCount(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHProduct::sourceXMLChangeCount" << endl);
-    data.addarg("Value", "0");
+    data.addarg("Value", SoapHelp::i2s(csxml.generation()));
     return UPNP_E_SUCCESS;
 }
 
@@ -380,14 +442,16 @@ int OHProduct::sourceXMLChangeCount(const SoapIncoming& sc, SoapOutgoing& data)
 // distinguished on value (but must be one of the three).
 //
 // Name is arbitrary
-static void listScripts(vector<pair<string, string> >& sources)
+static void listScripts(ConfSimple *conf,
+                        vector<pair<string, string> >& sources)
 {
-    if (!g_config)
+    if (!conf)
         return;
 
     {
-        std::unique_lock<std::mutex>(g_configlock);
-        g_config->get("ohsrc_scripts_dir", scripts_dir);
+        std::unique_lock<std::mutex> lock(g_configlock);
+        scripts_dir = dflt_scripts_dir;
+        conf->get("ohsrc_scripts_dir", scripts_dir);
     }
 
     DIR *dirp = opendir(scripts_dir.c_str());
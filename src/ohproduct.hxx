@@ -18,6 +18,8 @@
 #define _OHPRODUCT_H_X_INCLUDED_
 
 #include <string>                       // for string
+#include <unordered_map>                // for unordered_map
+#include <utility>                      // for pair
 #include <vector>                       // for vector
 
 #include "upmpd.hxx"                    // for ohProductDesc_t
@@ -27,6 +29,7 @@
 #include "ohservice.hxx"
 
 class UpMpd;
+class ConfSimple;
 using namespace UPnPP;
 
 class OHProduct : public OHService {
@@ -39,6 +42,8 @@ public:
 
 protected:
     virtual bool makestate(std::unordered_map<std::string, std::string> &st);
+    virtual void makestaticstate(
+        std::unordered_map<std::string, SharedStrValue>& st);
 
 private:
     int manufacturer(const SoapIncoming& sc, SoapOutgoing& data);
@@ -56,10 +61,18 @@ private:
     int sourceXMLChangeCount(const SoapIncoming& sc, SoapOutgoing& data);
 
     int iSrcNameToIndex(const std::string& nm);
+    void buildSources(ConfSimple *conf,
+                      std::vector<std::pair<std::string, std::string> >& srcs);
+    void setSourceXml();
+    void reloadSources(ConfSimple *conf);
     
     ohProductDesc_t& m_ohProductDesc;
+    // Fixed description values, built once.
+    std::unordered_map<std::string, SharedStrValue> m_descstate;
     int m_sourceIndex;
     bool m_standby;
+    // Configuration generation (confwatch) for the source list
+    int m_confgen;
 };
 
 #endif /* _OHPRODUCT_H_X_INCLUDED_ */
@@ -24,6 +24,7 @@
 #include <functional>
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -41,6 +42,8 @@
 #include "execmd.h"
 #include "ohproduct.hxx"
 #include "ohinfo.hxx"
+#include "metrics.hxx"
+#include "confwatch.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -61,13 +64,34 @@ struct RadioMeta {
     string artUri;
     vector<string> artScript;
     string dynArtUri;
+    // Channel id. Kept when the list is reloaded if the entry did
+    // not change.
+    unsigned int id{0};
+    bool sameAs(const RadioMeta& o) const {
+        return title == o.title && uri == o.uri && artUri == o.artUri &&
+            artScript == o.artScript;
+    }
 };
 
 static vector<RadioMeta> o_radios;
+// Channel id to o_radios index
+static unordered_map<unsigned int, size_t> o_radioidx;
+static unsigned int o_nextid = 1;
+// IdArray token, incremented when the list changes.
+static int o_listtoken = 1;
+
+static RadioMeta *radioForId(unsigned int id)
+{
+    auto it = o_radioidx.find(id);
+    if (it == o_radioidx.end()) {
+        return nullptr;
+    }
+    return &o_radios[it->second];
+}
 
 OHRadio::OHRadio(UpMpd *dev)
     : OHService(sTpProduct, sIdProduct, dev), m_active(false),
-      m_id(0), m_ok(false)
+      m_id(0), m_ok(false), m_protocolInfo(g_protocolInfo), m_confgen(0)
 {
     // Need Python
     string pypath;
@@ -75,47 +99,52 @@ OHRadio::OHRadio(UpMpd *dev)
         LOGINF("OHRadio: python2 not found, no radio service will be created\n");
         return;
     }
-    if (!readRadios()) {
+    bool ok;
+    {
+        std::unique_lock<std::mutex> lock(g_configlock);
+        ok = readRadios(g_config);
+    }
+    if (!ok) {
         LOGINF("OHRadio: readRadios() failed, no radio service will be created\n");
         return;
     }
     m_ok = true;
     
-    dev->addActionMapping(this, "Channel",
+    metricsAddAction(dev, this, "Channel",
                           bind(&OHRadio::channel, this, _1, _2));
-    dev->addActionMapping(this, "ChannelsMax",
+    metricsAddAction(dev, this, "ChannelsMax",
                           bind(&OHRadio::channelsMax, this, _1, _2));
-    dev->addActionMapping(this, "Id",
+    metricsAddAction(dev, this, "Id",
                           bind(&OHRadio::id, this, _1, _2));
-    dev->addActionMapping(this, "IdArray",
+    metricsAddAction(dev, this, "IdArray",
                           bind(&OHRadio::idArray, this, _1, _2));
-    dev->addActionMapping(this, "IdArrayChanged",
+    metricsAddAction(dev, this, "IdArrayChanged",
                           bind(&OHRadio::idArrayChanged, this, _1, _2));
-    dev->addActionMapping(this, "Pause",
+    metricsAddAction(dev, this, "Pause",
                           bind(&OHRadio::pause, this, _1, _2));
-    dev->addActionMapping(this, "Play",
+    metricsAddAction(dev, this, "Play",
                           bind(&OHRadio::play, this, _1, _2));
-    dev->addActionMapping(this, "ProtocolInfo",
+    metricsAddAction(dev, this, "ProtocolInfo",
                           bind(&OHRadio::protocolInfo, this, _1, _2));
-    dev->addActionMapping(this, "Read",
+    metricsAddAction(dev, this, "Read",
                           bind(&OHRadio::ohread, this, _1, _2));
-    dev->addActionMapping(this, "ReadList",
+    metricsAddAction(dev, this, "ReadList",
                           bind(&OHRadio::readList, this, _1, _2));
-    dev->addActionMapping(this, "SeekSecondAbsolute",
+    metricsAddAction(dev, this, "SeekSecondAbsolute",
                           bind(&OHRadio::seekSecondAbsolute, this, _1, _2));
-    dev->addActionMapping(this, "SeekSecondRelative",
+    metricsAddAction(dev, this, "SeekSecondRelative",
                           bind(&OHRadio::seekSecondRelative, this, _1, _2));
-    dev->addActionMapping(this, "SetChannel",
+    metricsAddAction(dev, this, "SetChannel",
                           bind(&OHRadio::setChannel, this, _1, _2));
-    dev->addActionMapping(this, "SetId",
+    metricsAddAction(dev, this, "SetId",
                           bind(&OHRadio::setId, this, _1, _2));
-    dev->addActionMapping(this, "Stop",
+    metricsAddAction(dev, this, "Stop",
                           bind(&OHRadio::stop, this, _1, _2));
-    dev->addActionMapping(this, "TransportState",
+    metricsAddAction(dev, this, "TransportState",
                           bind(&OHRadio::transportState, this, _1, _2));
 }
 
-static void getRadiosFromConf(ConfSimple* conf)
+static void getRadiosFromConf(ConfSimple* conf, vector<RadioMeta>& radios)
 {
     vector<string> allsubk = conf->getSubKeys_unsorted();
     for (auto it = allsubk.begin(); it != allsubk.end(); it++) {
@@ -127,7 +156,7 @@ static void getRadiosFromConf(ConfSimple* conf)
             conf->get("artScript", artScript, *it);
             trimstring(artScript, " \t\n\r");
             if (ok && !uri.empty()) {
-                o_radios.push_back(RadioMeta(title, uri, artUri, artScript));
+                radios.push_back(RadioMeta(title, uri, artUri, artScript));
                 LOGDEB1("OHRadio::readRadios:RADIO: [" << title << "] uri ["
                         << uri << "] artUri [" << artUri << "]\n");
             }
@@ -135,23 +164,79 @@ static void getRadiosFromConf(ConfSimple* conf)
     }
 }
 
-bool OHRadio::readRadios()
+// Read or reread the channel list. This is called from the
+// constructor, and from makestate() when the configuration changed,
+// so that Control Points only have to fetch the new or modified
+// channels (unchanged ones keep their id).
+bool OHRadio::readRadios(ConfSimple *conf)
 {
-    // Id 0 means no selection
-    o_radios.push_back(RadioMeta("Unknown radio", "", ""));
+    vector<RadioMeta> radios;
+    // Id 0 means no selection. Keep the current SetChannel data
+    if (o_radios.empty()) {
+        radios.push_back(RadioMeta("Unknown radio", "", ""));
+    } else {
+        radios.push_back(o_radios[0]);
+    }
     
-    std::unique_lock<std::mutex>(g_configlock);
-    getRadiosFromConf(g_config);
+    getRadiosFromConf(conf, radios);
     // Also if radiolist is defined, get from there
     string radiolistfn;
-    if (g_config->get("radiolist", radiolistfn)) {
-        ConfSimple rdconf(radiolistfn.c_str(), 1);
+    if (conf->get("radiolist", radiolistfn)) {
+        ConfSimple rdconf(radiolistfn.c_str(), 1, false, true);
         if (!rdconf.ok()) {
             LOGERR("OHRadio::readRadios: failed initializing from " <<
                    radiolistfn << endl);
         } else {
-            getRadiosFromConf(&rdconf);
+            getRadiosFromConf(&rdconf, radios);
+        }
+    }
+
+    bool changed = radios.size() != o_radios.size();
+    // Old channels by (title, uri), in list order
+    unordered_map<string, vector<size_t> > oldbykey;
+    for (size_t j = 1; j < o_radios.size(); j++) {
+        oldbykey[o_radios[j].title + '\0' + o_radios[j].uri].push_back(j);
+    }
+    unordered_map<unsigned int, size_t> idx;
+    idx[0] = 0;
+    for (size_t i = 1; i < radios.size(); i++) {
+        auto it = oldbykey.find(radios[i].title + '\0' + radios[i].uri);
+        if (it != oldbykey.end()) {
+            for (size_t j : it->second) {
+                if (radios[i].sameAs(o_radios[j]) &&
+                    idx.find(o_radios[j].id) == idx.end()) {
+                    radios[i].id = o_radios[j].id;
+                    radios[i].dynArtUri = o_radios[j].dynArtUri;
+                    break;
+                }
+            }
         }
+        if (radios[i].id == 0) {
+            radios[i].id = o_nextid++;
+        }
+        if (i >= o_radios.size() || radios[i].id != o_radios[i].id) {
+            changed = true;
+        }
+        idx[radios[i].id] = i;
+    }
+
+    // If the current channel is gone, keep playing it as an
+    // anonymous one (as for SetChannel).
+    if (m_id != 0 && idx.find(m_id) == idx.end()) {
+        RadioMeta *current = radioForId(m_id);
+        if (current) {
+            radios[0] = *current;
+            radios[0].id = 0;
+        }
+        m_id = 0;
+    }
+
+    o_radios.swap(radios);
+    o_radioidx.swap(idx);
+    if (changed && !radios.empty()) {
+        o_listtoken++;
+        LOGINF("OHRadio::readRadios: channel list changed, " <<
+               o_radios.size() - 1 << " channels\n");
     }
     return true;
 }
@@ -173,14 +258,15 @@ static string mpdstatusToTransportState(MpdStatus::State st)
 }
 
 // The data format for id lists is an array of msb 32 bits ints
-// encoded in base64. The values could be anything, but, for us, they
-// are just the indices into o_radios(), beginning at 1 because 0 is
-// special (it's reserved in o_radios too).
+// encoded in base64. The values could be anything, for us they are
+// the RadioMeta ids, beginning at 1 because 0 is special (it's the
+// reserved o_radios[0] entry).
 bool OHRadio::makeIdArray(string& out)
 {
     //LOGDEB1("OHRadio::makeIdArray\n");
     string out1;
-    for (unsigned int val = 1; val < o_radios.size(); val++) {
+    for (unsigned int i = 1; i < o_radios.size(); i++) {
+        unsigned int val = o_radios[i].id;
         out1 += (unsigned char) ((val & 0xff000000) >> 24);
         out1 += (unsigned char) ((val & 0x00ff0000) >> 16);
         out1 += (unsigned char) ((val & 0x0000ff00) >> 8);
@@ -194,19 +280,28 @@ bool OHRadio::makestate(unordered_map<string, string>& st)
 {
     st.clear();
 
+    if (confWatchGeneration() != m_confgen) {
+        m_confgen = confWatchGeneration();
+        shared_ptr<ConfSimple> conf = confWatchConfig();
+        if (conf) {
+            readRadios(conf.get());
+        }
+    }
+
     MpdStatus mpds = m_dev->getMpdStatusNoUpdate();
 
     st["ChannelsMax"] = SoapHelp::i2s(o_radios.size());
     st["Id"] = SoapHelp::i2s(m_id);
     makeIdArray(st["IdArray"]);
-    if (m_active && m_id >= 0 && m_id < o_radios.size()) {
+    RadioMeta *current = radioForId(m_id);
+    if (m_active && current) {
+        RadioMeta& radio = *current;
         if (mpds.currentsong.album.empty()) {
-            mpds.currentsong.album = o_radios[m_id].title;
+            mpds.currentsong.album = radio.title;
         }
 
         // Some radios provide a url to the art for the current song. Possibly
         // execute script to retrieve it
-        RadioMeta& radio = o_radios[m_id];
         LOGDEB2("OHRadio::makestate: artScript: " << radio.artScript << endl);
         if (radio.artScript.size()) {
             string nsong(mpds.currentsong.title + mpds.currentsong.artist);
@@ -214,6 +309,9 @@ bool OHRadio::makestate(unordered_map<string, string>& st)
                 m_currentsong = nsong;
                 string uri;
                 radio.dynArtUri.clear();
+                static MetricsHistogram *exechist = metricsHistogram(
+                    "upmpdcli_exec_seconds", "cmd=\"radioartscript\"");
+                MetricsTimer timer(exechist);
                 if (ExecCmd::backtick(radio.artScript, uri)) {
                     trimstring(uri, " \t\r\n");
                     LOGDEB("OHRadio::makestate: artScript got: [" << uri <<
@@ -234,12 +332,16 @@ bool OHRadio::makestate(unordered_map<string, string>& st)
         st["Metadata"] =  "";
         m_dev->m_ohif->setMetatext("");
     }
-    st["ProtocolInfo"] = g_protocolInfo;
     st["TransportState"] =  mpdstatusToTransportState(mpds.state);
     st["Uri"] = mpds.currentsong.uri;
     return true;
 }
 
+void OHRadio::makestaticstate(unordered_map<string, SharedStrValue>& st)
+{
+    st["ProtocolInfo"] = m_protocolInfo;
+}
+
 void OHRadio::maybeWakeUp(bool ok)
 {
     if (ok && m_dev) {
@@ -249,9 +351,10 @@ void OHRadio::maybeWakeUp(bool ok)
 
 int OHRadio::setPlaying()
 {
-    if (m_id > o_radios.size() || o_radios[m_id].uri.empty()) {
+    RadioMeta *radio = radioForId(m_id);
+    if (nullptr == radio || radio->uri.empty()) {
         LOGERR("OHRadio::setPlaying: called with bad id (" << m_id <<
-               ") or empty preset uri [" << o_radios[m_id].uri << "]\n");
+               ") or empty preset uri\n");
         return UPNP_E_INTERNAL_ERROR;
     }
     
@@ -259,9 +362,12 @@ int OHRadio::setPlaying()
     cmdpath = path_cat(cmdpath, "fetchStream.py");
 
     // Execute the playlist parser
+    static MetricsHistogram *exechist =
+        metricsHistogram("upmpdcli_exec_seconds", "cmd=\"fetchstream\"");
+    MetricsTimer timer(exechist);
     ExecCmd cmd;
     vector<string> args;
-    args.push_back(o_radios[m_id].uri);
+    args.push_back(radio->uri);
     LOGDEB("OHRadio::setPlaying: exec: " << cmdpath << " " << args[0] << endl);
     if (cmd.startExec(cmdpath, args, false, true) < 0) {
         LOGDEB("OHRadio::setPlaying: startExec failed for " <<
@@ -284,8 +390,8 @@ int OHRadio::setPlaying()
     // Send url to mpd
     m_dev->m_mpdcli->clearQueue();
     UpSong song;
-    song.album = o_radios[m_id].title;
-    song.uri = o_radios[m_id].uri;
+    song.album = radio->title;
+    song.uri = radio->uri;
     if (m_dev->m_mpdcli->insert(audiourl, 0, song) < 0) {
         LOGDEB("OHRadio::setPlaying: mpd insert failed\n");
         return UPNP_E_INTERNAL_ERROR;
@@ -380,7 +486,7 @@ int OHRadio::setId(const SoapIncoming& sc, SoapOutgoing& data)
         LOGDEB("OHRadio::setId: no value ??\n");
         return UPNP_E_INTERNAL_ERROR;
     }
-    if (id <= 0 || id > int(o_radios.size())) {
+    if (id <= 0 || nullptr == radioForId(id)) {
         LOGDEB("OHRadio::setId: bad value " << id << endl);
         return UPNP_E_INTERNAL_ERROR;
     }
@@ -429,14 +535,14 @@ string OHRadio::metaForId(unsigned int id)
 {
     LOGDEB1("OHRadio::metaForId: id " << id << " m_id " << m_id << endl);
     string meta;
-    if (id >= 0 && id  < o_radios.size()) {
+    RadioMeta *radio = radioForId(id);
+    if (radio) {
         if (false && id == m_id) {
             LOGDEB1("OHRadio::metaForId: using Metatext\n");
             meta = m_state["Metadata"];
         } else {
             LOGDEB1("OHRadio::metaForId: using list data\n");
-            meta = radioDidlMake(o_radios[id].title, o_radios[id].uri, 
-                                 o_radios[id].artUri);
+            meta = radioDidlMake(radio->title, radio->uri, radio->artUri);
         }
     }
     return meta;
@@ -449,7 +555,7 @@ int OHRadio::ohread(const SoapIncoming& sc, SoapOutgoing& data)
     bool ok = sc.get("Id", &id);
     if (ok) {
         LOGDEB("OHRadio::read id " << id << endl);
-        if (id >= 0 && id  < int(o_radios.size())) {
+        if (id >= 0 && radioForId(id)) {
             string meta = metaForId(id);
             data.addarg("Metadata", meta);
         } else {
@@ -484,7 +590,8 @@ int OHRadio::readList(const SoapIncoming& sc, SoapOutgoing& data)
         stringToTokens(sids, ids);
         for (auto it = ids.begin(); it != ids.end(); it++) {
             int id = atoi(it->c_str());
-            if (id <= 0 || id >= int(o_radios.size())) {
+            RadioMeta *radio = id > 0 ? radioForId(id) : nullptr;
+            if (nullptr == radio) {
                 LOGDEB("OHRadio::readlist: bad id " << id << endl);
                 continue;
             }
@@ -492,7 +599,7 @@ int OHRadio::readList(const SoapIncoming& sc, SoapOutgoing& data)
             out += "<Entry><Id>";
             out += *it;
             out += "</Id><Uri>";
-            out += SoapHelp::xmlQuote(o_radios[id].uri);
+            out += SoapHelp::xmlQuote(radio->uri);
             out += "</Uri><Metadata>";
             out += SoapHelp::xmlQuote(meta);
             out += "</Metadata></Entry>";
@@ -511,7 +618,7 @@ int OHRadio::idArray(const SoapIncoming& sc, SoapOutgoing& data)
     LOGDEB("OHRadio::idArray" << endl);
     string idarray;
     if (makeIdArray(idarray)) {
-        data.addarg("Token", SoapHelp::i2s(1));
+        data.addarg("Token", SoapHelp::i2s(o_listtoken));
         data.addarg("Array", idarray);
         return UPNP_E_SUCCESS;
     }
@@ -570,11 +677,13 @@ int OHRadio::transportState(const SoapIncoming& sc, SoapOutgoing& data)
 }
 
 // Check if id array changed since last call (which returned a gen
-// token). Our array never changes
+// token). The array only changes when the configuration is reloaded.
 int OHRadio::idArrayChanged(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHRadio::idArrayChanged" << endl);
-    data.addarg("Value", SoapHelp::i2s(0));
+    int token = o_listtoken;
+    sc.get("Token", &token);
+    data.addarg("Value", SoapHelp::i2s(token != o_listtoken));
     return UPNP_E_SUCCESS;
 }
 
@@ -588,6 +697,6 @@ int OHRadio::channelsMax(const SoapIncoming& sc, SoapOutgoing& data)
 int OHRadio::protocolInfo(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHRadio::protocolInfo" << endl);
-    data.addarg("Value", g_protocolInfo);
+    data.addarg("Value", m_protocolInfo.value());
     return UPNP_E_SUCCESS;
 }
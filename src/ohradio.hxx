@@ -27,6 +27,7 @@
 #include "ohservice.hxx"
 
 class UpMpd;
+class ConfSimple;
 
 using namespace UPnPP;
 
@@ -46,6 +47,7 @@ public:
 
 protected:
     bool makestate(std::unordered_map<std::string, std::string>& st);
+    void makestaticstate(std::unordered_map<std::string, SharedStrValue>& st);
     
 private:
     int channel(const SoapIncoming& sc, SoapOutgoing& data);
@@ -66,7 +68,7 @@ private:
     int transportState(const SoapIncoming& sc, SoapOutgoing& data);
 
     std::string metaForId(unsigned int id);
-    bool readRadios();
+    bool readRadios(ConfSimple *conf);
     int setPlaying();
     bool makeIdArray(std::string&);
     void maybeWakeUp(bool ok);
@@ -79,6 +81,9 @@ private:
     // executing possible configured art uri fetch script
     std::string m_currentsong;
     bool m_ok;
+    SharedStrValue m_protocolInfo;
+    // Configuration generation (confwatch) for the channel list
+    int m_confgen;
 };
 
 #endif /* _OHRADIO_H_X_INCLUDED_ */
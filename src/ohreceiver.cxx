@@ -21,6 +21,7 @@
 
 #include <upnp/upnp.h>                  // for UPNP_E_SUCCESS, etc
 
+#include <chrono>
 #include <functional>                   // for _Bind, bind, _1, _2
 #include <iostream>                     // for endl, etc
 #include <string>                       // for string, allocator, etc
@@ -35,6 +36,7 @@
 #include "upmpdutils.hxx"               // for didlmake, diffmaps, etc
 #include "ohplaylist.hxx"
 #include "ohproduct.hxx"
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -46,17 +48,20 @@ OHReceiver::OHReceiver(UpMpd *dev, const OHReceiverParams& parms)
     : OHService(sTpProduct, sIdProduct, dev), m_active(false),
       m_httpport(parms.httpport), m_sc2mpdpath(parms.sc2mpdpath), m_pm(parms.pm)
 {
-    dev->addActionMapping(this, "Play", 
+    // In alsa mode, sc2mpd plays as soon as it is connected, so it
+    // can't be started in advance.
+    m_usestandby = parms.standby && m_pm == OHReceiverParams::OHRP_MPD;
+    metricsAddAction(dev, this, "Play", 
                           bind(&OHReceiver::play, this, _1, _2));
-    dev->addActionMapping(this, "Stop", 
+    metricsAddAction(dev, this, "Stop", 
                           bind(&OHReceiver::stop, this, _1, _2));
-    dev->addActionMapping(this, "SetSender",
+    metricsAddAction(dev, this, "SetSender",
                           bind(&OHReceiver::setSender, this, _1, _2));
-    dev->addActionMapping(this, "Sender", 
+    metricsAddAction(dev, this, "Sender", 
                           bind(&OHReceiver::sender, this, _1, _2));
-    dev->addActionMapping(this, "ProtocolInfo",
+    metricsAddAction(dev, this, "ProtocolInfo",
                           bind(&OHReceiver::protocolInfo, this, _1, _2));
-    dev->addActionMapping(this, "TransportState",
+    metricsAddAction(dev, this, "TransportState",
                           bind(&OHReceiver::transportState, this, _1, _2));
 
     m_httpuri = "http://localhost:"+ SoapHelp::i2s(m_httpport) + 
@@ -75,6 +80,7 @@ bool OHReceiver::makestate(unordered_map<string, string> &st)
             // avtransport. I'm not sure we're supposed to let this
             // happen, but we do. Stop too.
             iStop();
+            startStandby();
         }
     } else {
         if (m_cmd) {
@@ -111,8 +117,91 @@ void OHReceiver::maybeWakeUp(bool ok)
 void OHReceiver::setActive(bool onoff)
 {
     m_active = onoff;
-    if (!m_active)
+    if (m_active) {
+        startStandby();
+    } else {
         iStop();
+        stopStandby();
+    }
+}
+
+// Start the songcast command to receive the audio flux and either
+// export it as HTTP, or play it directly to the sound card.
+bool OHReceiver::execsc2mpd(shared_ptr<ExecCmd> cmd)
+{
+    vector<string> args;
+    if (m_pm == OHReceiverParams::OHRP_ALSA) {
+        args.push_back("-d");
+    }
+    args.push_back("-u");
+    args.push_back(m_uri);
+    if (!g_configfilename.empty()) {
+        args.push_back("-c");
+        args.push_back(g_configfilename);
+    }
+        
+    LOGDEB("OHReceiver: executing " << m_sc2mpdpath << endl);
+    static MetricsHistogram *exechist =
+        metricsHistogram("upmpdcli_exec_seconds", "cmd=\"sc2mpd\"");
+    MetricsTimer timer(exechist);
+    if (cmd->startExec(m_sc2mpdpath, args, false, true) < 0) {
+        LOGERR("OHReceiver: executing " << m_sc2mpdpath << " failed" << endl);
+        return false;
+    }
+    LOGDEB("OHReceiver: sc2mpd pid "<< cmd->getChildPid()<< endl);
+    return true;
+}
+
+// In mpd mode, the sc2mpd startup (process creation, connection to
+// the sender, and HTTP server setup, signalled by the CONNECTED
+// line), is most of the Play latency. While the Receiver source is
+// selected and we know the sender, we keep a process ready to
+// use. It is only connected to mpd by Play.
+void OHReceiver::startStandby()
+{
+    if (!m_usestandby || !m_active || m_uri.empty() || m_cmd) {
+        return;
+    }
+    if (m_standby && m_standbyuri == m_uri) {
+        int status;
+        if (!m_standby->maybereap(&status)) {
+            return;
+        }
+        LOGDEB("OHReceiver: standby sc2mpd exited with status " << status
+               << endl);
+    }
+    stopStandby();
+    m_standby = shared_ptr<ExecCmd>(new ExecCmd());
+    if (!execsc2mpd(m_standby)) {
+        m_standby.reset();
+        return;
+    }
+    m_standbyuri = m_uri;
+}
+
+void OHReceiver::stopStandby()
+{
+    if (m_standby) {
+        m_standby->zapChild();
+        m_standby.reset();
+    }
+}
+
+// Return the standby process if it is usable for the current uri.
+shared_ptr<ExecCmd> OHReceiver::takeStandby()
+{
+    shared_ptr<ExecCmd> cmd;
+    if (m_standby && m_standbyuri == m_uri) {
+        int status;
+        if (m_standby->maybereap(&status)) {
+            LOGDEB("OHReceiver: standby sc2mpd exited with status " << status
+                   << endl);
+        } else {
+            cmd.swap(m_standby);
+        }
+    }
+    stopStandby();
+    return cmd;
 }
 
 bool OHReceiver::iPlay()
@@ -132,35 +221,28 @@ bool OHReceiver::iPlay()
         return false;
     }
 
+    auto start = chrono::steady_clock::now();
     int id = -1;
-    unordered_map<int, string> urlmap;
+    vector<int> ids;
     string line;
+    bool warm = false;
         
-    // We start the songcast command to receive the audio flux and either
+    // We need an sc2mpd process to receive the audio flux and either
     // export it as HTTP (then insert http URI at the front of the
-    // queue and execute next/play), or play it directly to the sound card
+    // queue and execute next/play), or play it directly to the sound
+    // card. Use the standby one if it is there.
     if (m_cmd)
         m_cmd->zapChild();
-    m_cmd = shared_ptr<ExecCmd>(new ExecCmd());
-    vector<string> args;
-    if (m_pm == OHReceiverParams::OHRP_ALSA) {
-        args.push_back("-d");
-    }
-    args.push_back("-u");
-    args.push_back(m_uri);
-    if (!g_configfilename.empty()) {
-        args.push_back("-c");
-        args.push_back(g_configfilename);
-    }
-        
-    LOGDEB("OHReceiver::play: executing " << m_sc2mpdpath << endl);
-    ok = m_cmd->startExec(m_sc2mpdpath, args, false, true) >= 0;
-    if (!ok) {
-        LOGERR("OHReceiver::play: executing " << m_sc2mpdpath << " failed" 
-               << endl);
-        goto out;
+    m_cmd = takeStandby();
+    if (m_cmd) {
+        warm = true;
+        LOGDEB("OHReceiver::play: using standby sc2mpd pid " <<
+               m_cmd->getChildPid() << endl);
     } else {
-        LOGDEB("OHReceiver::play: sc2mpd pid "<< m_cmd->getChildPid()<< endl);
+        m_cmd = shared_ptr<ExecCmd>(new ExecCmd());
+        if (!execsc2mpd(m_cmd)) {
+            goto out;
+        }
     }
 
     if (m_pm == OHReceiverParams::OHRP_MPD) {
@@ -169,6 +251,7 @@ bool OHReceiver::iPlay()
         // Wait for sc2mpd to signal ready, then play.
         // sc2mpd writes a single line to stdout "CONNECTED" when
         // it gets there, which should be more or less instantaneous
+        // (and is normally already done for a standby process).
         int timeo = 15;
         if (m_cmd->getline(line, timeo) < 0) {
             LOGERR("OHReceiver: mpd mode: sc2mpd still not ready to play after "
@@ -176,17 +259,15 @@ bool OHReceiver::iPlay()
             goto out;
         }
         LOGDEB("OHReceiver: sc2mpd sent: " << line);
-        // And insert the appropriate uri in the mpd playlist
-        if (!m_dev->m_ohpl->urlMap(urlmap)) {
-            LOGERR("OHReceiver::play: urlMap() failed" <<endl);
+        // And insert the appropriate uri in the mpd playlist, if it's
+        // not already there.
+        if (!m_dev->m_mpdcli->getIdsForUri(m_httpuri, ids)) {
+            LOGERR("OHReceiver::play: getIdsForUri() failed" <<endl);
             goto out;
         }
-        for (auto it = urlmap.begin(); it != urlmap.end(); it++) {
-            if (it->second == m_httpuri) {
-                id = it->first;
-            }
-        }
-        if (id == -1) {
+        if (!ids.empty()) {
+            id = ids[0];
+        } else {
             UpSong metaformpd;
             string metadata(SoapHelp::xmlUnquote(m_metadata));
             if (!uMetaToUpSong(metadata, &metaformpd)) {
@@ -207,11 +288,23 @@ bool OHReceiver::iPlay()
             LOGERR("OHReceiver::play: play() failed\n");
             goto out;
         }
+    } else {
+        ok = true;
     }
 
 out:
     if (!ok) {
         iStop();
+    } else {
+        static MetricsHistogram *coldhist = metricsHistogram(
+            "upmpdcli_receiver_start_seconds", "standby=\"0\"");
+        static MetricsHistogram *warmhist = metricsHistogram(
+            "upmpdcli_receiver_start_seconds", "standby=\"1\"");
+        uint64_t us = chrono::duration_cast<chrono::microseconds>(
+            chrono::steady_clock::now() - start).count();
+        (warm ? warmhist : coldhist)->record(us);
+        LOGINF("OHReceiver::play: started in " << us / 1000 << " mS" <<
+               (warm ? " (standby sc2mpd)" : "") << endl);
     }
     return ok;
 }
@@ -236,15 +329,13 @@ bool OHReceiver::iStop()
 
     if (m_pm == OHReceiverParams::OHRP_MPD) {
         m_dev->m_mpdcli->stop();
-        unordered_map<int, string> urlmap;
+        vector<int> ids;
         // Remove our bogus URi from the playlist
-        if (!m_dev->m_ohpl->urlMap(urlmap)) {
-            LOGERR("OHReceiver::stop: urlMap() failed" <<endl);
+        if (!m_dev->m_mpdcli->getIdsForUri(m_httpuri, ids)) {
+            LOGERR("OHReceiver::stop: getIdsForUri() failed" <<endl);
         }
-        for (auto it = urlmap.begin(); it != urlmap.end(); it++) {
-            if (it->second == m_httpuri) {
-                m_dev->m_mpdcli->deleteId(it->first);
-            }
+        for (auto id : ids) {
+            m_dev->m_mpdcli->deleteId(id);
         }
     }
     
@@ -255,6 +346,8 @@ int OHReceiver::stop(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHReceiver::stop" << endl);
     iStop();
+    // Get ready for the next Play
+    startStandby();
 
     // At least the songcast windows driver never resets the source
     // index (it does call stop when it deconnects).
@@ -281,6 +374,7 @@ bool OHReceiver::iSetSender(const string& uri, const string& metadata)
         m_metadata = metadata;
         LOGDEB("OHReceiver::setSender: uri [" << m_uri << "] meta [" << 
                m_metadata << "]" << endl);
+        startStandby();
     }
     return true;
 }
@@ -38,7 +38,10 @@ struct OHReceiverParams {
     PlayMethod pm;
     int httpport;
     std::string sc2mpdpath;
-    OHReceiverParams() : pm(OHRP_MPD), httpport(8768) {}
+    // Keep an sc2mpd process connected to the sender while the
+    // Receiver source is selected (mpd mode only).
+    bool standby;
+    OHReceiverParams() : pm(OHRP_MPD), httpport(8768), standby(true) {}
 };
 
 class OHReceiver : public OHService {
@@ -63,6 +66,10 @@ private:
     int transportState(const SoapIncoming& sc, SoapOutgoing& data);
 
     void maybeWakeUp(bool ok);
+    bool execsc2mpd(std::shared_ptr<ExecCmd> cmd);
+    void startStandby();
+    void stopStandby();
+    std::shared_ptr<ExecCmd> takeStandby();
 
     // Current
     std::string m_uri;
@@ -70,6 +77,10 @@ private:
 
     bool   m_active;
     std::shared_ptr<ExecCmd> m_cmd;
+    // Pre-started sc2mpd, and the sender uri it was started for.
+    std::shared_ptr<ExecCmd> m_standby;
+    std::string m_standbyuri;
+    bool m_usestandby;
     int m_httpport;
     std::string m_sc2mpdpath;
     std::string m_httpuri;
@@ -24,6 +24,7 @@
 #include "libupnpp/device/device.hxx"
 #include "upmpdutils.hxx"
 #include "upmpd.hxx"
+#include "metrics.hxx"
 
 using namespace UPnPP;
 
@@ -32,13 +33,15 @@ using namespace UPnPP;
 class OHService : public UPnPProvider::UpnpService {
 public:
     OHService(const std::string& servtp, const std::string &servid, UpMpd *dev)
-        : UpnpService(servtp, servid, dev), m_dev(dev) {
+        : UpnpService(servtp, servid, dev), m_dev(dev),
+          m_evhist(metricsEventHistogram(servid)) {
     }
     virtual ~OHService() { }
 
     virtual bool getEventData(bool all, std::vector<std::string>& names, 
                               std::vector<std::string>& values) {
         //LOGDEB("OHService::getEventData" << std::endl);
+        MetricsTimer timer(m_evhist);
 
         std::unordered_map<std::string, std::string> state, changed;
         makestate(state);
@@ -56,14 +59,34 @@ public:
             values.push_back(it.second);
         }
 
+        // Static values are only sent on subscription or if they changed.
+        std::unordered_map<std::string, SharedStrValue> sstate;
+        makestaticstate(sstate);
+        for (const auto& it : sstate) {
+            auto old = m_staticstate.find(it.first);
+            if (all || old == m_staticstate.end() ||
+                !old->second.sameAs(it.second)) {
+                names.push_back(it.first);
+                values.push_back(it.second.value());
+            }
+        }
+        m_staticstate.swap(sstate);
+
         return true;
     }
     
 protected:
     virtual bool makestate(std::unordered_map<std::string, std::string> &) = 0;
+    // Big, rarely changing, state values. These are not copied or
+    // compared on each event poll.
+    virtual void makestaticstate(
+        std::unordered_map<std::string, SharedStrValue>&) {
+    }
     // State variable storage
     std::unordered_map<std::string, std::string> m_state;
+    std::unordered_map<std::string, SharedStrValue> m_staticstate;
     UpMpd *m_dev;
+    MetricsHistogram *m_evhist;
 };
 
 #endif /* _OHSERVICE_H_X_INCLUDED_ */
@@ -32,6 +32,7 @@
 #include "mpdcli.hxx"                   // for MpdStatus, etc
 #include "upmpd.hxx"                    // for UpMpd
 #include "upmpdutils.hxx"               // for diffmaps
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -42,15 +43,12 @@ static const string sIdProduct("urn:av-openhome-org:serviceId:Time");
 OHTime::OHTime(UpMpd *dev)
     : OHService(sTpProduct, sIdProduct, dev)
 {
-    dev->addActionMapping(this, "Time", bind(&OHTime::ohtime, this, _1, _2));
+    metricsAddAction(dev, this, "Time", bind(&OHTime::ohtime, this, _1, _2));
 }
 
-void OHTime::getdata(string& trackcount, string &duration, 
-                     string& seconds)
+void OHTime::getdata(const MpdStatus& mpds, string& trackcount,
+                     string &duration, string& seconds)
 {
-    // We're relying on AVTransport to have updated the status for us
-    const MpdStatus& mpds =  m_dev->getMpdStatusNoUpdate();
-
     trackcount = SoapHelp::i2s(mpds.trackcounter);
 
     bool is_song = (mpds.state == MpdStatus::MPDS_PLAY) || 
@@ -67,7 +65,8 @@ void OHTime::getdata(string& trackcount, string &duration,
 bool OHTime::makestate(unordered_map<string, string> &st)
 {
     st.clear();
-    getdata(st["TrackCount"], st["Duration"], st["Seconds"]);
+    // We're relying on AVTransport to have updated the status for us
+    getdata(m_dev->getMpdStatusNoUpdate(), st["TrackCount"], st["Duration"], st["Seconds"]);
     return true;
 }
 
@@ -75,7 +74,7 @@ int OHTime::ohtime(const SoapIncoming& sc, SoapOutgoing& data)
 {
     LOGDEB("OHTime::ohtime" << endl);
     string trackcount, duration, seconds;
-    getdata(trackcount, duration, seconds);
+    getdata(m_dev->getMpdStatusInterpolated(), trackcount, duration, seconds);
     data.addarg("TrackCount", trackcount);
     data.addarg("Duration", duration);
     data.addarg("Seconds", seconds);
@@ -39,8 +39,8 @@ protected:
 private:
     int ohtime(const SoapIncoming& sc, SoapOutgoing& data);
 
-    void getdata(std::string& trackcount, std::string &duration,
-                 std::string& seconds);
+    void getdata(const MpdStatus& mpds, std::string& trackcount,
+                 std::string &duration, std::string& seconds);
 };
 
 #endif /* _OHTIME_H_X_INCLUDED_ */
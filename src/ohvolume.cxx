@@ -32,6 +32,7 @@
 #include "upmpd.hxx"
 #include "upmpdutils.hxx"
 #include "renderctl.hxx"
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -44,37 +45,37 @@ static const string sIdProduct("urn:av-openhome-org:serviceId:Volume");
 OHVolume::OHVolume(UpMpd *dev)
     : OHService(sTpProduct, sIdProduct, dev)
 {
-    dev->addActionMapping(this,"Characteristics", 
+    metricsAddAction(dev, this,"Characteristics", 
                           bind(&OHVolume::characteristics, this, _1, _2));
-    dev->addActionMapping(this,"SetVolume", 
+    metricsAddAction(dev, this,"SetVolume", 
                           bind(&OHVolume::setVolume, this, _1, _2));
-    dev->addActionMapping(this,"Volume", 
+    metricsAddAction(dev, this,"Volume", 
                           bind(&OHVolume::volume, this, _1, _2));
-    dev->addActionMapping(this,"VolumeInc", 
+    metricsAddAction(dev, this,"VolumeInc", 
                           bind(&OHVolume::volumeInc, this, _1, _2));
-    dev->addActionMapping(this,"VolumeDec", 
+    metricsAddAction(dev, this,"VolumeDec", 
                           bind(&OHVolume::volumeDec, this, _1, _2));
-    dev->addActionMapping(this,"VolumeLimit", 
+    metricsAddAction(dev, this,"VolumeLimit", 
                           bind(&OHVolume::volumeLimit, this, _1, _2));
-    dev->addActionMapping(this,"Mute", 
+    metricsAddAction(dev, this,"Mute", 
                           bind(&OHVolume::mute, this, _1, _2));
-    dev->addActionMapping(this,"SetMute", 
+    metricsAddAction(dev, this,"SetMute", 
                           bind(&OHVolume::setMute, this, _1, _2));
-    dev->addActionMapping(this,"SetBalance", 
+    metricsAddAction(dev, this,"SetBalance", 
                           bind(&OHVolume::setBalance, this, _1, _2));
-    dev->addActionMapping(this,"Balance", 
+    metricsAddAction(dev, this,"Balance", 
                           bind(&OHVolume::balance, this, _1, _2));
-    dev->addActionMapping(this,"BalanceInc", 
+    metricsAddAction(dev, this,"BalanceInc", 
                           bind(&OHVolume::balanceInc, this, _1, _2));
-    dev->addActionMapping(this,"BalanceDec", 
+    metricsAddAction(dev, this,"BalanceDec", 
                           bind(&OHVolume::balanceDec, this, _1, _2));
-    dev->addActionMapping(this,"SetFade", 
+    metricsAddAction(dev, this,"SetFade", 
                           bind(&OHVolume::setFade, this, _1, _2));
-    dev->addActionMapping(this,"Fade", 
+    metricsAddAction(dev, this,"Fade", 
                           bind(&OHVolume::fade, this, _1, _2));
-    dev->addActionMapping(this,"FadeInc", 
+    metricsAddAction(dev, this,"FadeInc", 
                           bind(&OHVolume::fadeInc, this, _1, _2));
-    dev->addActionMapping(this,"FadeDec", 
+    metricsAddAction(dev, this,"FadeDec", 
                           bind(&OHVolume::fadeDec, this, _1, _2));
 
 }
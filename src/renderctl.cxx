@@ -20,6 +20,7 @@
 #include <stdlib.h>                     // for atoi
 #include <upnp/upnp.h>                  // for UPNP_E_INVALID_PARAM, etc
 
+#include <algorithm>
 #include <functional>                   // for _Bind, bind, _1, _2
 #include <iostream>                     // for basic_ostream::operator<<, etc
 #include <map>                          // for _Rb_tree_const_iterator, etc
@@ -34,6 +35,7 @@
 #include "mpdcli.hxx"                   // for MPDCli, MpdStatus
 #include "upmpd.hxx"                    // for UpMpd
 #include "upmpdutils.hxx"               // for dbvaluetopercent, mapget, etc
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -43,23 +45,29 @@ static const string
 sTpRender("urn:schemas-upnp-org:service:RenderingControl:1");
 static const string sIdRender("urn:upnp-org:serviceId:RenderingControl");
 
-static const int minVolumeDelta = 5;
-
-UpMpdRenderCtl::UpMpdRenderCtl(UpMpd *dev, bool noev)
+UpMpdRenderCtl::UpMpdRenderCtl(UpMpd *dev, bool noev, int volintervalms,
+                               int volrampstep)
     : UpnpService(sTpRender, sIdRender, dev, noev), m_dev(dev), 
-      m_desiredvolume(-1)
+      m_desiredvolume(-1), m_volintervalms(volintervalms),
+      m_volrampstep(volrampstep)
 {
-    m_dev->addActionMapping(this, "SetMute", 
+    if (m_volintervalms > 0) {
+        m_timer = std::thread(&UpMpdRenderCtl::timerLoop, this);
+    } else {
+        // No timer to schedule the steps
+        m_volrampstep = 0;
+    }
+    metricsAddAction(m_dev, this, "SetMute", 
                             bind(&UpMpdRenderCtl::setMute, this, _1, _2));
-    m_dev->addActionMapping(this, "GetMute", 
+    metricsAddAction(m_dev, this, "GetMute", 
                             bind(&UpMpdRenderCtl::getMute, this, _1, _2));
-    m_dev->addActionMapping(this, "SetVolume", bind(&UpMpdRenderCtl::setVolume, 
+    metricsAddAction(m_dev, this, "SetVolume", bind(&UpMpdRenderCtl::setVolume, 
                                               this, _1, _2, false));
-    m_dev->addActionMapping(this, "GetVolume", bind(&UpMpdRenderCtl::getVolume, 
+    metricsAddAction(m_dev, this, "GetVolume", bind(&UpMpdRenderCtl::getVolume, 
                                               this, _1, _2, false));
-    m_dev->addActionMapping(this, "ListPresets", 
+    metricsAddAction(m_dev, this, "ListPresets", 
                             bind(&UpMpdRenderCtl::listPresets, this, _1, _2));
-    m_dev->addActionMapping(this, "SelectPreset", 
+    metricsAddAction(m_dev, this, "SelectPreset", 
                             bind(&UpMpdRenderCtl::selectPreset, this, _1, _2));
 }
 
@@ -69,6 +77,86 @@ enum RDCErrorCode {
   UPNP_AV_RC_INVALID_INSTANCE_ID                    = 702,
 };
 
+UpMpdRenderCtl::~UpMpdRenderCtl()
+{
+    if (m_timer.joinable()) {
+        {
+            lock_guard<mutex> lock(m_timermutex);
+            m_timerstop = true;
+        }
+        m_timercv.notify_all();
+        m_timer.join();
+    }
+}
+
+// The timer thread does not touch MPD (only the actions and the event
+// loop do, under the device lock), it just wakes the loop up, and
+// getEventData() performs the write.
+void UpMpdRenderCtl::timerLoop()
+{
+    unique_lock<mutex> lock(m_timermutex);
+    for (;;) {
+        m_timercv.wait(lock, [this] {return m_timerstop || m_timerpending;});
+        if (m_timerstop) {
+            return;
+        }
+        // The wakeup time may be moved while we wait
+        while (!m_timerstop &&
+               chrono::steady_clock::now() < m_timerwakeat) {
+            m_timercv.wait_until(lock, m_timerwakeat);
+        }
+        if (m_timerstop) {
+            return;
+        }
+        m_timerpending = false;
+        lock.unlock();
+        m_dev->loopWakeup();
+        lock.lock();
+    }
+}
+
+void UpMpdRenderCtl::wakeupAt(chrono::steady_clock::time_point when)
+{
+    {
+        lock_guard<mutex> lock(m_timermutex);
+        if (m_timerpending && m_timerwakeat <= when) {
+            return;
+        }
+        m_timerwakeat = when;
+        m_timerpending = true;
+    }
+    m_timercv.notify_all();
+}
+
+// Send the target volume to MPD if the minimum interval since the
+// previous write has elapsed, else arrange for a wakeup when it will
+// have.
+void UpMpdRenderCtl::flushvolume_i()
+{
+    if (m_desiredvolume < 0) {
+        return;
+    }
+    auto now = chrono::steady_clock::now();
+    auto due = m_lastvolwrite + chrono::milliseconds(m_volintervalms);
+    if (m_volintervalms > 0 && now < due) {
+        wakeupAt(due);
+        return;
+    }
+    int volume = m_desiredvolume;
+    if (m_volrampstep > 0) {
+        int current = m_dev->m_mpdcli->getVolume();
+        volume = max(current - m_volrampstep,
+                     min(current + m_volrampstep, volume));
+    }
+    m_dev->m_mpdcli->setVolume(volume);
+    m_lastvolwrite = now;
+    if (volume == m_desiredvolume) {
+        m_desiredvolume = -1;
+    } else if (m_volintervalms > 0) {
+        wakeupAt(now + chrono::milliseconds(m_volintervalms));
+    }
+}
+
 const std::string UpMpdRenderCtl::serviceErrString(int error) const
 {
     switch(error) {
@@ -117,10 +205,9 @@ bool UpMpdRenderCtl::getEventData(bool all, std::vector<std::string>& names,
 {
     //LOGDEB("UpMpdRenderCtl::getEventDataRendering. desiredvolume " << 
     //		   m_desiredvolume << (all?" all " : "") << endl);
-    if (m_desiredvolume >= 0) {
-        m_dev->m_mpdcli->setVolume(m_desiredvolume);
-        m_desiredvolume = -1;
-    }
+    static MetricsHistogram *evhist = metricsEventHistogram(sIdRender);
+    MetricsTimer timer(evhist);
+    flushvolume_i();
 
     unordered_map<string, string> newstate;
     rdstateMToU(newstate);
@@ -202,18 +289,12 @@ int UpMpdRenderCtl::getvolume_i()
 
 void UpMpdRenderCtl::setvolume_i(int volume)
 {
-    int previous_volume = m_dev->m_mpdcli->getVolume();
-    int delta = previous_volume - volume;
-    if (delta < 0)
-        delta = -delta;
-    LOGDEB("UpMpdRenderCtl::setVolume: volume " << volume << " delta " << 
-           delta << endl);
-    if (delta >= minVolumeDelta) {
-        m_dev->m_mpdcli->setVolume(volume);
-        m_desiredvolume = -1;
-    } else {
-        m_desiredvolume = volume;
+    LOGDEB("UpMpdRenderCtl::setVolume: volume " << volume << endl);
+    if (m_desiredvolume < 0 && volume == m_dev->m_mpdcli->getVolume()) {
+        return;
     }
+    m_desiredvolume = volume;
+    flushvolume_i();
 }
 
 void UpMpdRenderCtl::setmute_i(bool onoff)
@@ -17,7 +17,11 @@
 #ifndef _RENDERING_H_X_INCLUDED_
 #define _RENDERING_H_X_INCLUDED_
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>                       // for string
+#include <thread>
 #include <vector>                       // for vector
 #include <unordered_map>                // for unordered_map
 
@@ -30,7 +34,12 @@ using namespace UPnPP;
 
 class UpMpdRenderCtl : public UPnPProvider::UpnpService {
 public:
-    UpMpdRenderCtl(UpMpd *dev, bool noev);
+    // volintervalms: minimum interval between two volume changes
+    // sent to MPD. volrampstep: if not 0, the maximum change for
+    // one of these.
+    UpMpdRenderCtl(UpMpd *dev, bool noev, int volintervalms = 0,
+                   int volrampstep = 0);
+    ~UpMpdRenderCtl();
 
     virtual bool getEventData(bool all, std::vector<std::string>& names, 
                               std::vector<std::string>& values);
@@ -40,6 +49,9 @@ public:
     void setmute_i(bool onoff);
 private:
     bool rdstateMToU(std::unordered_map<std::string, std::string>& status);
+    void flushvolume_i();
+    void wakeupAt(std::chrono::steady_clock::time_point when);
+    void timerLoop();
     int setMute(const SoapIncoming& sc, SoapOutgoing& data);
     int getMute(const SoapIncoming& sc, SoapOutgoing& data);
     int setVolume(const SoapIncoming& sc, SoapOutgoing& data, bool isDb);
@@ -48,9 +60,22 @@ private:
     int selectPreset(const SoapIncoming& sc, SoapOutgoing& data);
 
     UpMpd *m_dev;
-    // Desired volume target. We may delay executing small volume
-    // changes to avoid saturating with small requests.
+    // Desired volume target, reported at once. Successive changes
+    // (e.g. from a control point volume knob) are merged and sent to
+    // MPD at most every m_volintervalms, possibly in steps of at most
+    // m_volrampstep.
     int m_desiredvolume;
+    int m_volintervalms;
+    int m_volrampstep;
+    std::chrono::steady_clock::time_point m_lastvolwrite;
+    // Timer thread: wakes up the event loop, which performs the
+    // writes, when a delayed one is due.
+    std::thread m_timer;
+    std::mutex m_timermutex;
+    std::condition_variable m_timercv;
+    std::chrono::steady_clock::time_point m_timerwakeat;
+    bool m_timerpending{false};
+    bool m_timerstop{false};
     // State variable storage
     std::unordered_map<std::string, std::string> m_rdstate;
 };
@@ -0,0 +1,204 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+#include "trace.hxx"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libupnpp/log.hxx"
+
+using namespace std;
+
+bool TraceSpan::o_on;
+
+struct TraceEvent {
+    const char *name;
+    string detail;
+    int64_t ts;
+    int64_t dur;
+    int tid;
+};
+
+// Ring buffer. o_next is the total number of events recorded.
+static mutex o_lock;
+static vector<TraceEvent> o_ring;
+static uint64_t o_next;
+static chrono::steady_clock::time_point o_t0;
+static string o_dumpfile;
+static int o_sigpipe[2] = {-1, -1};
+
+// Small sequential thread ids are easier to read in the trace viewer
+static int threadid()
+{
+    static atomic<int> nextid(1);
+    static thread_local int tid;
+    if (tid == 0) {
+        tid = nextid++;
+    }
+    return tid;
+}
+
+void TraceSpan::start(const char *name, const string& detail)
+{
+    m_name = name;
+    m_detail = detail;
+    m_start = chrono::steady_clock::now();
+}
+
+void TraceSpan::stop()
+{
+    auto now = chrono::steady_clock::now();
+    TraceEvent ev{m_name, std::move(m_detail),
+            chrono::duration_cast<chrono::microseconds>(m_start - o_t0).count(),
+            chrono::duration_cast<chrono::microseconds>(now - m_start).count(),
+            threadid()};
+    lock_guard<mutex> lock(o_lock);
+    o_ring[o_next++ % o_ring.size()] = std::move(ev);
+}
+
+static string jsonquote(const string& in)
+{
+    string out;
+    for (auto c : in) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char buf[10];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+string traceDump()
+{
+    vector<TraceEvent> events;
+    {
+        lock_guard<mutex> lock(o_lock);
+        if (o_ring.empty()) {
+            return "{\"traceEvents\":[]}\n";
+        }
+        // Oldest first
+        uint64_t first = o_next > o_ring.size() ? o_next - o_ring.size() : 0;
+        for (uint64_t i = first; i < o_next; i++) {
+            events.push_back(o_ring[i % o_ring.size()]);
+        }
+    }
+    string pid = to_string(getpid());
+    string out("{\"traceEvents\":[\n");
+    for (unsigned int i = 0; i < events.size(); i++) {
+        const TraceEvent& ev = events[i];
+        out += string("{\"name\":\"") + ev.name + "\",\"ph\":\"X\",\"ts\":" +
+            to_string(ev.ts) + ",\"dur\":" + to_string(ev.dur) +
+            ",\"pid\":" + pid + ",\"tid\":" + to_string(ev.tid);
+        if (!ev.detail.empty()) {
+            out += ",\"args\":{\"detail\":\"" + jsonquote(ev.detail) + "\"}";
+        }
+        out += i == events.size() - 1 ? "}\n" : "},\n";
+    }
+    out += "]}\n";
+    return out;
+}
+
+static void dumptofile()
+{
+    string data = traceDump();
+    string tmp = o_dumpfile + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "w");
+    if (nullptr == fp) {
+        LOGERR("trace: can't create " << tmp << " errno " << errno << endl);
+        return;
+    }
+    bool ok = fwrite(data.c_str(), 1, data.size(), fp) == data.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), o_dumpfile.c_str()) != 0) {
+        LOGERR("trace: can't write " << o_dumpfile << " errno " << errno <<
+               endl);
+        unlink(tmp.c_str());
+        return;
+    }
+    LOGINF("trace: wrote " << o_dumpfile << endl);
+}
+
+// The signal handler just wakes up the dump thread.
+static void onsigusr2(int)
+{
+    char c = 0;
+    int saved_errno = errno;
+    if (write(o_sigpipe[1], &c, 1) < 0) {
+        // Nothing to do
+    }
+    errno = saved_errno;
+}
+
+static void dumpworker()
+{
+    for (;;) {
+        char c;
+        ssize_t n = read(o_sigpipe[0], &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        dumptofile();
+    }
+}
+
+bool traceInit(int nspans, const string& dumpfile)
+{
+    if (nspans <= 0) {
+        return true;
+    }
+    o_ring.resize(nspans);
+    o_t0 = chrono::steady_clock::now();
+    o_dumpfile = dumpfile;
+    TraceSpan::o_on = true;
+    if (pipe(o_sigpipe) < 0) {
+        LOGERR("trace: pipe() failed, errno " << errno << endl);
+        return false;
+    }
+    std::thread(dumpworker).detach();
+    struct sigaction action;
+    action.sa_handler = onsigusr2;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR2, &action, 0) < 0) {
+        LOGERR("trace: sigaction failed, errno " << errno << endl);
+        return false;
+    }
+    LOGDEB("trace: buffer size " << nspans << ", SIGUSR2 dumps to " <<
+           dumpfile << endl);
+    return true;
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2017 J.F.Dockes
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the
+ *   Free Software Foundation, Inc.,
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+#ifndef _TRACE_H_X_INCLUDED_
+#define _TRACE_H_X_INCLUDED_
+
+// Optional request tracing. When enabled (traceInit() with a
+// non-zero size), each TraceSpan object records its name, thread and
+// lifetime in a fixed-size ring buffer, which can be dumped in Chrome
+// trace event format (chrome://tracing, Perfetto) on SIGUSR2 or
+// through the metrics HTTP server. When disabled, a span only costs a
+// test.
+
+#include <chrono>
+#include <string>
+
+// Must be called once, before any traced code can run (before
+// creating the UPnP devices). nspans is the ring buffer size (0:
+// tracing disabled). The buffer is written to dumpfile when SIGUSR2
+// is received.
+extern bool traceInit(int nspans, const std::string& dumpfile);
+
+// Return the current buffer contents as a JSON document.
+extern std::string traceDump();
+
+class TraceSpan {
+public:
+    // The name must be a string constant (or at least outlive the
+    // process): only the pointer is stored. The detail (e.g. an
+    // object id or URI) is copied.
+    TraceSpan(const char *name) {
+        if (o_on) {
+            start(name, std::string());
+        }
+    }
+    TraceSpan(const char *name, const std::string& detail) {
+        if (o_on) {
+            start(name, detail);
+        }
+    }
+    ~TraceSpan() {
+        if (m_name) {
+            stop();
+        }
+    }
+    static bool o_on;
+private:
+    void start(const char *name, const std::string& detail);
+    void stop();
+    const char *m_name{nullptr};
+    std::string m_detail;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif /* _TRACE_H_X_INCLUDED_ */
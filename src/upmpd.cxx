@@ -17,6 +17,9 @@
 
 #include "upmpd.hxx"
 
+#include <algorithm>
+#include <chrono>
+
 #include "libupnpp/device/device.hxx"   // for UpnpDevice, UpnpService
 #include "libupnpp/log.hxx"             // for LOGFAT, LOGERR, Logger, etc
 #include "libupnpp/upnpplib.hxx"        // for LibUPnP
@@ -38,6 +41,8 @@
 #include "execmd.h"
 #include "httpfs.hxx"
 #include "ohsndrcv.hxx"
+#include "trace.hxx"
+#include "metrics.hxx"
 
 using namespace std;
 using namespace std::placeholders;
@@ -55,13 +60,17 @@ UpMpd::UpMpd(const string& deviceid, const string& friendlyname,
       m_rdctl(0), m_avt(0), m_ohpr(0), m_ohpl(0), m_ohrd(0), m_ohrcv(0),
       m_sndrcv(0), m_friendlyname(friendlyname)
 {
+    m_pollmaxms = 1000 * opts.pollmaxsecs;
+    m_statusmaxagems = opts.statusmaxagems;
+    m_interpmpds = new MpdStatus;
     bool avtnoev = (m_options & upmpdNoAV) != 0; 
     // Note: the order is significant here as it will be used when
     // calling the getStatus() methods, and we want AVTransport to
     // update the mpd status for everybody
     m_avt = new UpMpdAVTransport(this, avtnoev);
     m_services.push_back(m_avt);
-    m_rdctl = new UpMpdRenderCtl(this, avtnoev);
+    m_rdctl = new UpMpdRenderCtl(this, avtnoev, opts.volintervalms,
+                                 opts.volrampstep);
     m_services.push_back(m_rdctl);
     m_services.push_back(new UpMpdConMan(this, g_protocolInfo));
 
@@ -95,6 +104,7 @@ UpMpd::UpMpd(const string& deviceid, const string& friendlyname,
                 }
             }
             parms.sc2mpdpath = opts.sc2mpdpath;
+            parms.standby = opts.scstandby;
             m_ohrcv = new OHReceiver(this, parms);
             m_services.push_back(m_ohrcv);
         }
@@ -111,6 +121,7 @@ UpMpd::UpMpd(const string& deviceid, const string& friendlyname,
 
 UpMpd::~UpMpd()
 {
+    delete m_interpmpds;
     delete m_sndrcv;
     for (vector<UpnpService*>::iterator it = m_services.begin();
          it != m_services.end(); it++) {
@@ -121,12 +132,82 @@ UpMpd::~UpMpd()
 const MpdStatus& UpMpd::getMpdStatus()
 {
     m_mpds = &m_mpdcli->getStatus();
+    m_statustime = chrono::steady_clock::now();
+    return *m_mpds;
+}
+
+// All actions and the event computation run under the device lock. A
+// wakeup after each action of an insertion series would recompute the
+// events (re-reading the MPD queue) between each, and delay any
+// interactive action arriving meanwhile: the state changes made by
+// bulk actions are only reported by the next regular loop pass.
+void UpMpd::loopWakeup()
+{
+    m_pollnow = true;
+    if (inBulkAction()) {
+        static MetricsCounter *deferredcnt =
+            metricsCounter("upmpdcli_deferred_wakeups_total", "");
+        deferredcnt->inc();
+        return;
+    }
+    UpnpDevice::loopWakeup();
+}
+
+// The event loop runs about once per second. Querying MPD each time
+// is necessary while playing (the position changes, and the track
+// may change), but mostly useless when paused or stopped for hours:
+// changes made through our own actions come with a wakeup, and only
+// changes made by another MPD client need to be detected by polling.
+const MpdStatus& UpMpd::pollMpdStatus()
+{
+    auto now = chrono::steady_clock::now();
+    bool wakeup = m_pollnow.exchange(false);
+    if (m_mpds && !wakeup && now < m_nextpoll) {
+        return *m_mpds;
+    }
+    MpdStatus::State prevstate =
+        m_mpds ? m_mpds->state : MpdStatus::MPDS_UNK;
+    getMpdStatus();
+    if (m_mpds->state == MpdStatus::MPDS_PLAY) {
+        m_pollms = 0;
+    } else if (wakeup || m_mpds->state != prevstate || m_pollms == 0) {
+        m_pollms = 1000;
+    } else {
+        m_pollms = std::min(2 * m_pollms, std::max(m_pollmaxms, 1000));
+    }
+    m_nextpoll = now + chrono::milliseconds(m_pollms);
     return *m_mpds;
 }
 
+const MpdStatus& UpMpd::getMpdStatusInterpolated()
+{
+    if (m_mpds == 0) {
+        return getMpdStatus();
+    }
+    int agems = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - m_statustime).count();
+    if (agems >= m_statusmaxagems || m_pollnow) {
+        return getMpdStatus();
+    }
+    static MetricsCounter *cachedcnt =
+        metricsCounter("upmpdcli_mpd_status_cached_total", "");
+    cachedcnt->inc();
+    if (m_mpds->state != MpdStatus::MPDS_PLAY) {
+        return *m_mpds;
+    }
+    *m_interpmpds = *m_mpds;
+    m_interpmpds->songelapsedms += agems;
+    if (m_interpmpds->songlenms > 0 &&
+        m_interpmpds->songelapsedms > m_interpmpds->songlenms) {
+        m_interpmpds->songelapsedms = m_interpmpds->songlenms;
+    }
+    return *m_interpmpds;
+}
+
 bool UpMpd::checkContentFormat(const string& uri, const string& didl,
                                UpSong *ups)
 {
+    TraceSpan span("UpMpd::checkContentFormat", uri);
     UPnPClient::UPnPDirContent dirc;
     if (!dirc.parse(didl) || dirc.m_items.size() == 0) {
         LOGERR("checkContentFormat: didl parse failed\n");
@@ -18,6 +18,8 @@
 #ifndef _UPMPD_H_X_INCLUDED_
 #define _UPMPD_H_X_INCLUDED_
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -75,16 +77,25 @@ public:
     };
     struct Options {
         Options() : options(upmpdNone), ohmetasleep(0), schttpport(0),
-            sendermpdport(0) {}
+            scstandby(true), sendermpdport(0), pollmaxsecs(8),
+            statusmaxagems(2000), volintervalms(250), volrampstep(0) {}
         unsigned int options;
         std::string  cachefn;
         std::string  radioconf;
         unsigned int ohmetasleep;
         int schttpport;
         std::string scplaymethod;
+        bool scstandby;
         std::string sc2mpdpath;
         std::string senderpath;
         int sendermpdport;
+        // Max interval between MPD status polls when not playing
+        int pollmaxsecs;
+        // Max age of the status used by the position actions
+        int statusmaxagems;
+        // Volume changes merging and ramping (see UpMpdRenderCtl)
+        int volintervalms;
+        int volrampstep;
     };
     UpMpd(const std::string& deviceid, const std::string& friendlyname,
           ohProductDesc_t& ohProductDesc,
@@ -100,6 +111,22 @@ public:
             return *m_mpds;
         }
     }
+    // Status for the event loop. MPD is queried at every pass while
+    // playing, or after a wakeup or state change, then less and less
+    // often while nothing happens, up to pollmaxsecs.
+    const MpdStatus& pollMpdStatus();
+    // Status for the actions which control points call repeatedly to
+    // update a position display (GetPositionInfo, GetTransportInfo,
+    // Time). If the last status is less than statusmaxagems old and
+    // no change was signalled since, it is returned with the elapsed
+    // time advanced by its age (while playing) instead of querying
+    // MPD again. The event loop keeps it fresh while playing.
+    const MpdStatus& getMpdStatusInterpolated();
+    // Hides UpnpDevice::loopWakeup(): also forces an MPD poll on the
+    // next pass. Called after all state-changing actions. The wakeups
+    // from bulk actions (inBulkAction()) are merged into the next
+    // regular pass.
+    void loopWakeup();
 
     const std::string& getMetaCacheFn() {
         return m_mcachefn;
@@ -114,6 +141,15 @@ public:
 private:
     MPDCli *m_mpdcli;
     const MpdStatus *m_mpds;
+    // Adaptive polling state (see pollMpdStatus()). m_pollnow is set
+    // from other threads.
+    std::chrono::steady_clock::time_point m_statustime;
+    std::chrono::steady_clock::time_point m_nextpoll;
+    int m_pollms{0};
+    int m_pollmaxms;
+    int m_statusmaxagems;
+    std::atomic<bool> m_pollnow{true};
+    MpdStatus *m_interpmpds{nullptr};
     unsigned int m_options;
     std::string m_mcachefn;
     UpMpdRenderCtl *m_rdctl;
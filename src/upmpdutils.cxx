@@ -39,6 +39,7 @@
 #define O_STREAMING 0
 #endif
 #include <fstream>                      // for operator<<, basic_ostream, etc
+#include <mutex>
 #include <sstream>                      // for ostringstream
 #include <utility>                      // for pair
 #include <vector>                       // for vector
@@ -134,7 +135,58 @@ diffmaps(const unordered_map<string, string>& old,
         ss << "<" #TAG ">" << SoapHelp::xmlQuote(DEF) << "</" #TAG ">"; \
     }
 
-string UpSong::didl()
+static const unordered_map<string, unsigned int> filterprops {
+    {"dc:creator", DIDLP_CREATOR},
+    {"upnp:artist", DIDLP_ARTIST},
+    {"upnp:album", DIDLP_ALBUM},
+    {"upnp:genre", DIDLP_GENRE},
+    {"upnp:originalTrackNumber", DIDLP_TRACKNUM},
+    {"upnp:albumArtURI", DIDLP_ARTURI},
+    {"upnp:userAnnotation", DIDLP_ANNOT},
+    {"res", DIDLP_RES},
+    {"res@protocolInfo", DIDLP_RES},
+    {"res@duration", DIDLP_RES | DIDLP_RESDURATION},
+    {"res@size", DIDLP_RES | DIDLP_RESSIZE},
+    {"res@bitrate", DIDLP_RES | DIDLP_RESBITRATE},
+    {"res@sampleFrequency", DIDLP_RES | DIDLP_RESSAMPLEFREQ},
+    {"res@nrAudioChannels", DIDLP_RES | DIDLP_RESCHANNELS},
+};
+
+unsigned int didlFilterMask(const string& filter)
+{
+    static mutex cachelock;
+    static unordered_map<string, unsigned int> cache;
+    lock_guard<mutex> lock(cachelock);
+    auto it = cache.find(filter);
+    if (it != cache.end()) {
+        return it->second;
+    }
+
+    unsigned int mask = 0;
+    vector<string> props;
+    stringToTokens(filter, props, ", ");
+    if (props.empty()) {
+        mask = DIDLP_ALL;
+    }
+    for (const auto& prop : props) {
+        if (prop == "*") {
+            mask = DIDLP_ALL;
+            break;
+        }
+        auto pit = filterprops.find(prop);
+        if (pit != filterprops.end()) {
+            mask |= pit->second;
+        }
+    }
+    // Don't let a misbehaving client grow the cache forever
+    if (cache.size() >= 100) {
+        cache.clear();
+    }
+    cache[filter] = mask;
+    return mask;
+}
+
+string UpSong::didl(unsigned int props)
 {
     ostringstream ss;
     string typetag;
@@ -151,34 +203,207 @@ string UpSong::didl()
     if (iscontainer) {
         UPNPXMLD(upnpClass, upnp:class, "object.container");
         // tracknum is reused for annotations for containers
-        ss << (tracknum.empty() ? string() :
-               string("<upnp:userAnnotation>" + SoapHelp::xmlQuote(tracknum) +
-		    "</upnp:userAnnotation>"));
-	    
+        if (props & DIDLP_ANNOT) {
+            UPNPXML(tracknum, upnp:userAnnotation);
+        }
     } else {
         UPNPXMLD(upnpClass, upnp:class, "object.item.audioItem.musicTrack");
-	UPNPXML(genre, upnp:genre);
-	UPNPXML(album, upnp:album);
-	UPNPXML(tracknum, upnp:originalTrackNumber);
-
-	ss << "<res " <<
-            "duration=\"" << upnpduration(duration_secs * 1000)  << "\" " <<
-            "size=\"" << lltodecstr(size)                        << "\" " <<
-            "bitrate=\"" << SoapHelp::i2s(bitrate)               << "\" " <<
-	    "sampleFrequency=\"" << SoapHelp::i2s(samplefreq)    << "\" " <<
-            "nrAudioChannels=\"" << SoapHelp::i2s(channels)      << "\" " <<
-	    "protocolInfo=\"http-get:*:" << mime << ":* "        << "\" >"<<
-            SoapHelp::xmlQuote(uri) <<
-            "</res>";
-    }
-    UPNPXML(artist, dc:creator);
-    UPNPXML(artist, upnp:artist);
-    UPNPXML(artUri, upnp:albumArtURI);
+        if (props & DIDLP_GENRE) {
+            UPNPXML(genre, upnp:genre);
+        }
+        if (props & DIDLP_ALBUM) {
+            UPNPXML(album, upnp:album);
+        }
+        if (props & DIDLP_TRACKNUM) {
+            UPNPXML(tracknum, upnp:originalTrackNumber);
+        }
+        if (props & DIDLP_RES) {
+            ss << "<res ";
+            if (props & DIDLP_RESDURATION) {
+                ss << "duration=\"" << upnpduration(duration_secs * 1000)
+                   << "\" ";
+            }
+            if (props & DIDLP_RESSIZE) {
+                ss << "size=\"" << lltodecstr(size) << "\" ";
+            }
+            if (props & DIDLP_RESBITRATE) {
+                ss << "bitrate=\"" << SoapHelp::i2s(bitrate) << "\" ";
+            }
+            if (props & DIDLP_RESSAMPLEFREQ) {
+                ss << "sampleFrequency=\"" << SoapHelp::i2s(samplefreq)
+                   << "\" ";
+            }
+            if (props & DIDLP_RESCHANNELS) {
+                ss << "nrAudioChannels=\"" << SoapHelp::i2s(channels)
+                   << "\" ";
+            }
+            ss << "protocolInfo=\"http-get:*:" << mime << ":* " << "\" >" <<
+                SoapHelp::xmlQuote(uri) << "</res>";
+        }
+    }
+    if (props & DIDLP_CREATOR) {
+        UPNPXML(artist, dc:creator);
+    }
+    if (props & DIDLP_ARTIST) {
+        UPNPXML(artist, upnp:artist);
+    }
+    if (props & DIDLP_ARTURI) {
+        UPNPXML(artUri, upnp:albumArtURI);
+    }
     ss << "</" << typetag << ">";
     LOGDEB1("UpSong::didl(): " << ss.str() << endl);
     return ss.str();
 }
 
+CompactSongList::CompactSongList(const vector<UpSong>& songs)
+{
+    // Repeated values, with their offsets. Only needed while building.
+    unordered_map<string, uint32_t> shared;
+    // Offset 0 is the empty string
+    m_strs.push_back(0);
+    auto store = [this](const string& value) -> uint32_t {
+        if (value.empty()) {
+            return 0;
+        }
+        uint32_t offs = m_strs.size();
+        m_strs.append(value.c_str(), value.size() + 1);
+        return offs;
+    };
+    auto storeshared = [this, &shared, &store](const string& value) {
+        if (value.empty()) {
+            return uint32_t(0);
+        }
+        auto it = shared.find(value);
+        if (it != shared.end()) {
+            return it->second;
+        }
+        uint32_t offs = store(value);
+        shared[value] = offs;
+        return offs;
+    };
+
+    m_recs.resize(songs.size());
+    for (size_t i = 0; i < songs.size(); i++) {
+        const UpSong& song = songs[i];
+        Rec& rec = m_recs[i];
+        rec.strs[SId] = store(song.id);
+        rec.strs[SParentId] = storeshared(song.parentid);
+        rec.strs[SUri] = store(song.uri);
+        rec.strs[SName] = storeshared(song.name);
+        rec.strs[SArtist] = storeshared(song.artist);
+        rec.strs[SAlbum] = storeshared(song.album);
+        rec.strs[STitle] = store(song.title);
+        rec.strs[STracknum] = storeshared(song.tracknum);
+        rec.strs[SGenre] = storeshared(song.genre);
+        rec.strs[SArtUri] = storeshared(song.artUri);
+        rec.strs[SUpnpClass] = storeshared(song.upnpClass);
+        rec.strs[SMime] = storeshared(song.mime);
+        rec.duration_secs = song.duration_secs;
+        rec.bitrate = song.bitrate;
+        rec.samplefreq = song.samplefreq;
+        rec.mpdid = song.mpdid;
+        rec.size = song.size;
+        rec.channels = song.channels;
+        rec.iscontainer = song.iscontainer;
+        rec.searchable = song.searchable;
+    }
+    m_strs.shrink_to_fit();
+}
+
+// Image header. The record size changes if the Rec structure is
+// modified, which invalidates the stored data.
+struct CompactSongListHeader {
+    uint32_t nrecs;
+    uint32_t recsize;
+    uint32_t strslen;
+};
+
+void CompactSongList::serialize(string& out) const
+{
+    CompactSongListHeader hd;
+    hd.nrecs = m_recs.size();
+    hd.recsize = sizeof(Rec);
+    hd.strslen = m_strs.size();
+    out.reserve(sizeof(hd) + m_recs.size() * sizeof(Rec) + m_strs.size());
+    out.assign((const char *)&hd, sizeof(hd));
+    if (!m_recs.empty()) {
+        out.append((const char *)&m_recs[0], m_recs.size() * sizeof(Rec));
+    }
+    out.append(m_strs);
+}
+
+bool CompactSongList::unserialize(const string& data)
+{
+    m_recs.clear();
+    m_strs.clear();
+    CompactSongListHeader hd;
+    if (data.size() < sizeof(hd)) {
+        return false;
+    }
+    memcpy(&hd, data.c_str(), sizeof(hd));
+    if (hd.recsize != sizeof(Rec) ||
+        data.size() != sizeof(hd) + uint64_t(hd.nrecs) * sizeof(Rec) +
+        hd.strslen) {
+        return false;
+    }
+    // The strings must be null-terminated, and the empty string at 0
+    const char *strs = data.c_str() + sizeof(hd) + hd.nrecs * sizeof(Rec);
+    if (hd.strslen == 0 || strs[0] != 0 || strs[hd.strslen - 1] != 0) {
+        return false;
+    }
+    m_recs.resize(hd.nrecs);
+    if (hd.nrecs) {
+        memcpy(&m_recs[0], data.c_str() + sizeof(hd), hd.nrecs * sizeof(Rec));
+    }
+    for (const auto& rec : m_recs) {
+        for (int i = 0; i < SNFIELDS; i++) {
+            if (rec.strs[i] >= hd.strslen) {
+                m_recs.clear();
+                return false;
+            }
+        }
+    }
+    m_strs.assign(strs, hd.strslen);
+    return true;
+}
+
+UpSong CompactSongList::get(size_t i) const
+{
+    const Rec& rec = m_recs[i];
+    const char *strs = m_strs.c_str();
+    UpSong song;
+    song.id = strs + rec.strs[SId];
+    song.parentid = strs + rec.strs[SParentId];
+    song.uri = strs + rec.strs[SUri];
+    song.name = strs + rec.strs[SName];
+    song.artist = strs + rec.strs[SArtist];
+    song.album = strs + rec.strs[SAlbum];
+    song.title = strs + rec.strs[STitle];
+    song.tracknum = strs + rec.strs[STracknum];
+    song.genre = strs + rec.strs[SGenre];
+    song.artUri = strs + rec.strs[SArtUri];
+    song.upnpClass = strs + rec.strs[SUpnpClass];
+    song.mime = strs + rec.strs[SMime];
+    song.duration_secs = rec.duration_secs;
+    song.bitrate = rec.bitrate;
+    song.samplefreq = rec.samplefreq;
+    song.mpdid = rec.mpdid;
+    song.size = rec.size;
+    song.channels = rec.channels;
+    song.iscontainer = rec.iscontainer;
+    song.searchable = rec.searchable;
+    return song;
+}
+
+void CompactSongList::get(vector<UpSong>& songs) const
+{
+    songs.clear();
+    songs.reserve(m_recs.size());
+    for (size_t i = 0; i < m_recs.size(); i++) {
+        songs.push_back(get(i));
+    }
+}
+
 const string& headDIDL()
 {
     static const string head(